@@ -75,6 +75,13 @@ static void open_filesystem(char *device, int open_flags, blk_t superblock,
 			"opening read-only because of catastrophic mode");
 		open_flags &= ~EXT2_FLAG_RW;
 	}
+
+	/*
+	 * Most commands only look at a few groups' bitmaps, so only
+	 * read those in as they are needed; and most only change the
+	 * free counts, which don't need to go out to the backups.
+	 */
+	open_flags |= EXT2_FLAG_LAZY_BITMAPS | EXT2_FLAG_DEFER_BACKUPS;
 	
 	retval = ext2fs_open(device, open_flags, superblock, blocksize,
 			     unix_io_manager, &current_fs);
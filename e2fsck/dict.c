@@ -979,6 +979,70 @@ static void dnode_free(dnode_t *node, void *context EXT2FS_ATTR((unused)))
     free(node);
 }
 
+/*
+ * Node pools (an e2fsprogs addition).  A dictionary which is going to
+ * hold a great many nodes can get them from a pool, which hands them
+ * out of large chunks instead of calling malloc() for each one.  This
+ * avoids the per-node malloc overhead, and nodes allocated one after
+ * the other end up next to each other in memory.  Nodes given back
+ * to the pool go on a free list; the chunks themselves are only freed
+ * by dnode_pool_destroy().
+ */
+
+#define DNODE_POOL_CHUNK 1024
+
+struct dnode_pool_chunk {
+    struct dnode_pool_chunk *next;
+    dnode_t nodes[DNODE_POOL_CHUNK];
+};
+
+void dnode_pool_init(dnode_pool_t *pool)
+{
+    pool->dict_chunks = NULL;
+    pool->dict_freelist = NULL;
+    pool->dict_unused = 0;
+}
+
+dnode_t *dnode_pool_alloc(void *context)
+{
+    dnode_pool_t *pool = context;
+    struct dnode_pool_chunk *chunk;
+    dnode_t *node = pool->dict_freelist;
+
+    if (node) {
+	pool->dict_freelist = node->left;
+	return node;
+    }
+    if (pool->dict_unused == 0) {
+	chunk = malloc(sizeof *chunk);
+	if (!chunk)
+	    return NULL;
+	chunk->next = pool->dict_chunks;
+	pool->dict_chunks = chunk;
+	pool->dict_unused = DNODE_POOL_CHUNK;
+    }
+    return &pool->dict_chunks->nodes[DNODE_POOL_CHUNK - pool->dict_unused--];
+}
+
+void dnode_pool_free(dnode_t *node, void *context)
+{
+    dnode_pool_t *pool = context;
+
+    node->left = pool->dict_freelist;
+    pool->dict_freelist = node;
+}
+
+void dnode_pool_destroy(dnode_pool_t *pool)
+{
+    struct dnode_pool_chunk *chunk, *next;
+
+    for (chunk = pool->dict_chunks; chunk; chunk = next) {
+	next = chunk->next;
+	free(chunk);
+    }
+    dnode_pool_init(pool);
+}
+
 dnode_t *dnode_create(void *data)
 {
     dnode_t *new = malloc(sizeof *new);
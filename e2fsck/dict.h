@@ -77,6 +77,21 @@ typedef struct dict_t {
 
 typedef void (*dnode_process_t)(dict_t *, dnode_t *, void *);
 
+/*
+ * A pool which dictionaries can allocate their nodes from, by passing
+ * dnode_pool_alloc, dnode_pool_free and the pool to dict_set_allocator
+ */
+
+typedef struct dnode_pool_t {
+#if defined(DICT_IMPLEMENTATION) || !defined(KAZLIB_OPAQUE_DEBUG)
+    struct dnode_pool_chunk *dict_chunks;
+    dnode_t *dict_freelist;
+    int dict_unused;
+#else
+    int dict_dummy;
+#endif
+} dnode_pool_t;
+
 typedef struct dict_load_t {
 #if defined(DICT_IMPLEMENTATION) || !defined(KAZLIB_OPAQUE_DEBUG)
     dict_t *dict_dictptr;
@@ -123,6 +138,10 @@ extern void dict_load_begin(dict_load_t *, dict_t *);
 extern void dict_load_next(dict_load_t *, dnode_t *, const void *);
 extern void dict_load_end(dict_load_t *);
 extern void dict_merge(dict_t *, dict_t *);
+extern void dnode_pool_init(dnode_pool_t *);
+extern dnode_t *dnode_pool_alloc(void *);
+extern void dnode_pool_free(dnode_t *, void *);
+extern void dnode_pool_destroy(dnode_pool_t *);
 
 #if defined(DICT_IMPLEMENTATION) || !defined(KAZLIB_OPAQUE_DEBUG)
 #ifdef KAZLIB_SIDEEFFECT_DEBUG
@@ -30,17 +30,18 @@ void e2fsck_add_dir_info(e2fsck_t ctx, ext2_ino_t ino, ext2_ino_t parent)
 			num_dirs = 1024;	/* Guess */
 		ctx->dir_info_size = num_dirs + 10;
 		ctx->dir_info  = (struct dir_info *)
-			e2fsck_allocate_memory(ctx, ctx->dir_info_size
-					       * sizeof (struct dir_info),
-					       "directory map");
+			e2fsck_allocate_scratch_memory(ctx, ctx->dir_info_size
+						       * sizeof (struct dir_info),
+						       "directory map");
 	}
 	
 	if (ctx->dir_info_count >= ctx->dir_info_size) {
 		old_size = ctx->dir_info_size * sizeof(struct dir_info);
 		ctx->dir_info_size += 10;
-		retval = ext2fs_resize_mem(old_size, ctx->dir_info_size *
-					   sizeof(struct dir_info),
-					   &ctx->dir_info);
+		retval = ext2fs_resize_scratch_mem(old_size,
+						   ctx->dir_info_size *
+						   sizeof(struct dir_info),
+						   &ctx->dir_info);
 		if (retval) {
 			ctx->dir_info_size -= 10;
 			return;
@@ -110,7 +111,7 @@ struct dir_info *e2fsck_get_dir_info(e2fsck_t ctx, ext2_ino_t ino)
 void e2fsck_free_dir_info(e2fsck_t ctx)
 {
 	if (ctx->dir_info) {
-		ext2fs_free_mem(&ctx->dir_info);
+		ext2fs_free_scratch_mem(&ctx->dir_info);
 		ctx->dir_info = 0;
 	}
 	ctx->dir_info_size = 0;
@@ -27,17 +27,19 @@ void e2fsck_add_dx_dir(e2fsck_t ctx, ext2_ino_t ino, int num_blocks)
 		ctx->dx_dir_info_count = 0;
 		ctx->dx_dir_info_size = 100; /* Guess */
 		ctx->dx_dir_info  = (struct dx_dir_info *)
-			e2fsck_allocate_memory(ctx, ctx->dx_dir_info_size
-					       * sizeof (struct dx_dir_info),
-					       "directory map");
+			e2fsck_allocate_scratch_memory(ctx,
+						       ctx->dx_dir_info_size
+						       * sizeof (struct dx_dir_info),
+						       "directory map");
 	}
 	
 	if (ctx->dx_dir_info_count >= ctx->dx_dir_info_size) {
 		old_size = ctx->dx_dir_info_size * sizeof(struct dx_dir_info);
 		ctx->dx_dir_info_size += 10;
-		retval = ext2fs_resize_mem(old_size, ctx->dx_dir_info_size *
-					   sizeof(struct dx_dir_info),
-					   &ctx->dx_dir_info);
+		retval = ext2fs_resize_scratch_mem(old_size,
+						   ctx->dx_dir_info_size *
+						   sizeof(struct dx_dir_info),
+						   &ctx->dx_dir_info);
 		if (retval) {
 			ctx->dx_dir_info_size -= 10;
 			return;
@@ -121,7 +123,7 @@ void e2fsck_free_dx_dir_info(e2fsck_t ctx)
 				dir->dx_block = 0;
 			}
 		}
-		ext2fs_free_mem(&ctx->dx_dir_info);
+		ext2fs_free_scratch_mem(&ctx->dx_dir_info);
 		ctx->dx_dir_info = 0;
 	}
 	ctx->dx_dir_info_size = 0;
@@ -135,6 +135,15 @@ struct resource_track {
 };
 #endif
 
+/*
+ * A child process which does part of the work of a pass; see
+ * e2fsck_start_workers().
+ */
+struct e2fsck_worker {
+	pid_t	pid;
+	int	fd;		/* Pipe which the worker writes to */
+};
+
 /*
  * E2fsck options
  */
@@ -167,6 +176,8 @@ struct resource_track {
 					* specified by the user */
 #define E2F_FLAG_RESTARTED	0x0200 /* E2fsck has been restarted */
 #define E2F_FLAG_RESIZE_INODE	0x0400 /* Request to recreate resize inode */
+#define E2F_FLAG_WORKER		0x0800 /* Running in a worker process */
+#define E2F_FLAG_WORKER_PUNT	0x1000 /* Worker must leave it to the parent */
 
 /*
  * Defines for indicating the e2fsck pass number
@@ -220,6 +231,7 @@ struct e2fsck_struct {
 
 	ext2fs_block_bitmap block_found_map; /* Blocks which are in use */
 	ext2fs_block_bitmap block_dup_map; /* Blks referenced more than once */
+	ext2_ino_t dup_ino_limit; /* No inode past this uses a dup block */
 	ext2fs_block_bitmap block_ea_map; /* Blocks which are used by EA's */
 
 	/*
@@ -328,6 +340,12 @@ struct e2fsck_struct {
 	time_t now;
 
 	int ext_attr_ver;
+	int rehash_workers;	/* Processes rebuilding directories */
+#define MAX_REHASH_WORKERS	64
+	int pass1_workers;	/* Processes checking inodes in pass 1 */
+#define MAX_PASS1_WORKERS	64
+	int pass2_workers;	/* Processes checking directories in pass 2 */
+#define MAX_PASS2_WORKERS	64
 
 	profile_t	profile;
 
@@ -447,6 +465,8 @@ void swap_filesys(e2fsck_t ctx);
 /* util.c */
 extern void *e2fsck_allocate_memory(e2fsck_t ctx, unsigned int size,
 				    const char *description);
+extern void *e2fsck_allocate_scratch_memory(e2fsck_t ctx, unsigned int size,
+					    const char *description);
 extern int ask(e2fsck_t ctx, const char * string, int def);
 extern int ask_yn(const char * string, int def);
 extern void fatal_error(e2fsck_t ctx, const char * fmt_string);
@@ -470,6 +490,15 @@ extern void mtrace_print(char *mesg);
 extern blk_t get_backup_sb(e2fsck_t ctx, ext2_filsys fs,
 			   const char *name, io_manager manager);
 extern int ext2_file_type(unsigned int mode);
+extern int e2fsck_read_all(int fd, void *buf, size_t count);
+extern int e2fsck_write_all(int fd, const void *buf, size_t count);
+extern int e2fsck_start_workers(e2fsck_t ctx, struct e2fsck_worker *workers,
+				int num_workers,
+				int (*func)(e2fsck_t ctx, int worker, int fd,
+					    void *priv_data),
+				void *priv_data);
+extern void e2fsck_stop_workers(struct e2fsck_worker *workers,
+				int num_workers);
 
 /* unix.c */
 extern void e2fsck_clear_progbar(e2fsck_t ctx);
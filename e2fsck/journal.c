@@ -65,6 +65,186 @@ int journal_bmap(journal_t *journal, blk_t block, unsigned long *phys)
 #endif
 }
 
+/*
+ * Blocks written back to the filesystem while the journal is being
+ * replayed are gathered in the replay cache instead of being written
+ * one at a time.  A block which is replayed more than once only keeps
+ * its last contents, and when the cache is flushed (because it is
+ * full, or at the end of recovery) the blocks are written out in
+ * block number order, with runs of adjacent blocks combined into a
+ * single write.
+ */
+#define REPLAY_CACHE_SIZE	(32 * 1024 * 1024)
+#define REPLAY_WRITE_MAX	256
+
+struct replay_cache {
+	e2fsck_t	ctx;
+	io_channel	io;
+	int		blocksize;
+	int		count, max;
+	int		hash_mask;
+	blk_t		*blocks;
+	int		*hash;		/* index into blocks + 1, or 0 */
+	int		*order;
+	char		*buf;
+	char		*write_buf;
+};
+
+static struct replay_cache *replay_cache;
+
+static void free_replay_cache(void)
+{
+	struct replay_cache *rc = replay_cache;
+
+	if (!rc)
+		return;
+	if (rc->blocks)
+		ext2fs_free_mem(&rc->blocks);
+	if (rc->hash)
+		ext2fs_free_mem(&rc->hash);
+	if (rc->order)
+		ext2fs_free_mem(&rc->order);
+	if (rc->buf)
+		ext2fs_free_mem(&rc->buf);
+	if (rc->write_buf)
+		ext2fs_free_mem(&rc->write_buf);
+	ext2fs_free_mem(&replay_cache);
+}
+
+/*
+ * Set up the replay cache for up to max_blocks blocks.  If we can't
+ * get the memory, the replayed blocks are just written one at a time.
+ */
+static void setup_replay_cache(e2fsck_t ctx, int max_blocks)
+{
+	struct replay_cache *rc;
+	int	hash_size = 16;
+
+	if (ext2fs_get_mem(sizeof(struct replay_cache), &rc))
+		return;
+	memset(rc, 0, sizeof(struct replay_cache));
+	replay_cache = rc;
+
+	rc->ctx = ctx;
+	rc->io = ctx->fs->io;
+	rc->blocksize = ctx->fs->blocksize;
+	rc->max = REPLAY_CACHE_SIZE / rc->blocksize;
+	if (max_blocks > 0 && rc->max > max_blocks)
+		rc->max = max_blocks;
+	while (hash_size < 2 * rc->max)
+		hash_size <<= 1;
+	rc->hash_mask = hash_size - 1;
+
+	if (ext2fs_get_mem(rc->max * sizeof(blk_t), &rc->blocks) ||
+	    ext2fs_get_mem(hash_size * sizeof(int), &rc->hash) ||
+	    ext2fs_get_mem(rc->max * sizeof(int), &rc->order) ||
+	    ext2fs_get_mem((unsigned long) rc->max * rc->blocksize,
+			   &rc->buf) ||
+	    ext2fs_get_mem(REPLAY_WRITE_MAX * rc->blocksize,
+			   &rc->write_buf)) {
+		free_replay_cache();
+		return;
+	}
+	memset(rc->hash, 0, hash_size * sizeof(int));
+}
+
+/*
+ * Return the hash slot which holds blocknr, or the empty slot where
+ * it should go.
+ */
+static int *replay_cache_slot(blk_t blocknr)
+{
+	struct replay_cache *rc = replay_cache;
+	int	i = (blocknr * 0x9E3779B1U) & rc->hash_mask;
+
+	while (rc->hash[i] && rc->blocks[rc->hash[i] - 1] != blocknr)
+		i = (i + 1) & rc->hash_mask;
+	return &rc->hash[i];
+}
+
+static EXT2_QSORT_TYPE replay_order_cmp(const void *a, const void *b)
+{
+	blk_t	blk_a = replay_cache->blocks[*(const int *) a];
+	blk_t	blk_b = replay_cache->blocks[*(const int *) b];
+
+	if (blk_a < blk_b)
+		return -1;
+	return blk_a > blk_b;
+}
+
+static errcode_t flush_replay_cache(void)
+{
+	struct replay_cache *rc = replay_cache;
+	errcode_t	retval, ret = 0;
+	blk_t		first;
+	int		i, n;
+
+	if (!rc || !rc->count)
+		return 0;
+
+	for (i = 0; i < rc->count; i++)
+		rc->order[i] = i;
+	qsort(rc->order, rc->count, sizeof(int), replay_order_cmp);
+
+	for (i = 0; i < rc->count; i += n) {
+		first = rc->blocks[rc->order[i]];
+		for (n = 0; n < REPLAY_WRITE_MAX && i + n < rc->count &&
+			     rc->blocks[rc->order[i + n]] == first + n; n++)
+			memcpy(rc->write_buf + n * rc->blocksize,
+			       rc->buf + rc->order[i + n] * rc->blocksize,
+			       rc->blocksize);
+		jfs_debug(3, "writing blocks %lu-%lu\n",
+			  (unsigned long) first, (unsigned long) first + n - 1);
+		retval = io_channel_write_blk(rc->io, first, n,
+					      rc->write_buf);
+		if (retval) {
+			com_err(rc->ctx->device_name, retval,
+				"while writing blocks %lu-%lu\n",
+				(unsigned long) first,
+				(unsigned long) first + n - 1);
+			ret = retval;
+		}
+	}
+	rc->count = 0;
+	memset(rc->hash, 0, (rc->hash_mask + 1) * sizeof(int));
+	return ret;
+}
+
+static errcode_t replay_cache_write(struct buffer_head *bh)
+{
+	struct replay_cache *rc = replay_cache;
+	errcode_t	retval;
+	int		*slot;
+
+	slot = replay_cache_slot(bh->b_blocknr);
+	if (!*slot) {
+		if (rc->count >= rc->max) {
+			retval = flush_replay_cache();
+			if (retval)
+				return retval;
+			slot = replay_cache_slot(bh->b_blocknr);
+		}
+		rc->blocks[rc->count] = bh->b_blocknr;
+		*slot = ++rc->count;
+	}
+	memcpy(rc->buf + (*slot - 1) * rc->blocksize, bh->b_data,
+	       rc->blocksize);
+	return 0;
+}
+
+static int replay_cache_read(struct buffer_head *bh)
+{
+	struct replay_cache *rc = replay_cache;
+	int		*slot;
+
+	slot = replay_cache_slot(bh->b_blocknr);
+	if (!*slot)
+		return 0;
+	memcpy(bh->b_data, rc->buf + (*slot - 1) * rc->blocksize,
+	       rc->blocksize);
+	return 1;
+}
+
 struct buffer_head *getblk(kdev_t kdev, blk_t blocknr, int blocksize)
 {
 	struct buffer_head *bh;
@@ -96,6 +276,8 @@ void sync_blockdev(kdev_t kdev)
 	else 
 		io = kdev->k_ctx->journal_io;
 
+	if (replay_cache && replay_cache->io == io)
+		flush_replay_cache();
 	io_channel_flush(io);
 }
 
@@ -109,6 +291,11 @@ void ll_rw_block(int rw, int nr, struct buffer_head *bhp[])
 		if (rw == READ && !bh->b_uptodate) {
 			jfs_debug(3, "reading block %lu/%p\n", 
 				  (unsigned long) bh->b_blocknr, (void *) bh);
+			if (replay_cache && bh->b_io == replay_cache->io &&
+			    replay_cache_read(bh)) {
+				bh->b_uptodate = 1;
+				continue;
+			}
 			retval = io_channel_read_blk(bh->b_io, 
 						     bh->b_blocknr,
 						     1, bh->b_data);
@@ -123,9 +310,12 @@ void ll_rw_block(int rw, int nr, struct buffer_head *bhp[])
 		} else if (rw == WRITE && bh->b_dirty) {
 			jfs_debug(3, "writing block %lu/%p\n", 
 				  (unsigned long) bh->b_blocknr, (void *) bh);
-			retval = io_channel_write_blk(bh->b_io, 
-						      bh->b_blocknr,
-						      1, bh->b_data);
+			if (replay_cache && bh->b_io == replay_cache->io)
+				retval = replay_cache_write(bh);
+			else
+				retval = io_channel_write_blk(bh->b_io,
+							      bh->b_blocknr,
+							      1, bh->b_data);
 			if (retval) {
 				com_err(bh->b_ctx->device_name, retval,
 					"while writing block %lu\n", 
@@ -777,7 +967,16 @@ static errcode_t recover_ext3_journal(e2fsck_t ctx)
 	if (retval)
 		goto errout;
 	
+	/*
+	 * Only the blocks replayed into the filesystem go through the
+	 * replay cache; it is flushed by the sync_blockdev() at the
+	 * end of journal_recover().
+	 */
+	setup_replay_cache(ctx, journal->j_maxlen);
 	retval = -journal_recover(journal);
+	if (!retval)
+		retval = flush_replay_cache();
+	free_replay_cache();
 	if (retval)
 		goto errout;
 	
@@ -40,6 +40,8 @@
 #define _GNU_SOURCE 1 /* get strnlen() */
 #include <string.h>
 #include <time.h>
+#include <limits.h>
+#include <stddef.h>
 #ifdef HAVE_ERRNO_H
 #include <errno.h>
 #endif
@@ -70,8 +72,13 @@ static void mark_inode_bad(e2fsck_t ctx, ino_t ino);
 static void handle_fs_bad_blocks(e2fsck_t ctx);
 static void process_inodes(e2fsck_t ctx, char *block_buf);
 static EXT2_QSORT_TYPE process_inode_cmp(const void *a, const void *b);
+static int inodes_to_process_size(e2fsck_t ctx);
 static errcode_t scan_callback(ext2_filsys fs, ext2_inode_scan scan,
 				  dgrp_t group, void * priv_data);
+static errcode_t end_group(e2fsck_t ctx, char *block_buf, dgrp_t group);
+static void check_inode(e2fsck_t ctx, struct problem_context *pctx,
+			char *block_buf, int busted_fs_time);
+static void mark_block_used(e2fsck_t ctx, blk_t block);
 static void adjust_extattr_refcount(e2fsck_t ctx, ext2_refcount_t refcount, 
 				    char *block_buf, int adjust_sign);
 /* static char *describe_illegal_block(ext2_filsys fs, blk_t block); */
@@ -99,6 +106,10 @@ struct process_inode_block {
 struct scan_callback_struct {
 	e2fsck_t	ctx;
 	char		*block_buf;
+	struct ext2_inode *inode;
+	int		busted_fs_time;
+	dgrp_t		last_group;	/* Where the scan is to stop */
+	int		range_done;
 };
 
 /*
@@ -106,6 +117,125 @@ struct scan_callback_struct {
  */
 static struct process_inode_block *inodes_to_process;
 static int process_inode_count;
+static int process_inode_max;
+
+/*
+ * The highest numbered inode whose blocks have been checked so far.
+ * When a multiply-claimed block turns up, every inode which claims it
+ * has been checked already, so none of them can be numbered higher
+ * than this.  That lets pass 1B stop scanning at ctx->dup_ino_limit.
+ */
+static ext2_ino_t max_ino_checked;
+
+/*
+ * With the pass1_workers extended option, the block groups are split
+ * into chunks, which are handed out round-robin to worker processes
+ * (see e2fsck_start_workers).  A worker checks the inodes of its
+ * chunks into its own copies of the inode and block maps, and at the
+ * end of each block group it sends the parent a message with what
+ * the parent needs to bring its own maps and lists up to date:
+ *
+ * 	- a record for each inode found in use, and for each directory
+ * 	  block, htree directory and directory to be reindexed
+ * 	- the runs of blocks which were marked in use
+ * 	- how much each of the inode counts went up
+ *
+ * A worker never fixes anything.  As soon as an inode runs into a
+ * problem, or if it is one which the parent had better look at itself
+ * (a reserved inode, or one with an extended attribute block), the
+ * worker forgets everything it found out about the inode and sends a
+ * PUNT record instead, and the parent checks that inode itself.
+ * Since the parent merges the messages in block group order, the end
+ * result is the same as if it had checked all of the inodes itself.
+ */
+#define PASS1_WORKER_CHUNK	16	/* Maximum block groups per chunk */
+
+#define P1_REC_INODE	1	/* a: P1_INODE_* flags, b: links count */
+#define P1_REC_PUNT	2
+#define P1_REC_DBLOCK	3	/* a: block number, b: block count */
+#define P1_REC_DX_DIR	4	/* a: number of blocks */
+#define P1_REC_HASH	5
+
+#define P1_INODE_DIR	0x0001
+#define P1_INODE_REG	0x0002
+#define P1_INODE_BAD	0x0004
+#define P1_INODE_IMAGIC	0x0008
+#define P1_INODE_BB	0x0010
+
+struct pass1_rec {
+	ext2_ino_t	ino;
+	int		type;
+	blk_t		a;
+	int		b;
+};
+
+struct pass1_run {
+	blk_t		blk;
+	blk_t		num;
+	int		dup;
+};
+
+/*
+ * The inode counts which a worker keeps track of
+ */
+static const size_t pass1_counts[] = {
+	offsetof(struct e2fsck_struct, fs_directory_count),
+	offsetof(struct e2fsck_struct, fs_regular_count),
+	offsetof(struct e2fsck_struct, fs_blockdev_count),
+	offsetof(struct e2fsck_struct, fs_chardev_count),
+	offsetof(struct e2fsck_struct, fs_symlinks_count),
+	offsetof(struct e2fsck_struct, fs_fast_symlinks_count),
+	offsetof(struct e2fsck_struct, fs_fifo_count),
+	offsetof(struct e2fsck_struct, fs_sockets_count),
+	offsetof(struct e2fsck_struct, fs_ind_count),
+	offsetof(struct e2fsck_struct, fs_dind_count),
+	offsetof(struct e2fsck_struct, fs_tind_count),
+	offsetof(struct e2fsck_struct, fs_fragmented),
+	offsetof(struct e2fsck_struct, large_files),
+};
+#define PASS1_NUM_COUNTS (sizeof(pass1_counts) / sizeof(pass1_counts[0]))
+#define PASS1_COUNT(ctx, i) (*(int *) ((char *) (ctx) + pass1_counts[i]))
+
+/*
+ * The header of the message sent at the end of each block group; the
+ * records and the runs follow it.
+ */
+struct pass1_msg {
+	dgrp_t		group;
+	int		num_recs;
+	int		num_runs;
+	ext2_ino_t	max_ino_checked;
+	int		counts[PASS1_NUM_COUNTS];
+};
+
+/*
+ * A worker's state; the parent reads the messages into one as well.
+ */
+struct pass1_worker {
+	int		fd;
+	struct pass1_rec *recs;
+	int		num_recs, max_recs;
+	struct pass1_run *runs;
+	int		num_runs, max_runs;
+	/* Where the inode being checked started out */
+	int		inode_recs, inode_runs;
+	int		inode_counts[PASS1_NUM_COUNTS];
+};
+
+/*
+ * Only set in a worker process
+ */
+static struct pass1_worker *worker;
+
+static void scan_inodes(e2fsck_t ctx, ext2_inode_scan scan,
+			struct scan_callback_struct *scan_struct,
+			struct problem_context *pctx);
+
+/*
+ * Number of inodes in the list whose indirect blocks are read ahead
+ * at once; we try to keep between one and two batches in flight.
+ */
+#define PROCESS_INODE_READAHEAD	64
 
 static __u64 ext2_max_sizes[EXT2_MAX_BLOCK_LOG_SIZE -
 			    EXT2_MIN_BLOCK_LOG_SIZE + 1];
@@ -373,24 +503,845 @@ static void check_inode_extra_space(e2fsck_t ctx, struct problem_context *pctx)
 	}
 }
 
+static int grow_worker_array(void *array, int *max, int want, size_t size)
+{
+	int	new_max = *max ? *max : 256;
+
+	while (new_max < want)
+		new_max *= 2;
+	if (new_max == *max)
+		return 0;
+	if (ext2fs_resize_mem(*max * size, new_max * size, array))
+		return -1;
+	*max = new_max;
+	return 0;
+}
+
+static void add_worker_rec(e2fsck_t ctx, ext2_ino_t ino, int type,
+			   blk_t a, int b)
+{
+	struct pass1_rec *rec;
+
+	if (grow_worker_array(&worker->recs, &worker->max_recs,
+			      worker->num_recs + 1, sizeof(struct pass1_rec))) {
+		ctx->flags |= E2F_FLAG_ABORT;
+		return;
+	}
+	rec = &worker->recs[worker->num_recs++];
+	rec->ino = ino;
+	rec->type = type;
+	rec->a = a;
+	rec->b = b;
+}
+
+/*
+ * Called by mark_block_used for each block which a worker marks in
+ * the in-use block map (or in the multiply claimed block map if dup
+ * is set).
+ */
+static void note_worker_block(e2fsck_t ctx, blk_t blk, int dup)
+{
+	struct pass1_run *run;
+
+	if (worker->num_runs > worker->inode_runs) {
+		run = &worker->runs[worker->num_runs - 1];
+		if (run->dup == dup && run->blk + run->num == blk) {
+			run->num++;
+			return;
+		}
+	}
+	if (grow_worker_array(&worker->runs, &worker->max_runs,
+			      worker->num_runs + 1, sizeof(struct pass1_run))) {
+		ctx->flags |= E2F_FLAG_ABORT;
+		return;
+	}
+	run = &worker->runs[worker->num_runs++];
+	run->blk = blk;
+	run->num = 1;
+	run->dup = dup;
+}
+
+/*
+ * Tell the parent that ino is in use, and what sort of inode it is.
+ */
+static void finish_worker_inode(e2fsck_t ctx, ext2_ino_t ino, int links)
+{
+	int	flags = 0;
+
+	if (!ext2fs_test_inode_bitmap(ctx->inode_used_map, ino))
+		return;
+	if (ext2fs_test_inode_bitmap(ctx->inode_dir_map, ino))
+		flags |= P1_INODE_DIR;
+	if (ext2fs_test_inode_bitmap(ctx->inode_reg_map, ino))
+		flags |= P1_INODE_REG;
+	if (ctx->inode_bad_map &&
+	    ext2fs_test_inode_bitmap(ctx->inode_bad_map, ino))
+		flags |= P1_INODE_BAD;
+	if (ctx->inode_imagic_map &&
+	    ext2fs_test_inode_bitmap(ctx->inode_imagic_map, ino))
+		flags |= P1_INODE_IMAGIC;
+	if (ctx->inode_bb_map &&
+	    ext2fs_test_inode_bitmap(ctx->inode_bb_map, ino))
+		flags |= P1_INODE_BB;
+	add_worker_rec(ctx, ino, P1_REC_INODE, flags, links);
+}
+
+/*
+ * Forget everything the worker found out about ino, and leave it to
+ * the parent instead.
+ */
+static void punt_worker_inode(e2fsck_t ctx, ext2_ino_t ino)
+{
+	struct pass1_run *run;
+	int		i;
+
+	for (i = worker->inode_runs; i < worker->num_runs; i++) {
+		run = &worker->runs[i];
+		ext2fs_fast_unmark_block_bitmap_range(run->dup ?
+			ctx->block_dup_map : ctx->block_found_map,
+			run->blk, run->num);
+	}
+	worker->num_runs = worker->inode_runs;
+	worker->num_recs = worker->inode_recs;
+	for (i = 0; i < (int) PASS1_NUM_COUNTS; i++)
+		PASS1_COUNT(ctx, i) = worker->inode_counts[i];
+	ext2fs_unmark_inode_bitmap(ctx->inode_used_map, ino);
+	ext2fs_unmark_inode_bitmap(ctx->inode_dir_map, ino);
+	ext2fs_unmark_inode_bitmap(ctx->inode_reg_map, ino);
+	if (ctx->inode_bad_map)
+		ext2fs_unmark_inode_bitmap(ctx->inode_bad_map, ino);
+	if (ctx->inode_imagic_map)
+		ext2fs_unmark_inode_bitmap(ctx->inode_imagic_map, ino);
+	add_worker_rec(ctx, ino, P1_REC_PUNT, 0, 0);
+}
+
+static void check_worker_inode(e2fsck_t ctx, struct problem_context *pctx,
+			       struct scan_callback_struct *scan_struct)
+{
+	ext2_ino_t	ino = pctx->ino;
+	struct ext2_inode *inode = pctx->inode;
+	int		i;
+
+	if (ino < EXT2_FIRST_INODE(ctx->fs->super) || inode->i_file_acl) {
+		add_worker_rec(ctx, ino, P1_REC_PUNT, 0, 0);
+		return;
+	}
+	ctx->flags &= ~E2F_FLAG_WORKER_PUNT;
+	worker->inode_recs = worker->num_recs;
+	worker->inode_runs = worker->num_runs;
+	for (i = 0; i < (int) PASS1_NUM_COUNTS; i++)
+		worker->inode_counts[i] = PASS1_COUNT(ctx, i);
+
+	check_inode(ctx, pctx, scan_struct->block_buf,
+		    scan_struct->busted_fs_time);
+	if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
+		return;
+	if (ctx->flags & E2F_FLAG_WORKER_PUNT)
+		punt_worker_inode(ctx, ino);
+	else
+		finish_worker_inode(ctx, ino, inode->i_links_count);
+}
+
+/*
+ * Send the parent what the worker found in block group group.
+ */
+static errcode_t send_worker_group(e2fsck_t ctx, dgrp_t group)
+{
+	struct pass1_msg msg;
+	struct pass1_run *runs = worker->runs;
+	int		i, j;
+
+	/* Join up the runs of neighbouring inodes */
+	for (i = j = 0; i < worker->num_runs; i++) {
+		if (j && runs[j-1].dup == runs[i].dup &&
+		    runs[j-1].blk + runs[j-1].num == runs[i].blk)
+			runs[j-1].num += runs[i].num;
+		else
+			runs[j++] = runs[i];
+	}
+	worker->num_runs = j;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.group = group;
+	msg.num_recs = worker->num_recs;
+	msg.num_runs = worker->num_runs;
+	msg.max_ino_checked = max_ino_checked;
+	for (i = 0; i < (int) PASS1_NUM_COUNTS; i++) {
+		msg.counts[i] = PASS1_COUNT(ctx, i);
+		PASS1_COUNT(ctx, i) = 0;
+	}
+	if (e2fsck_write_all(worker->fd, &msg, sizeof(msg)) ||
+	    e2fsck_write_all(worker->fd, worker->recs,
+			     worker->num_recs * sizeof(struct pass1_rec)) ||
+	    e2fsck_write_all(worker->fd, worker->runs,
+			     worker->num_runs * sizeof(struct pass1_run)))
+		return EXT2_ET_SHORT_WRITE;
+	worker->num_recs = worker->num_runs = 0;
+	worker->inode_recs = worker->inode_runs = 0;
+	return 0;
+}
+
+struct pass1_worker_struct {
+	ext2_inode_scan	scan;
+	struct scan_callback_struct *scan_struct;
+	int		num_workers;
+	dgrp_t		chunk;
+};
+
+static int pass1_worker(e2fsck_t ctx, int first, int fd, void *priv_data)
+{
+	struct pass1_worker_struct *pw;
+	struct pass1_worker w;
+	struct problem_context pctx;
+	dgrp_t		group, last;
+	int		i;
+
+	pw = (struct pass1_worker_struct *) priv_data;
+	memset(&w, 0, sizeof(w));
+	w.fd = fd;
+	worker = &w;
+	for (i = 0; i < (int) PASS1_NUM_COUNTS; i++)
+		PASS1_COUNT(ctx, i) = 0;
+	clear_problem_context(&pctx);
+
+	for (group = first * pw->chunk; group < ctx->fs->group_desc_count;
+	     group += pw->num_workers * pw->chunk) {
+		last = group + pw->chunk - 1;
+		if (last >= ctx->fs->group_desc_count)
+			last = ctx->fs->group_desc_count - 1;
+		if (ext2fs_inode_scan_goto_blockgroup(pw->scan, group))
+			return 1;
+		pw->scan_struct->last_group = last;
+		scan_inodes(ctx, pw->scan, pw->scan_struct, &pctx);
+		if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Read the message which a worker sends at the end of block group
+ * group.  If anything goes wrong, the worker is written off and the
+ * parent checks the rest of its block groups itself.
+ */
+static int read_worker_group(struct e2fsck_worker *w, dgrp_t group,
+			     struct pass1_msg *msg, struct pass1_worker *buf)
+{
+	if (w->fd < 0)
+		return -1;
+	if (e2fsck_read_all(w->fd, msg, sizeof(*msg)) ||
+	    msg->group != group || msg->num_recs < 0 || msg->num_runs < 0)
+		goto fail;
+	if (grow_worker_array(&buf->recs, &buf->max_recs, msg->num_recs,
+			      sizeof(struct pass1_rec)) ||
+	    grow_worker_array(&buf->runs, &buf->max_runs, msg->num_runs,
+			      sizeof(struct pass1_run)))
+		goto fail;
+	if (e2fsck_read_all(w->fd, buf->recs,
+			    msg->num_recs * sizeof(struct pass1_rec)) ||
+	    e2fsck_read_all(w->fd, buf->runs,
+			    msg->num_runs * sizeof(struct pass1_run)))
+		goto fail;
+	buf->num_recs = msg->num_recs;
+	buf->num_runs = msg->num_runs;
+	return 0;
+fail:
+	close(w->fd);
+	w->fd = -1;
+	return -1;
+}
+
+static void replay_worker_inode(e2fsck_t ctx, struct pass1_rec *rec,
+				struct problem_context *pctx)
+{
+	if (rec->b) {
+		pctx->errcode = ext2fs_icount_store(ctx->inode_link_info,
+						    rec->ino, rec->b);
+		if (pctx->errcode) {
+			pctx->ino = rec->ino;
+			pctx->num = rec->b;
+			fix_problem(ctx, PR_1_ICOUNT_STORE, pctx);
+			ctx->flags |= E2F_FLAG_ABORT;
+			return;
+		}
+	}
+	ext2fs_mark_inode_bitmap(ctx->inode_used_map, rec->ino);
+	if (rec->a & P1_INODE_DIR) {
+		ext2fs_mark_inode_bitmap(ctx->inode_dir_map, rec->ino);
+		e2fsck_add_dir_info(ctx, rec->ino, 0);
+	}
+	if (rec->a & P1_INODE_REG)
+		ext2fs_mark_inode_bitmap(ctx->inode_reg_map, rec->ino);
+	if (rec->a & P1_INODE_BAD)
+		mark_inode_bad(ctx, rec->ino);
+	if (rec->a & P1_INODE_IMAGIC) {
+		if (!ctx->inode_imagic_map)
+			alloc_imagic_map(ctx);
+		ext2fs_mark_inode_bitmap(ctx->inode_imagic_map, rec->ino);
+	}
+	if (rec->a & P1_INODE_BB) {
+		if (!ctx->inode_bb_map)
+			alloc_bb_map(ctx);
+		ext2fs_mark_inode_bitmap(ctx->inode_bb_map, rec->ino);
+	}
+}
+
+/*
+ * Merge a run of blocks which a worker found in use.  The blocks
+ * which somebody else has claimed already are multiply claimed.
+ */
+static void merge_worker_run(e2fsck_t ctx, struct pass1_run *run)
+{
+	blk_t	blk = run->blk, end = run->blk + run->num - 1;
+	__u32	next;
+
+	while (blk <= end) {
+		if (ext2fs_find_first_set_generic_bitmap(ctx->block_found_map,
+							 blk, end, &next))
+			next = end + 1;
+		if (next > blk)
+			ext2fs_fast_mark_block_bitmap_range(ctx->block_found_map,
+							    blk, next - blk);
+		if (next > end)
+			break;
+		mark_block_used(ctx, next);
+		blk = next + 1;
+	}
+}
+
+static void merge_worker_group(e2fsck_t ctx, struct pass1_msg *msg,
+			       struct pass1_worker *buf,
+			       struct scan_callback_struct *scan_struct,
+			       struct problem_context *pctx)
+{
+	ext2_filsys	fs = ctx->fs;
+	struct ext2_inode *inode = scan_struct->inode;
+	struct pass1_rec *rec;
+	blk_t		blk;
+	int		i;
+
+	if (msg->max_ino_checked > max_ino_checked)
+		max_ino_checked = msg->max_ino_checked;
+	for (i = 0; i < (int) PASS1_NUM_COUNTS; i++)
+		PASS1_COUNT(ctx, i) += msg->counts[i];
+
+	for (i = 0, rec = buf->recs; i < buf->num_recs; i++, rec++) {
+		switch (rec->type) {
+		case P1_REC_INODE:
+			replay_worker_inode(ctx, rec, pctx);
+			break;
+		case P1_REC_PUNT:
+			ctx->stashed_ino = 0;
+			pctx->errcode = ext2fs_read_inode_full(fs, rec->ino,
+					inode, EXT2_INODE_SIZE(fs->super));
+			if (pctx->errcode) {
+				fix_problem(ctx, PR_1_ISCAN_ERROR, pctx);
+				ctx->flags |= E2F_FLAG_ABORT;
+				return;
+			}
+			pctx->ino = rec->ino;
+			pctx->inode = inode;
+			check_inode(ctx, pctx, scan_struct->block_buf,
+				    scan_struct->busted_fs_time);
+			if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
+				return;
+			if (process_inode_count >= process_inode_max)
+				process_inodes(ctx, scan_struct->block_buf);
+			break;
+		case P1_REC_DBLOCK:
+			pctx->errcode = ext2fs_add_dir_block(fs->dblist,
+						rec->ino, rec->a, rec->b);
+			if (pctx->errcode) {
+				pctx->ino = rec->ino;
+				pctx->blk = rec->a;
+				pctx->num = rec->b;
+				fix_problem(ctx, PR_1_ADD_DBLOCK, pctx);
+				ctx->flags |= E2F_FLAG_ABORT;
+				return;
+			}
+			break;
+#ifdef ENABLE_HTREE
+		case P1_REC_DX_DIR:
+			e2fsck_add_dx_dir(ctx, rec->ino, rec->a);
+			break;
+#endif
+		case P1_REC_HASH:
+			if (ctx->dirs_to_hash)
+				ext2fs_u32_list_add(ctx->dirs_to_hash,
+						    rec->ino);
+			break;
+		}
+		if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
+			return;
+	}
+
+	/*
+	 * The runs come in the order the worker marked them, so a
+	 * block is always marked in use before it is marked as
+	 * multiply claimed.
+	 */
+	for (i = 0; i < buf->num_runs; i++) {
+		if (buf->runs[i].dup) {
+			for (blk = buf->runs[i].blk;
+			     blk < buf->runs[i].blk + buf->runs[i].num; blk++)
+				mark_block_used(ctx, blk);
+		} else
+			merge_worker_run(ctx, &buf->runs[i]);
+		if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
+			return;
+	}
+}
+
+/*
+ * Check the inodes with the help of ctx->pass1_workers worker
+ * processes.  The parent takes the messages from the workers in block
+ * group order; if a worker dies, the parent scans the rest of that
+ * worker's chunk of block groups itself.
+ */
+static void run_pass1_workers(e2fsck_t ctx, ext2_inode_scan scan,
+			      struct scan_callback_struct *scan_struct,
+			      struct problem_context *pctx)
+{
+	ext2_filsys	fs = ctx->fs;
+	struct e2fsck_worker *workers, *w;
+	struct pass1_worker_struct pw;
+	struct pass1_worker buf;
+	struct pass1_msg msg;
+	dgrp_t		group, first, last;
+	int		num_workers, c;
+
+	num_workers = ctx->pass1_workers;
+	if ((dgrp_t) num_workers > fs->group_desc_count)
+		num_workers = fs->group_desc_count;
+	pw.scan = scan;
+	pw.scan_struct = scan_struct;
+	pw.num_workers = num_workers;
+	pw.chunk = fs->group_desc_count / (num_workers * 4);
+	if (pw.chunk < 1)
+		pw.chunk = 1;
+	if (pw.chunk > PASS1_WORKER_CHUNK)
+		pw.chunk = PASS1_WORKER_CHUNK;
+
+	workers = (struct e2fsck_worker *)
+		e2fsck_allocate_memory(ctx, num_workers *
+				       sizeof(struct e2fsck_worker),
+				       "pass 1 workers");
+	if (!e2fsck_start_workers(ctx, workers, num_workers,
+				  pass1_worker, &pw)) {
+		ext2fs_free_mem(&workers);
+		scan_inodes(ctx, scan, scan_struct, pctx);
+		return;
+	}
+
+	memset(&buf, 0, sizeof(buf));
+	for (first = 0, c = 0; first < fs->group_desc_count;
+	     first += pw.chunk, c++) {
+		last = first + pw.chunk - 1;
+		if (last >= fs->group_desc_count)
+			last = fs->group_desc_count - 1;
+		w = &workers[c % num_workers];
+		for (group = first; group <= last; group++) {
+			if (read_worker_group(w, group, &msg, &buf))
+				break;
+			merge_worker_group(ctx, &msg, &buf, scan_struct, pctx);
+			if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
+				goto out;
+			pctx->errcode = end_group(ctx, scan_struct->block_buf,
+						  group);
+			if (pctx->errcode) {
+				if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
+					goto out;
+				fix_problem(ctx, PR_1_ISCAN_ERROR, pctx);
+				ctx->flags |= E2F_FLAG_ABORT;
+				goto out;
+			}
+		}
+		if (group > last)
+			continue;
+		ext2fs_inode_scan_goto_blockgroup(scan, group);
+		scan_struct->last_group = last;
+		scan_inodes(ctx, scan, scan_struct, pctx);
+		if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
+			goto out;
+	}
+out:
+	e2fsck_stop_workers(workers, num_workers);
+	ext2fs_free_mem(&workers);
+	ext2fs_free_mem(&buf.recs);
+	ext2fs_free_mem(&buf.runs);
+}
+
+/*
+ * Check the inode which has just been read into pctx->inode.
+ */
+static void check_inode(e2fsck_t ctx, struct problem_context *pctx,
+			char *block_buf, int busted_fs_time)
+{
+	ext2_filsys fs = ctx->fs;
+	ext2_ino_t	ino = pctx->ino;
+	struct ext2_inode *inode = pctx->inode;
+	int		inode_size = EXT2_INODE_SIZE(fs->super);
+	int		imagic_fs;
+	unsigned char	frag, fsize;
+
+	imagic_fs = (fs->super->s_feature_compat &
+		     EXT2_FEATURE_COMPAT_IMAGIC_INODES);
+	ctx->stashed_ino = ino;
+	/*
+	 * A worker leaves the link counts, the directory information
+	 * and the deferred inodes to the parent, which replays them in
+	 * inode order (see merge_worker_group).
+	 */
+	if (inode->i_links_count && !worker) {
+		pctx->errcode = ext2fs_icount_store(ctx->inode_link_info, 
+				   ino, inode->i_links_count);
+		if (pctx->errcode) {
+			pctx->num = inode->i_links_count;
+			fix_problem(ctx, PR_1_ICOUNT_STORE, pctx);
+			ctx->flags |= E2F_FLAG_ABORT;
+			return;
+		}
+	}
+	if (ino == EXT2_BAD_INO) {
+		struct process_block_struct pb;
+		
+		pctx->errcode = ext2fs_copy_bitmap(ctx->block_found_map,
+						  &pb.fs_meta_blocks);
+		if (pctx->errcode) {
+			pctx->num = 4;
+			fix_problem(ctx, PR_1_ALLOCATE_BBITMAP_ERROR, pctx);
+			ctx->flags |= E2F_FLAG_ABORT;
+			return;
+		}
+		pb.ino = EXT2_BAD_INO;
+		pb.num_blocks = pb.last_block = 0;
+		pb.num_illegal_blocks = 0;
+		pb.suppress = 0; pb.clear = 0; pb.is_dir = 0;
+		pb.is_reg = 0; pb.fragmented = 0; pb.bbcheck = 0;
+		pb.inode = inode;
+		pb.pctx = pctx;
+		pb.ctx = ctx;
+		pctx->errcode = ext2fs_block_iterate2(fs, ino, 0, 
+			     block_buf, process_bad_block, &pb);
+		ext2fs_free_block_bitmap(pb.fs_meta_blocks);
+		if (pctx->errcode) {
+			fix_problem(ctx, PR_1_BLOCK_ITERATE, pctx);
+			ctx->flags |= E2F_FLAG_ABORT;
+			return;
+		}
+		if (pb.bbcheck)
+			if (!fix_problem(ctx, PR_1_BBINODE_BAD_METABLOCK_PROMPT, pctx)) {
+			ctx->flags |= E2F_FLAG_ABORT;
+			return;
+		}
+		ext2fs_mark_inode_bitmap(ctx->inode_used_map, ino);
+		clear_problem_context(pctx);
+		return;
+	} else if (ino == EXT2_ROOT_INO) {
+		/*
+		 * Make sure the root inode is a directory; if
+		 * not, offer to clear it.  It will be
+		 * regnerated in pass #3.
+		 */
+		if (!LINUX_S_ISDIR(inode->i_mode)) {
+			if (fix_problem(ctx, PR_1_ROOT_NO_DIR, pctx)) {
+				inode->i_dtime = ctx->now;
+				inode->i_links_count = 0;
+				ext2fs_icount_store(ctx->inode_link_info,
+						    ino, 0);
+				e2fsck_write_inode(ctx, ino, inode,
+						   "pass1");
+			}
+
+		}
+		/*
+		 * If dtime is set, offer to clear it.  mke2fs
+		 * version 0.2b created filesystems with the
+		 * dtime field set for the root and lost+found
+		 * directories.  We won't worry about
+		 * /lost+found, since that can be regenerated
+		 * easily.  But we will fix the root directory
+		 * as a special case.
+		 */
+		if (inode->i_dtime && inode->i_links_count) {
+			if (fix_problem(ctx, PR_1_ROOT_DTIME, pctx)) {
+				inode->i_dtime = 0;
+				e2fsck_write_inode(ctx, ino, inode,
+						   "pass1");
+			}
+		}
+	} else if (ino == EXT2_JOURNAL_INO) {
+		ext2fs_mark_inode_bitmap(ctx->inode_used_map, ino);
+		if (fs->super->s_journal_inum == EXT2_JOURNAL_INO) {
+			if (!LINUX_S_ISREG(inode->i_mode) &&
+			    fix_problem(ctx, PR_1_JOURNAL_BAD_MODE,
+					pctx)) {
+				inode->i_mode = LINUX_S_IFREG;
+				e2fsck_write_inode(ctx, ino, inode,
+						   "pass1");
+			}
+			check_blocks(ctx, pctx, block_buf);
+			return;
+		}
+		if ((inode->i_links_count || inode->i_blocks ||
+		     inode->i_blocks || inode->i_block[0]) &&
+		    fix_problem(ctx, PR_1_JOURNAL_INODE_NOT_CLEAR, 
+				pctx)) {
+			memset(inode, 0, inode_size);
+			ext2fs_icount_store(ctx->inode_link_info,
+					    ino, 0);
+			e2fsck_write_inode_full(ctx, ino, inode, 
+						inode_size, "pass1");
+		}
+	} else if (ino < EXT2_FIRST_INODE(fs->super)) {
+		int	problem = 0;
+		
+		ext2fs_mark_inode_bitmap(ctx->inode_used_map, ino);
+		if (ino == EXT2_BOOT_LOADER_INO) {
+			if (LINUX_S_ISDIR(inode->i_mode))
+				problem = PR_1_RESERVED_BAD_MODE;
+		} else if (ino == EXT2_RESIZE_INO) {
+			if (inode->i_mode &&
+			    !LINUX_S_ISREG(inode->i_mode))
+				problem = PR_1_RESERVED_BAD_MODE;
+		} else {
+			if (inode->i_mode != 0)
+				problem = PR_1_RESERVED_BAD_MODE;
+		}
+		if (problem) {
+			if (fix_problem(ctx, problem, pctx)) {
+				inode->i_mode = 0;
+				e2fsck_write_inode(ctx, ino, inode,
+						   "pass1");
+			}
+		}
+		check_blocks(ctx, pctx, block_buf);
+		return;
+	}
+	/*
+	 * Check for inodes who might have been part of the
+	 * orphaned list linked list.  They should have gotten
+	 * dealt with by now, unless the list had somehow been
+	 * corrupted.
+	 * 
+	 * FIXME: In the future, inodes which are still in use
+	 * (and which are therefore) pending truncation should
+	 * be handled specially.  Right now we just clear the
+	 * dtime field, and the normal e2fsck handling of
+	 * inodes where i_size and the inode blocks are
+	 * inconsistent is to fix i_size, instead of releasing
+	 * the extra blocks.  This won't catch the inodes that
+	 * was at the end of the orphan list, but it's better
+	 * than nothing.  The right answer is that there
+	 * shouldn't be any bugs in the orphan list handling.  :-)
+	 */
+	if (inode->i_dtime && !busted_fs_time &&
+	    inode->i_dtime < ctx->fs->super->s_inodes_count) {
+		if (fix_problem(ctx, PR_1_LOW_DTIME, pctx)) {
+			inode->i_dtime = inode->i_links_count ?
+				0 : ctx->now;
+			e2fsck_write_inode(ctx, ino, inode,
+					   "pass1");
+		}
+	}
+	
+	/*
+	 * This code assumes that deleted inodes have
+	 * i_links_count set to 0.  
+	 */
+	if (!inode->i_links_count) {
+		if (!inode->i_dtime && inode->i_mode) {
+			if (fix_problem(ctx,
+				    PR_1_ZERO_DTIME, pctx)) {
+				inode->i_dtime = ctx->now;
+				e2fsck_write_inode(ctx, ino, inode,
+						   "pass1");
+			}
+		}
+		return;
+	}
+	/*
+	 * n.b.  0.3c ext2fs code didn't clear i_links_count for
+	 * deleted files.  Oops.
+	 *
+	 * Since all new ext2 implementations get this right,
+	 * we now assume that the case of non-zero
+	 * i_links_count and non-zero dtime means that we
+	 * should keep the file, not delete it.
+	 * 
+	 */
+	if (inode->i_dtime) {
+		if (fix_problem(ctx, PR_1_SET_DTIME, pctx)) {
+			inode->i_dtime = 0;
+			e2fsck_write_inode(ctx, ino, inode, "pass1");
+		}
+	}
+	
+	ext2fs_mark_inode_bitmap(ctx->inode_used_map, ino);
+	switch (fs->super->s_creator_os) {
+	    case EXT2_OS_LINUX:
+		frag = inode->osd2.linux2.l_i_frag;
+		fsize = inode->osd2.linux2.l_i_fsize;
+		break;
+	    case EXT2_OS_HURD:
+		frag = inode->osd2.hurd2.h_i_frag;
+		fsize = inode->osd2.hurd2.h_i_fsize;
+		break;
+	    case EXT2_OS_MASIX:
+		frag = inode->osd2.masix2.m_i_frag;
+		fsize = inode->osd2.masix2.m_i_fsize;
+		break;
+	    default:
+		frag = fsize = 0;
+	}
+	
+	if (inode->i_faddr || frag || fsize ||
+	    (LINUX_S_ISDIR(inode->i_mode) && inode->i_dir_acl))
+		mark_inode_bad(ctx, ino);
+	if (inode->i_flags & EXT2_IMAGIC_FL) {
+		if (imagic_fs) {
+			if (!ctx->inode_imagic_map)
+				alloc_imagic_map(ctx);
+			ext2fs_mark_inode_bitmap(ctx->inode_imagic_map,
+						 ino);
+		} else {
+			if (fix_problem(ctx, PR_1_SET_IMAGIC, pctx)) {
+				inode->i_flags &= ~EXT2_IMAGIC_FL;
+				e2fsck_write_inode(ctx, ino,
+						   inode, "pass1");
+			}
+		}
+	}
+
+	check_inode_extra_space(ctx, pctx);
+
+	if (LINUX_S_ISDIR(inode->i_mode)) {
+		ext2fs_mark_inode_bitmap(ctx->inode_dir_map, ino);
+		if (!worker)
+			e2fsck_add_dir_info(ctx, ino, 0);
+		ctx->fs_directory_count++;
+	} else if (LINUX_S_ISREG (inode->i_mode)) {
+		ext2fs_mark_inode_bitmap(ctx->inode_reg_map, ino);
+		ctx->fs_regular_count++;
+	} else if (LINUX_S_ISCHR (inode->i_mode) &&
+		   e2fsck_pass1_check_device_inode(fs, inode)) {
+		check_immutable(ctx, pctx);
+		check_size(ctx, pctx);
+		ctx->fs_chardev_count++;
+	} else if (LINUX_S_ISBLK (inode->i_mode) &&
+		   e2fsck_pass1_check_device_inode(fs, inode)) {
+		check_immutable(ctx, pctx);
+		check_size(ctx, pctx);
+		ctx->fs_blockdev_count++;
+	} else if (LINUX_S_ISLNK (inode->i_mode) &&
+		   e2fsck_pass1_check_symlink(fs, inode, block_buf)) {
+		check_immutable(ctx, pctx);
+		ctx->fs_symlinks_count++;
+		if (ext2fs_inode_data_blocks(fs, inode) == 0) {
+			ctx->fs_fast_symlinks_count++;
+			check_blocks(ctx, pctx, block_buf);
+			return;
+		}
+	}
+	else if (LINUX_S_ISFIFO (inode->i_mode) &&
+		 e2fsck_pass1_check_device_inode(fs, inode)) {
+		check_immutable(ctx, pctx);
+		check_size(ctx, pctx);
+		ctx->fs_fifo_count++;
+	} else if ((LINUX_S_ISSOCK (inode->i_mode)) &&
+		   e2fsck_pass1_check_device_inode(fs, inode)) {
+		check_immutable(ctx, pctx);
+		check_size(ctx, pctx);
+		ctx->fs_sockets_count++;
+	} else
+		mark_inode_bad(ctx, ino);
+	if (inode->i_block[EXT2_IND_BLOCK])
+		ctx->fs_ind_count++;
+	if (inode->i_block[EXT2_DIND_BLOCK])
+		ctx->fs_dind_count++;
+	if (inode->i_block[EXT2_TIND_BLOCK])
+		ctx->fs_tind_count++;
+	if (!worker &&
+	    (inode->i_block[EXT2_IND_BLOCK] ||
+	     inode->i_block[EXT2_DIND_BLOCK] ||
+	     inode->i_block[EXT2_TIND_BLOCK] ||
+	     inode->i_file_acl)) {
+		inodes_to_process[process_inode_count].ino = ino;
+		inodes_to_process[process_inode_count].inode = *inode;
+		process_inode_count++;
+	} else
+		check_blocks(ctx, pctx, block_buf);
+}
+
+/*
+ * Check the inodes from where the scan is now through to the end of
+ * block group scan_struct->last_group.
+ */
+static void scan_inodes(e2fsck_t ctx, ext2_inode_scan scan,
+			struct scan_callback_struct *scan_struct,
+			struct problem_context *pctx)
+{
+	ext2_ino_t	ino;
+	struct ext2_inode *inode = scan_struct->inode;
+	int		inode_size = EXT2_INODE_SIZE(ctx->fs->super);
+
+	scan_struct->range_done = 0;
+	while (1) {
+		pctx->errcode = ext2fs_get_next_inode_full(scan, &ino, 
+							   inode, inode_size);
+		if (scan_struct->range_done)
+			break;
+		if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
+			return;
+		if (pctx->errcode == EXT2_ET_BAD_BLOCK_IN_INODE_TABLE) {
+			if (!ctx->inode_bb_map)
+				alloc_bb_map(ctx);
+			ext2fs_mark_inode_bitmap(ctx->inode_bb_map, ino);
+			ext2fs_mark_inode_bitmap(ctx->inode_used_map, ino);
+			if (worker)
+				finish_worker_inode(ctx, ino, 0);
+			continue;
+		}
+		if (pctx->errcode) {
+			fix_problem(ctx, PR_1_ISCAN_ERROR, pctx);
+			ctx->flags |= E2F_FLAG_ABORT;
+			return;
+		}
+		if (!ino)
+			break;
+		pctx->ino = ino;
+		pctx->inode = inode;
+		if (worker)
+			check_worker_inode(ctx, pctx, scan_struct);
+		else
+			check_inode(ctx, pctx, scan_struct->block_buf,
+				    scan_struct->busted_fs_time);
+
+		if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
+			return;
+
+		if (process_inode_count >= process_inode_max) {
+			process_inodes(ctx, scan_struct->block_buf);
+
+			if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
+				return;
+		}
+	}
+}
+
 void e2fsck_pass1(e2fsck_t ctx)
 {
 	int	i;
 	__u64	max_sizes;
 	ext2_filsys fs = ctx->fs;
-	ext2_ino_t	ino;
 	struct ext2_inode *inode;
 	ext2_inode_scan	scan;
 	char		*block_buf;
 #ifdef RESOURCE_TRACK
 	struct resource_track	rtrack;
 #endif
-	unsigned char	frag, fsize;
 	struct		problem_context pctx;
 	struct		scan_callback_struct scan_struct;
-	struct ext2_super_block *sb = ctx->fs->super;
-	int		imagic_fs;
-	int		busted_fs_time = 0;
 	int		inode_size;
 	
 #ifdef RESOURCE_TRACK
@@ -422,8 +1373,6 @@ void e2fsck_pass1(e2fsck_t ctx)
 	}
 #undef EXT2_BPP
 
-	imagic_fs = (sb->s_feature_compat & EXT2_FEATURE_COMPAT_IMAGIC_INODES);
-
 	/*
 	 * Allocate bitmaps structures
 	 */
@@ -470,12 +1419,15 @@ void e2fsck_pass1(e2fsck_t ctx)
 	inode = (struct ext2_inode *)
 		e2fsck_allocate_memory(ctx, inode_size, "scratch inode");
 
+	process_inode_max = inodes_to_process_size(ctx);
 	inodes_to_process = (struct process_inode_block *)
 		e2fsck_allocate_memory(ctx,
-				       (ctx->process_inode_size *
+				       (process_inode_max *
 					sizeof(struct process_inode_block)),
 				       "array of inodes to process");
 	process_inode_count = 0;
+	max_ino_checked = 0;
+	ctx->dup_ino_limit = 0;
 
 	pctx.errcode = ext2fs_init_dblist(fs, 0);
 	if (pctx.errcode) {
@@ -514,324 +1466,24 @@ void e2fsck_pass1(e2fsck_t ctx)
 	ctx->stashed_inode = inode;
 	scan_struct.ctx = ctx;
 	scan_struct.block_buf = block_buf;
+	scan_struct.inode = inode;
+	scan_struct.busted_fs_time = 0;
+	scan_struct.last_group = fs->group_desc_count - 1;
 	ext2fs_set_inode_callback(scan, scan_callback, &scan_struct);
 	if (ctx->progress)
 		if ((ctx->progress)(ctx, 1, 0, ctx->fs->group_desc_count))
 			return;
 	if ((fs->super->s_wtime < fs->super->s_inodes_count) ||
 	    (fs->super->s_mtime < fs->super->s_inodes_count))
-		busted_fs_time = 1;
-
-	while (1) {
-		pctx.errcode = ext2fs_get_next_inode_full(scan, &ino, 
-							  inode, inode_size);
-		if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
-			return;
-		if (pctx.errcode == EXT2_ET_BAD_BLOCK_IN_INODE_TABLE) {
-			if (!ctx->inode_bb_map)
-				alloc_bb_map(ctx);
-			ext2fs_mark_inode_bitmap(ctx->inode_bb_map, ino);
-			ext2fs_mark_inode_bitmap(ctx->inode_used_map, ino);
-			continue;
-		}
-		if (pctx.errcode) {
-			fix_problem(ctx, PR_1_ISCAN_ERROR, &pctx);
-			ctx->flags |= E2F_FLAG_ABORT;
-			return;
-		}
-		if (!ino)
-			break;
-		pctx.ino = ino;
-		pctx.inode = inode;
-		ctx->stashed_ino = ino;
-		if (inode->i_links_count) {
-			pctx.errcode = ext2fs_icount_store(ctx->inode_link_info, 
-					   ino, inode->i_links_count);
-			if (pctx.errcode) {
-				pctx.num = inode->i_links_count;
-				fix_problem(ctx, PR_1_ICOUNT_STORE, &pctx);
-				ctx->flags |= E2F_FLAG_ABORT;
-				return;
-			}
-		}
-		if (ino == EXT2_BAD_INO) {
-			struct process_block_struct pb;
-			
-			pctx.errcode = ext2fs_copy_bitmap(ctx->block_found_map,
-							  &pb.fs_meta_blocks);
-			if (pctx.errcode) {
-				pctx.num = 4;
-				fix_problem(ctx, PR_1_ALLOCATE_BBITMAP_ERROR, &pctx);
-				ctx->flags |= E2F_FLAG_ABORT;
-				return;
-			}
-			pb.ino = EXT2_BAD_INO;
-			pb.num_blocks = pb.last_block = 0;
-			pb.num_illegal_blocks = 0;
-			pb.suppress = 0; pb.clear = 0; pb.is_dir = 0;
-			pb.is_reg = 0; pb.fragmented = 0; pb.bbcheck = 0;
-			pb.inode = inode;
-			pb.pctx = &pctx;
-			pb.ctx = ctx;
-			pctx.errcode = ext2fs_block_iterate2(fs, ino, 0, 
-				     block_buf, process_bad_block, &pb);
-			ext2fs_free_block_bitmap(pb.fs_meta_blocks);
-			if (pctx.errcode) {
-				fix_problem(ctx, PR_1_BLOCK_ITERATE, &pctx);
-				ctx->flags |= E2F_FLAG_ABORT;
-				return;
-			}
-			if (pb.bbcheck)
-				if (!fix_problem(ctx, PR_1_BBINODE_BAD_METABLOCK_PROMPT, &pctx)) {
-				ctx->flags |= E2F_FLAG_ABORT;
-				return;
-			}
-			ext2fs_mark_inode_bitmap(ctx->inode_used_map, ino);
-			clear_problem_context(&pctx);
-			continue;
-		} else if (ino == EXT2_ROOT_INO) {
-			/*
-			 * Make sure the root inode is a directory; if
-			 * not, offer to clear it.  It will be
-			 * regnerated in pass #3.
-			 */
-			if (!LINUX_S_ISDIR(inode->i_mode)) {
-				if (fix_problem(ctx, PR_1_ROOT_NO_DIR, &pctx)) {
-					inode->i_dtime = ctx->now;
-					inode->i_links_count = 0;
-					ext2fs_icount_store(ctx->inode_link_info,
-							    ino, 0);
-					e2fsck_write_inode(ctx, ino, inode,
-							   "pass1");
-				}
+		scan_struct.busted_fs_time = 1;
 
-			}
-			/*
-			 * If dtime is set, offer to clear it.  mke2fs
-			 * version 0.2b created filesystems with the
-			 * dtime field set for the root and lost+found
-			 * directories.  We won't worry about
-			 * /lost+found, since that can be regenerated
-			 * easily.  But we will fix the root directory
-			 * as a special case.
-			 */
-			if (inode->i_dtime && inode->i_links_count) {
-				if (fix_problem(ctx, PR_1_ROOT_DTIME, &pctx)) {
-					inode->i_dtime = 0;
-					e2fsck_write_inode(ctx, ino, inode,
-							   "pass1");
-				}
-			}
-		} else if (ino == EXT2_JOURNAL_INO) {
-			ext2fs_mark_inode_bitmap(ctx->inode_used_map, ino);
-			if (fs->super->s_journal_inum == EXT2_JOURNAL_INO) {
-				if (!LINUX_S_ISREG(inode->i_mode) &&
-				    fix_problem(ctx, PR_1_JOURNAL_BAD_MODE,
-						&pctx)) {
-					inode->i_mode = LINUX_S_IFREG;
-					e2fsck_write_inode(ctx, ino, inode,
-							   "pass1");
-				}
-				check_blocks(ctx, &pctx, block_buf);
-				continue;
-			}
-			if ((inode->i_links_count || inode->i_blocks ||
-			     inode->i_blocks || inode->i_block[0]) &&
-			    fix_problem(ctx, PR_1_JOURNAL_INODE_NOT_CLEAR, 
-					&pctx)) {
-				memset(inode, 0, inode_size);
-				ext2fs_icount_store(ctx->inode_link_info,
-						    ino, 0);
-				e2fsck_write_inode_full(ctx, ino, inode, 
-							inode_size, "pass1");
-			}
-		} else if (ino < EXT2_FIRST_INODE(fs->super)) {
-			int	problem = 0;
-			
-			ext2fs_mark_inode_bitmap(ctx->inode_used_map, ino);
-			if (ino == EXT2_BOOT_LOADER_INO) {
-				if (LINUX_S_ISDIR(inode->i_mode))
-					problem = PR_1_RESERVED_BAD_MODE;
-			} else if (ino == EXT2_RESIZE_INO) {
-				if (inode->i_mode &&
-				    !LINUX_S_ISREG(inode->i_mode))
-					problem = PR_1_RESERVED_BAD_MODE;
-			} else {
-				if (inode->i_mode != 0)
-					problem = PR_1_RESERVED_BAD_MODE;
-			}
-			if (problem) {
-				if (fix_problem(ctx, problem, &pctx)) {
-					inode->i_mode = 0;
-					e2fsck_write_inode(ctx, ino, inode,
-							   "pass1");
-				}
-			}
-			check_blocks(ctx, &pctx, block_buf);
-			continue;
-		}
-		/*
-		 * Check for inodes who might have been part of the
-		 * orphaned list linked list.  They should have gotten
-		 * dealt with by now, unless the list had somehow been
-		 * corrupted.
-		 * 
-		 * FIXME: In the future, inodes which are still in use
-		 * (and which are therefore) pending truncation should
-		 * be handled specially.  Right now we just clear the
-		 * dtime field, and the normal e2fsck handling of
-		 * inodes where i_size and the inode blocks are
-		 * inconsistent is to fix i_size, instead of releasing
-		 * the extra blocks.  This won't catch the inodes that
-		 * was at the end of the orphan list, but it's better
-		 * than nothing.  The right answer is that there
-		 * shouldn't be any bugs in the orphan list handling.  :-)
-		 */
-		if (inode->i_dtime && !busted_fs_time &&
-		    inode->i_dtime < ctx->fs->super->s_inodes_count) {
-			if (fix_problem(ctx, PR_1_LOW_DTIME, &pctx)) {
-				inode->i_dtime = inode->i_links_count ?
-					0 : ctx->now;
-				e2fsck_write_inode(ctx, ino, inode,
-						   "pass1");
-			}
-		}
-		
-		/*
-		 * This code assumes that deleted inodes have
-		 * i_links_count set to 0.  
-		 */
-		if (!inode->i_links_count) {
-			if (!inode->i_dtime && inode->i_mode) {
-				if (fix_problem(ctx,
-					    PR_1_ZERO_DTIME, &pctx)) {
-					inode->i_dtime = ctx->now;
-					e2fsck_write_inode(ctx, ino, inode,
-							   "pass1");
-				}
-			}
-			continue;
-		}
-		/*
-		 * n.b.  0.3c ext2fs code didn't clear i_links_count for
-		 * deleted files.  Oops.
-		 *
-		 * Since all new ext2 implementations get this right,
-		 * we now assume that the case of non-zero
-		 * i_links_count and non-zero dtime means that we
-		 * should keep the file, not delete it.
-		 * 
-		 */
-		if (inode->i_dtime) {
-			if (fix_problem(ctx, PR_1_SET_DTIME, &pctx)) {
-				inode->i_dtime = 0;
-				e2fsck_write_inode(ctx, ino, inode, "pass1");
-			}
-		}
-		
-		ext2fs_mark_inode_bitmap(ctx->inode_used_map, ino);
-		switch (fs->super->s_creator_os) {
-		    case EXT2_OS_LINUX:
-			frag = inode->osd2.linux2.l_i_frag;
-			fsize = inode->osd2.linux2.l_i_fsize;
-			break;
-		    case EXT2_OS_HURD:
-			frag = inode->osd2.hurd2.h_i_frag;
-			fsize = inode->osd2.hurd2.h_i_fsize;
-			break;
-		    case EXT2_OS_MASIX:
-			frag = inode->osd2.masix2.m_i_frag;
-			fsize = inode->osd2.masix2.m_i_fsize;
-			break;
-		    default:
-			frag = fsize = 0;
-		}
-		
-		if (inode->i_faddr || frag || fsize ||
-		    (LINUX_S_ISDIR(inode->i_mode) && inode->i_dir_acl))
-			mark_inode_bad(ctx, ino);
-		if (inode->i_flags & EXT2_IMAGIC_FL) {
-			if (imagic_fs) {
-				if (!ctx->inode_imagic_map)
-					alloc_imagic_map(ctx);
-				ext2fs_mark_inode_bitmap(ctx->inode_imagic_map,
-							 ino);
-			} else {
-				if (fix_problem(ctx, PR_1_SET_IMAGIC, &pctx)) {
-					inode->i_flags &= ~EXT2_IMAGIC_FL;
-					e2fsck_write_inode(ctx, ino,
-							   inode, "pass1");
-				}
-			}
-		}
-
-		check_inode_extra_space(ctx, &pctx);
-
-		if (LINUX_S_ISDIR(inode->i_mode)) {
-			ext2fs_mark_inode_bitmap(ctx->inode_dir_map, ino);
-			e2fsck_add_dir_info(ctx, ino, 0);
-			ctx->fs_directory_count++;
-		} else if (LINUX_S_ISREG (inode->i_mode)) {
-			ext2fs_mark_inode_bitmap(ctx->inode_reg_map, ino);
-			ctx->fs_regular_count++;
-		} else if (LINUX_S_ISCHR (inode->i_mode) &&
-			   e2fsck_pass1_check_device_inode(fs, inode)) {
-			check_immutable(ctx, &pctx);
-			check_size(ctx, &pctx);
-			ctx->fs_chardev_count++;
-		} else if (LINUX_S_ISBLK (inode->i_mode) &&
-			   e2fsck_pass1_check_device_inode(fs, inode)) {
-			check_immutable(ctx, &pctx);
-			check_size(ctx, &pctx);
-			ctx->fs_blockdev_count++;
-		} else if (LINUX_S_ISLNK (inode->i_mode) &&
-			   e2fsck_pass1_check_symlink(fs, inode, block_buf)) {
-			check_immutable(ctx, &pctx);
-			ctx->fs_symlinks_count++;
-			if (ext2fs_inode_data_blocks(fs, inode) == 0) {
-				ctx->fs_fast_symlinks_count++;
-				check_blocks(ctx, &pctx, block_buf);
-				continue;
-			}
-		}
-		else if (LINUX_S_ISFIFO (inode->i_mode) &&
-			 e2fsck_pass1_check_device_inode(fs, inode)) {
-			check_immutable(ctx, &pctx);
-			check_size(ctx, &pctx);
-			ctx->fs_fifo_count++;
-		} else if ((LINUX_S_ISSOCK (inode->i_mode)) &&
-			   e2fsck_pass1_check_device_inode(fs, inode)) {
-			check_immutable(ctx, &pctx);
-			check_size(ctx, &pctx);
-			ctx->fs_sockets_count++;
-		} else
-			mark_inode_bad(ctx, ino);
-		if (inode->i_block[EXT2_IND_BLOCK])
-			ctx->fs_ind_count++;
-		if (inode->i_block[EXT2_DIND_BLOCK])
-			ctx->fs_dind_count++;
-		if (inode->i_block[EXT2_TIND_BLOCK])
-			ctx->fs_tind_count++;
-		if (inode->i_block[EXT2_IND_BLOCK] ||
-		    inode->i_block[EXT2_DIND_BLOCK] ||
-		    inode->i_block[EXT2_TIND_BLOCK] ||
-		    inode->i_file_acl) {
-			inodes_to_process[process_inode_count].ino = ino;
-			inodes_to_process[process_inode_count].inode = *inode;
-			process_inode_count++;
-		} else
-			check_blocks(ctx, &pctx, block_buf);
-
-		if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
-			return;
-
-		if (process_inode_count >= ctx->process_inode_size) {
-			process_inodes(ctx, block_buf);
-
-			if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
-				return;
-		}
-	}
+	if (ctx->pass1_workers > 1 && fs->group_desc_count > 1 &&
+	    !(fs->flags & EXT2_FLAG_IMAGE_FILE))
+		run_pass1_workers(ctx, scan, &scan_struct, &pctx);
+	else
+		scan_inodes(ctx, scan, &scan_struct, &pctx);
+	if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
+		return;
 	process_inodes(ctx, block_buf);
 	ext2fs_close_inode_scan(scan);
 	ehandler_operation(0);
@@ -919,36 +1571,152 @@ endit:
 #endif
 }
 
+/*
+ * At the end of each block group, call process_inodes and report how
+ * far we have got.
+ */
+static errcode_t end_group(e2fsck_t ctx, char *block_buf, dgrp_t group)
+{
+	/*
+	 * In adaptive mode the list is only processed when it fills
+	 * up, so that it can be sorted across block groups.
+	 */
+	if (ctx->process_inode_size > 0)
+		process_inodes(ctx, block_buf);
+
+	if (ctx->progress)
+		if ((ctx->progress)(ctx, 1, group+1,
+				    ctx->fs->group_desc_count))
+			return EXT2_ET_CANCEL_REQUESTED;
+
+	return 0;
+}
+
 /*
  * When the inode_scan routines call this callback at the end of the
- * glock group, call process_inodes.
+ * glock group, call end_group (or send the parent what a worker has
+ * found), and stop the scan at the end of the range being checked.
  */
-static errcode_t scan_callback(ext2_filsys fs, 
+static errcode_t scan_callback(ext2_filsys fs EXT2FS_ATTR((unused)),
 			       ext2_inode_scan scan EXT2FS_ATTR((unused)),
 			       dgrp_t group, void * priv_data)
 {
 	struct scan_callback_struct *scan_struct;
 	e2fsck_t ctx;
+	errcode_t retval;
 
 	scan_struct = (struct scan_callback_struct *) priv_data;
 	ctx = scan_struct->ctx;
-	
-	process_inodes((e2fsck_t) fs->priv_data, scan_struct->block_buf);
 
-	if (ctx->progress)
-		if ((ctx->progress)(ctx, 1, group+1,
-				    ctx->fs->group_desc_count))
-			return EXT2_ET_CANCEL_REQUESTED;
+	if (worker)
+		retval = send_worker_group(ctx, group);
+	else
+		retval = end_group(ctx, scan_struct->block_buf, group);
+	if (retval)
+		return retval;
 
+	if (group == scan_struct->last_group) {
+		scan_struct->range_done = 1;
+		return EXT2_ET_CANCEL_REQUESTED;
+	}
 	return 0;
 }
+/*
+ * Work out how many inodes the "inodes to process" list can hold.  If
+ * the -P option was given as 0, size it adaptively: use up to a
+ * sixteenth of the free memory, but no more than there are inodes in
+ * use, so that as many inodes as possible can be sorted by the
+ * location of their indirect blocks before they are checked.
+ */
+static int inodes_to_process_size(e2fsck_t ctx)
+{
+	ext2_filsys	fs = ctx->fs;
+	unsigned long	max = 0, in_use;
+#if defined(HAVE_SYSCONF) && defined(_SC_AVPHYS_PAGES)
+	long		pages, pagesize;
+#endif
+
+	if (ctx->process_inode_size > 0)
+		return ctx->process_inode_size;
+
+#if defined(HAVE_SYSCONF) && defined(_SC_AVPHYS_PAGES)
+	pages = sysconf(_SC_AVPHYS_PAGES);
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pages > 0 && pagesize > 0)
+		max = (unsigned long) (pages / 16) * pagesize /
+			sizeof(struct process_inode_block);
+#endif
+	in_use = fs->super->s_inodes_count - fs->super->s_free_inodes_count;
+	if (!max || max > in_use)
+		max = in_use;
+	if (max > INT_MAX / sizeof(struct process_inode_block))
+		max = INT_MAX / sizeof(struct process_inode_block);
+	if (max < 256)
+		max = 256;
+	return (int) max;
+}
+
+static EXT2_QSORT_TYPE blk_cmp(const void *a, const void *b)
+{
+	blk_t	blk_a = *(const blk_t *) a;
+	blk_t	blk_b = *(const blk_t *) b;
+
+	if (blk_a < blk_b)
+		return -1;
+	return blk_a > blk_b;
+}
+
+/*
+ * Ask the I/O channel to start reading the indirect and extended
+ * attribute blocks of count inodes in the list, starting at start, in
+ * physical block order and with adjacent blocks merged into a single
+ * request.
+ */
+static void readahead_inodes(e2fsck_t ctx, int start, int count)
+{
+	ext2_filsys		fs = ctx->fs;
+	blk_t			blocks[PROCESS_INODE_READAHEAD * 4];
+	blk_t			blk, first, next;
+	struct ext2_inode	*inode;
+	int			i, j, num = 0;
+
+	if (count > process_inode_count - start)
+		count = process_inode_count - start;
+	for (i = start; i < start + count; i++) {
+		inode = &inodes_to_process[i].inode;
+		for (j = EXT2_IND_BLOCK; j <= EXT2_TIND_BLOCK + 1; j++) {
+			blk = (j > EXT2_TIND_BLOCK) ? inode->i_file_acl :
+				inode->i_block[j];
+			if (blk >= fs->super->s_first_data_block &&
+			    blk < fs->super->s_blocks_count)
+				blocks[num++] = blk;
+		}
+	}
+	if (!num)
+		return;
+	qsort(blocks, num, sizeof(blk_t), blk_cmp);
+
+	first = next = blocks[0];
+	for (i = 0; i < num; i++) {
+		if (blocks[i] == next - 1)
+			continue;
+		if (blocks[i] == next) {
+			next++;
+			continue;
+		}
+		io_channel_readahead(fs->io, first, (int) (next - first));
+		first = blocks[i];
+		next = first + 1;
+	}
+	io_channel_readahead(fs->io, first, (int) (next - first));
+}
 
 /*
  * Process the inodes in the "inodes to process" list.
  */
 static void process_inodes(e2fsck_t ctx, char *block_buf)
 {
-	int			i;
+	int			i, readahead_next = 0;
 	struct ext2_inode	*old_stashed_inode;
 	ext2_ino_t		old_stashed_ino;
 	const char		*old_operation;
@@ -967,6 +1735,11 @@ static void process_inodes(e2fsck_t ctx, char *block_buf)
 		      sizeof(struct process_inode_block), process_inode_cmp);
 	clear_problem_context(&pctx);
 	for (i=0; i < process_inode_count; i++) {
+		if (readahead_next <= i + PROCESS_INODE_READAHEAD) {
+			readahead_inodes(ctx, readahead_next,
+					 PROCESS_INODE_READAHEAD);
+			readahead_next += PROCESS_INODE_READAHEAD;
+		}
 		pctx.inode = ctx->stashed_inode = &inodes_to_process[i].inode;
 		pctx.ino = ctx->stashed_ino = inodes_to_process[i].ino;
 		
@@ -995,13 +1768,21 @@ static EXT2_QSORT_TYPE process_inode_cmp(const void *a, const void *b)
 		(const struct process_inode_block *) a;
 	const struct process_inode_block *ib_b =
 		(const struct process_inode_block *) b;
-	int	ret;
+	blk_t	blk_a, blk_b;
 	
-	ret = (ib_a->inode.i_block[EXT2_IND_BLOCK] -
-	       ib_b->inode.i_block[EXT2_IND_BLOCK]);
-	if (ret == 0)
-		ret = ib_a->inode.i_file_acl - ib_b->inode.i_file_acl;
-	return ret;
+	/*
+	 * Compare rather than subtract, since the difference between
+	 * two block numbers may not fit in an int.
+	 */
+	blk_a = ib_a->inode.i_block[EXT2_IND_BLOCK];
+	blk_b = ib_b->inode.i_block[EXT2_IND_BLOCK];
+	if (blk_a == blk_b) {
+		blk_a = ib_a->inode.i_file_acl;
+		blk_b = ib_b->inode.i_file_acl;
+	}
+	if (blk_a < blk_b)
+		return -1;
+	return blk_a > blk_b;
 }
 
 /*
@@ -1014,8 +1795,9 @@ static void mark_inode_bad(e2fsck_t ctx, ino_t ino)
 	if (!ctx->inode_bad_map) {
 		clear_problem_context(&pctx);
 	
-		pctx.errcode = ext2fs_allocate_inode_bitmap(ctx->fs,
-			    _("bad inode map"), &ctx->inode_bad_map);
+		pctx.errcode = ext2fs_allocate_inode_bitmap_type(ctx->fs,
+			    EXT2FS_BMAP_EXTENT, _("bad inode map"),
+			    &ctx->inode_bad_map);
 		if (pctx.errcode) {
 			pctx.num = 3;
 			fix_problem(ctx, PR_1_ALLOCATE_IBITMAP_ERROR, &pctx);
@@ -1036,7 +1818,8 @@ static void alloc_bb_map(e2fsck_t ctx)
 	struct		problem_context pctx;
 	
 	clear_problem_context(&pctx);
-	pctx.errcode = ext2fs_allocate_inode_bitmap(ctx->fs,
+	pctx.errcode = ext2fs_allocate_inode_bitmap_type(ctx->fs,
+					      EXT2FS_BMAP_EXTENT,
 					      _("inode in bad block map"),
 					      &ctx->inode_bb_map);
 	if (pctx.errcode) {
@@ -1056,7 +1839,8 @@ static void alloc_imagic_map(e2fsck_t ctx)
 	struct		problem_context pctx;
 	
 	clear_problem_context(&pctx);
-	pctx.errcode = ext2fs_allocate_inode_bitmap(ctx->fs,
+	pctx.errcode = ext2fs_allocate_inode_bitmap_type(ctx->fs,
+					      EXT2FS_BMAP_EXTENT,
 					      _("imagic inode map"),
 					      &ctx->inode_imagic_map);
 	if (pctx.errcode) {
@@ -1083,7 +1867,8 @@ static _INLINE_ void mark_block_used(e2fsck_t ctx, blk_t block)
 	
 	if (ext2fs_fast_test_block_bitmap(ctx->block_found_map, block)) {
 		if (!ctx->block_dup_map) {
-			pctx.errcode = ext2fs_allocate_block_bitmap(ctx->fs,
+			pctx.errcode = ext2fs_allocate_block_bitmap_type(
+			      ctx->fs, EXT2FS_BMAP_EXTENT,
 			      _("multiply claimed block map"),
 			      &ctx->block_dup_map);
 			if (pctx.errcode) {
@@ -1095,8 +1880,14 @@ static _INLINE_ void mark_block_used(e2fsck_t ctx, blk_t block)
 				return;
 			}
 		}
+		if (worker &&
+		    !ext2fs_fast_test_block_bitmap(ctx->block_dup_map, block))
+			note_worker_block(ctx, block, 1);
 		ext2fs_fast_mark_block_bitmap(ctx->block_dup_map, block);
+		ctx->dup_ino_limit = max_ino_checked;
 	} else {
+		if (worker)
+			note_worker_block(ctx, block, 0);
 		ext2fs_fast_mark_block_bitmap(ctx->block_found_map, block);
 	}
 }
@@ -1182,7 +1973,8 @@ static int check_ext_attr(e2fsck_t ctx, struct problem_context *pctx,
 
 	/* If ea bitmap hasn't been allocated, create it */
 	if (!ctx->block_ea_map) {
-		pctx->errcode = ext2fs_allocate_block_bitmap(fs,
+		pctx->errcode = ext2fs_allocate_block_bitmap_type(fs,
+						      EXT2FS_BMAP_EXTENT,
 						      _("ext attr block map"),
 						      &ctx->block_ea_map);
 		if (pctx->errcode) {
@@ -1394,6 +2186,8 @@ static void check_blocks(e2fsck_t ctx, struct problem_context *pctx,
 	pb.ctx = ctx;
 	pctx->ino = ino;
 	pctx->errcode = 0;
+	if (ino > max_ino_checked)
+		max_ino_checked = ino;
 
 	if (inode->i_flags & EXT2_COMPRBLK_FL) {
 		if (fs->super->s_feature_incompat &
@@ -1447,14 +2241,22 @@ static void check_blocks(e2fsck_t ctx, struct problem_context *pctx,
 			dirty_inode++;
 		} else {
 #ifdef ENABLE_HTREE
-			e2fsck_add_dx_dir(ctx, ino, pb.last_block+1);
+			if (worker)
+				add_worker_rec(ctx, ino, P1_REC_DX_DIR,
+					       pb.last_block+1, 0);
+			else
+				e2fsck_add_dx_dir(ctx, ino, pb.last_block+1);
 #endif
 		}
 	}
 	if (ctx->dirs_to_hash && pb.is_dir &&
 	    !(inode->i_flags & EXT2_INDEX_FL) &&
-	    ((inode->i_size / fs->blocksize) >= 3))
-		ext2fs_u32_list_add(ctx->dirs_to_hash, ino);
+	    ((inode->i_size / fs->blocksize) >= 3)) {
+		if (worker)
+			add_worker_rec(ctx, ino, P1_REC_HASH, 0, 0);
+		else
+			ext2fs_u32_list_add(ctx->dirs_to_hash, ino);
+	}
 		
 	if (!pb.num_blocks && pb.is_dir) {
 		if (fix_problem(ctx, PR_1_ZERO_LENGTH_DIR, pctx)) {
@@ -1707,6 +2509,11 @@ static int process_block(ext2_filsys fs,
 		p->last_block = blockcnt;
 mark_dir:
 	if (p->is_dir && (blockcnt >= 0)) {
+		if (worker) {
+			add_worker_rec(ctx, p->ino, P1_REC_DBLOCK,
+				       blk, blockcnt);
+			return ret_code;
+		}
 		pctx->errcode = ext2fs_add_dir_block(fs->dblist, p->ino,
 						    blk, blockcnt);
 		if (pctx->errcode) {
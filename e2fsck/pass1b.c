@@ -98,6 +98,7 @@ static void pass1d(e2fsck_t ctx, char *block_buf);
 static int dup_inode_count = 0;
 
 static dict_t blk_dict, ino_dict;
+static dnode_pool_t dnode_pool;
 
 static ext2fs_inode_bitmap inode_dup_map;
 
@@ -108,7 +109,10 @@ static int dict_int_cmp(const void *a, const void *b)
 	ia = (intptr_t)a;
 	ib = (intptr_t)b;
 
-	return (ia-ib);
+	/* Don't subtract; the difference may not fit in an int */
+	if (ia < ib)
+		return -1;
+	return (ia > ib);
 }
 
 /*
@@ -163,8 +167,7 @@ static void add_dupe(e2fsck_t ctx, ext2_ino_t ino, blk_t blk,
 /*
  * Free a duplicate inode record
  */
-static void inode_dnode_free(dnode_t *node, 
-			     void *context EXT2FS_ATTR((unused)))
+static void inode_dnode_free(dnode_t *node, void *context)
 {
 	struct dup_inode	*di;
 	struct block_el		*p, *next;
@@ -174,14 +177,14 @@ static void inode_dnode_free(dnode_t *node,
 		next = p->next;
 		free(p);
 	}
-	free(node);
+	free(di);
+	dnode_pool_free(node, context);
 }
 
 /*
  * Free a duplicate block record
  */
-static void block_dnode_free(dnode_t *node, 
-			     void *context EXT2FS_ATTR((unused)))
+static void block_dnode_free(dnode_t *node, void *context)
 {
 	struct dup_block	*db;
 	struct inode_el		*p, *next;
@@ -191,7 +194,8 @@ static void block_dnode_free(dnode_t *node,
 		next = p->next;
 		free(p);
 	}
-	free(node);
+	free(db);
+	dnode_pool_free(node, context);
 }
 
 
@@ -205,18 +209,26 @@ void e2fsck_pass1_dupblocks(e2fsck_t ctx, char *block_buf)
 
 	clear_problem_context(&pctx);
 	
-	pctx.errcode = ext2fs_allocate_inode_bitmap(fs,
-		      _("multiply claimed inode map"), &inode_dup_map);
+	pctx.errcode = ext2fs_allocate_inode_bitmap_type(fs,
+		      EXT2FS_BMAP_EXTENT, _("multiply claimed inode map"),
+		      &inode_dup_map);
 	if (pctx.errcode) {
 		fix_problem(ctx, PR_1B_ALLOCATE_IBITMAP_ERROR, &pctx);
 		ctx->flags |= E2F_FLAG_ABORT;
 		return;
 	}
 
+	/*
+	 * There can be a very large number of multiply-claimed blocks,
+	 * so take the dictionary nodes from a pool.
+	 */
+	dnode_pool_init(&dnode_pool);
 	dict_init(&ino_dict, DICTCOUNT_T_MAX, dict_int_cmp);
 	dict_init(&blk_dict, DICTCOUNT_T_MAX, dict_int_cmp);
-	dict_set_allocator(&ino_dict, NULL, inode_dnode_free, NULL);
-	dict_set_allocator(&blk_dict, NULL, block_dnode_free, NULL);
+	dict_set_allocator(&ino_dict, dnode_pool_alloc, inode_dnode_free,
+			   &dnode_pool);
+	dict_set_allocator(&blk_dict, dnode_pool_alloc, block_dnode_free,
+			   &dnode_pool);
 	
 	pass1b(ctx, block_buf);
 	pass1c(ctx, block_buf);
@@ -228,6 +240,7 @@ void e2fsck_pass1_dupblocks(e2fsck_t ctx, char *block_buf)
 	 */
 	dict_free_nodes(&ino_dict);
 	dict_free_nodes(&blk_dict);
+	dnode_pool_destroy(&dnode_pool);
 }
 
 /*
@@ -276,6 +289,12 @@ static void pass1b(e2fsck_t ctx, char *block_buf)
 		}
 		if (!ino)
 			break;
+		/*
+		 * Pass 1 worked out that no inode past this one claims
+		 * any of the multiply-claimed blocks.
+		 */
+		if (ino > ctx->dup_ino_limit)
+			break;
 		pctx.ino = ctx->stashed_ino = ino;
 		if ((ino != EXT2_BAD_INO) &&
 		    !ext2fs_test_inode_bitmap(ctx->inode_used_map, ino))
@@ -397,6 +416,11 @@ static void pass1c(e2fsck_t ctx, char *block_buf)
 	sd.count = dup_inode_count;
 	sd.first_inode = EXT2_FIRST_INODE(fs->super);
 	sd.max_inode = fs->super->s_inodes_count;
+	/* The root directory's name is already known */
+	if (ext2fs_test_inode_bitmap(inode_dup_map, EXT2_ROOT_INO))
+		sd.count--;
+	if (sd.count <= 0)
+		return;
 	ext2fs_dblist_dir_iterate(fs->dblist, 0, block_buf,
 				  search_dirent_proc, &sd);
 }	
@@ -77,13 +77,61 @@ static int htree_depth(struct dx_dir_info *dx_dir,
 		       struct dx_dirblock_info *dx_db);
 static EXT2_QSORT_TYPE special_dir_block_cmp(const void *a, const void *b);
 
+/*
+ * With the pass2_workers extended option, the directory blocks are
+ * first looked at by worker processes (see e2fsck_start_workers).
+ * The sorted directory block list is split into batches of
+ * DIR_READAHEAD_BATCH entries, which are handed out round-robin.  For
+ * each of its blocks a worker runs scan_dir_block(), which checks the
+ * block the same way as check_dir_block() does but never changes
+ * anything, and sends the parent either the entries of the block or a
+ * request to check the block itself.
+ *
+ * The parent takes the results in list order.  For a block which
+ * needs no fixing it just accounts for the entries (replay_dir_block);
+ * everything else still goes through check_dir_block().  The htree
+ * root and interior blocks are always left to the parent; for a leaf
+ * block, a worker looks up the hash version in the root block itself,
+ * and the parent only takes the hash range if it agrees with what
+ * check_dir_block() found there.
+ */
+struct pass2_ent {
+	ext2_ino_t	ino;
+	int		dot_state;	/* 0 for '.', 1 for '..', else 2 */
+};
+
+struct pass2_msg {
+	ext2_ino_t	index;		/* Position in the dblist */
+	int		check;		/* Leave it to check_dir_block */
+	int		num_ents;
+	int		dx_leaf;	/* Min_hash and max_hash are valid */
+	int		hash_version;
+	ext2_dirhash_t	min_hash, max_hash;
+};
+
 struct check_dir_struct {
 	char *buf;
 	struct problem_context	pctx;
 	int	count, max;
 	e2fsck_t ctx;
+	ext2_ino_t index, readahead_next;
+	dnode_pool_t de_pool;
+	int	num_workers;	/* 0 until started, -1 if not used */
+	ext2_ino_t worker_start;
+	struct e2fsck_worker *workers;
+	struct pass2_msg msg;	/* Result for the current block */
+	struct pass2_ent *ents;
+	int	max_ents;
 };	
 
+static void stop_pass2_workers(struct check_dir_struct *cd);
+
+/*
+ * Number of directory list entries to request at once; we try to keep
+ * between one and two batches of directory blocks in flight.
+ */
+#define DIR_READAHEAD_BATCH	128
+
 void e2fsck_pass2(e2fsck_t ctx)
 {
 	struct ext2_super_block *sb = ctx->fs->super;
@@ -115,7 +163,13 @@ void e2fsck_pass2(e2fsck_t ctx)
 	if (!(ctx->options & E2F_OPT_PREEN))
 		fix_problem(ctx, PR_2_PASS_HEADER, &cd.pctx);
 
-	cd.pctx.errcode = ext2fs_create_icount2(fs, EXT2_ICOUNT_OPT_INCREMENT,
+	/*
+	 * Directory entries are found in directory order rather than
+	 * inode order, so use the hash table icount backend to avoid
+	 * inserting into the middle of a sorted list.
+	 */
+	cd.pctx.errcode = ext2fs_create_icount2(fs, EXT2_ICOUNT_OPT_INCREMENT |
+						EXT2_ICOUNT_OPT_HASH,
 						0, ctx->inode_link_info,
 						&ctx->inode_count);
 	if (cd.pctx.errcode) {
@@ -139,6 +193,12 @@ void e2fsck_pass2(e2fsck_t ctx)
 	cd.ctx = ctx;
 	cd.count = 1;
 	cd.max = ext2fs_dblist_count(fs->dblist);
+	cd.index = cd.readahead_next = 0;
+	dnode_pool_init(&cd.de_pool);
+	cd.num_workers = 0;
+	cd.workers = 0;
+	cd.ents = 0;
+	cd.max_ents = 0;
 
 	if (ctx->progress)
 		(void) (ctx->progress)(ctx, 2, 0, cd.max);
@@ -148,6 +208,8 @@ void e2fsck_pass2(e2fsck_t ctx)
 	
 	cd.pctx.errcode = ext2fs_dblist_iterate(fs->dblist, check_dir_block,
 						&cd);
+	stop_pass2_workers(&cd);
+	dnode_pool_destroy(&cd.de_pool);
 	if (ctx->flags & E2F_FLAG_SIGNAL_MASK)
 		return;
 	if (cd.pctx.errcode) {
@@ -693,6 +755,437 @@ static void salvage_directory(ext2_filsys fs,
 	}
 }
 
+struct pass2_worker_struct {
+	e2fsck_t	ctx;
+	int		worker, num_workers, fd;
+	ext2_ino_t	start, index;
+	ext2_ino_t	hash_ino;	/* Htree directory last looked up */
+	int		hash_version;
+	char		*buf;
+	struct pass2_ent *ents;
+	int		max_ents;
+	dict_t		de_dict;
+	dnode_pool_t	de_pool;
+};
+
+static int add_dir_ent(struct pass2_ent **ents, int *max_ents, int num,
+		       ext2_ino_t ino, int dot_state)
+{
+	int	new_max;
+
+	if (num >= *max_ents) {
+		new_max = *max_ents ? *max_ents * 2 : 256;
+		if (ext2fs_resize_mem(*max_ents * sizeof(struct pass2_ent),
+				      new_max * sizeof(struct pass2_ent),
+				      ents))
+			return -1;
+		*max_ents = new_max;
+	}
+	(*ents)[num].ino = ino;
+	(*ents)[num].dot_state = dot_state > 2 ? 2 : dot_state;
+	return 0;
+}
+
+/*
+ * Check a directory block the way check_dir_block() does, without
+ * fixing or changing anything.  Returns 0 if the block is fine, with
+ * its entries in pw->ents, or 1 if check_dir_block() has to look at
+ * it after all.
+ */
+static int scan_dir_block(struct pass2_worker_struct *pw,
+			  struct ext2_db_entry *db, struct pass2_msg *msg)
+{
+	e2fsck_t		ctx = pw->ctx;
+	ext2_filsys		fs = ctx->fs;
+	char			*buf = pw->buf;
+	ext2_ino_t		ino = db->ino;
+	struct ext2_dir_entry	*dirent;
+	struct dir_info		*subdir;
+	struct ext2_inode	inode;
+	unsigned int		offset = 0;
+	int			dot_state, name_len, i;
+	int			dups_found = 0, ret = 1;
+	int			filetype, should_be;
+	errcode_t		retval;
+#ifdef ENABLE_HTREE
+	struct dx_dir_info	*dx_dir;
+	struct ext2_dx_root_info *root;
+	struct ext2_dx_countlimit *limit;
+	ext2_dirhash_t		hash;
+	blk_t			blk;
+#endif
+
+	msg->num_ents = 0;
+	msg->dx_leaf = 0;
+	msg->min_hash = ~0;
+	msg->max_hash = 0;
+
+	if (!ext2fs_test_inode_bitmap(ctx->inode_used_map, ino) ||
+	    db->blk == 0 ||
+	    (ctx->block_dup_map &&
+	     ext2fs_test_block_bitmap(ctx->block_dup_map, db->blk)))
+		return 1;
+
+#ifdef ENABLE_HTREE
+	dx_dir = e2fsck_get_dx_dir_info(ctx, ino);
+	if (dx_dir && !dx_dir->numblocks)
+		dx_dir = 0;
+	if (dx_dir && (db->blockcnt == 0 ||
+		       db->blockcnt >= dx_dir->numblocks))
+		return 1;
+	if (dx_dir && pw->hash_ino != ino) {
+		if (ext2fs_bmap(fs, ino, 0, 0, 0, 0, &blk) || !blk ||
+		    io_channel_read_blk(fs->io, blk, 1, buf))
+			return 1;
+		root = (struct ext2_dx_root_info *) (buf + 24);
+		pw->hash_ino = ino;
+		pw->hash_version = root->hash_version;
+	}
+#endif
+
+	dot_state = db->blockcnt ? 2 : 0;
+	if (ctx->dirs_to_hash &&
+	    ext2fs_u32_list_test(ctx->dirs_to_hash, ino))
+		dups_found++;
+
+	retval = ext2fs_read_dir_block(fs, db->blk, buf);
+	if (retval && retval != EXT2_ET_DIR_CORRUPTED)
+		return 1;
+
+#ifdef ENABLE_HTREE
+	if (dx_dir) {
+		/* Interior nodes go to check_dir_block */
+		dirent = (struct ext2_dir_entry *) buf;
+		limit = (struct ext2_dx_countlimit *) (buf+8);
+		if ((dirent->inode == 0) &&
+		    (dirent->rec_len == fs->blocksize) &&
+		    (dirent->name_len == 0) &&
+		    (ext2fs_le16_to_cpu(limit->limit) == 
+		     ((fs->blocksize-8) / sizeof(struct ext2_dx_entry))))
+			return 1;
+		msg->dx_leaf = 1;
+		msg->hash_version = pw->hash_version;
+	}
+#endif
+
+	dict_init(&pw->de_dict, DICTCOUNT_T_MAX, dict_de_cmp);
+	dict_set_allocator(&pw->de_dict, dnode_pool_alloc, dnode_pool_free,
+			   &pw->de_pool);
+	do {
+		dirent = (struct ext2_dir_entry *) (buf + offset);
+		name_len = dirent->name_len & 0xFF;
+		if (((offset + dirent->rec_len) > fs->blocksize) ||
+		    (dirent->rec_len < 12) ||
+		    ((dirent->rec_len % 4) != 0) ||
+		    ((name_len+8) > dirent->rec_len) ||
+		    (name_len > EXT2_NAME_LEN))
+			goto out;
+
+		if (dot_state == 0) {
+			if (dirent->inode != ino || name_len != 1 ||
+			    dirent->name[0] != '.' || dirent->name[1] != '\0' ||
+			    dirent->rec_len > 24)
+				goto out;
+		} else if (dot_state == 1) {
+			if (!e2fsck_get_dir_info(ctx, ino) ||
+			    !dirent->inode || name_len != 2 ||
+			    dirent->name[0] != '.' || dirent->name[1] != '.' ||
+			    dirent->name[2] != '\0')
+				goto out;
+		} else if (dirent->inode == ino)
+			goto out;
+		if (!dirent->inode)
+			goto next;
+
+		if (((dirent->inode != EXT2_ROOT_INO) &&
+		     (dirent->inode < EXT2_FIRST_INODE(fs->super))) ||
+		    (dirent->inode > fs->super->s_inodes_count) ||
+		    !ext2fs_test_inode_bitmap(ctx->inode_used_map,
+					      dirent->inode) ||
+		    (ctx->inode_bb_map &&
+		     ext2fs_test_inode_bitmap(ctx->inode_bb_map,
+					      dirent->inode)) ||
+		    (ctx->inode_bad_map &&
+		     ext2fs_test_inode_bitmap(ctx->inode_bad_map,
+					      dirent->inode)))
+			goto out;
+		if ((dot_state > 1) &&
+		    ((name_len == 0) || (dirent->inode == EXT2_ROOT_INO) ||
+		     ((name_len == 1) && (dirent->name[0] == '.')) ||
+		     ((name_len == 2) && (dirent->name[0] == '.') &&
+		      (dirent->name[1] == '.'))))
+			goto out;
+		for (i = 0; i < name_len; i++)
+			if (dirent->name[i] == '/' || dirent->name[i] == '\0')
+				goto out;
+
+		filetype = dirent->name_len >> 8;
+		if (!(fs->super->s_feature_incompat &
+		      EXT2_FEATURE_INCOMPAT_FILETYPE)) {
+			if (filetype)
+				goto out;
+		} else {
+			if (ext2fs_test_inode_bitmap(ctx->inode_dir_map,
+						     dirent->inode))
+				should_be = EXT2_FT_DIR;
+			else if (ext2fs_test_inode_bitmap(ctx->inode_reg_map,
+							  dirent->inode))
+				should_be = EXT2_FT_REG_FILE;
+			else {
+				if (ext2fs_read_inode(fs, dirent->inode,
+						      &inode))
+					goto out;
+				should_be = ext2_file_type(inode.i_mode);
+			}
+			if (filetype != should_be)
+				goto out;
+		}
+
+#ifdef ENABLE_HTREE
+		if (msg->dx_leaf) {
+			ext2fs_dirhash(pw->hash_version, dirent->name,
+				       name_len, fs->super->s_hash_seed,
+				       &hash, 0);
+			if (hash < msg->min_hash)
+				msg->min_hash = hash;
+			if (hash > msg->max_hash)
+				msg->max_hash = hash;
+		}
+#endif
+
+		/*
+		 * The parent will check again that nobody else has
+		 * claimed the subdirectory in the meantime; noting the
+		 * claim in our own copy catches the later blocks which
+		 * this worker looks at.
+		 */
+		if ((dot_state > 1) &&
+		    ext2fs_test_inode_bitmap(ctx->inode_dir_map,
+					     dirent->inode)) {
+			subdir = e2fsck_get_dir_info(ctx, dirent->inode);
+			if (!subdir || subdir->parent)
+				goto out;
+			subdir->parent = ino;
+		}
+
+		if (!dups_found) {
+			if (dict_lookup(&pw->de_dict, dirent))
+				goto out;
+			dict_alloc_insert(&pw->de_dict, dirent, dirent);
+		}
+
+		if (add_dir_ent(&pw->ents, &pw->max_ents, msg->num_ents,
+				dirent->inode, dot_state))
+			goto out;
+		msg->num_ents++;
+	next:
+		offset += dirent->rec_len;
+		dot_state++;
+	} while (offset < fs->blocksize);
+	if (offset == fs->blocksize)
+		ret = 0;
+out:
+	dict_free_nodes(&pw->de_dict);
+	if (ret)
+		msg->num_ents = 0;
+	return ret;
+}
+
+static int pass2_worker_proc(ext2_filsys fs, struct ext2_db_entry *db,
+			     void *priv_data)
+{
+	struct pass2_worker_struct *pw;
+	struct pass2_msg msg;
+	ext2_ino_t	i, batch;
+
+	pw = (struct pass2_worker_struct *) priv_data;
+	i = pw->index++;
+	if (i < pw->start)
+		return 0;
+	batch = (i - pw->start) / DIR_READAHEAD_BATCH;
+	if (batch % pw->num_workers != (ext2_ino_t) pw->worker)
+		return 0;
+
+	/* Read ahead this batch (the first time) and our next one */
+	if ((i - pw->start) % DIR_READAHEAD_BATCH == 0) {
+		if (batch < (ext2_ino_t) pw->num_workers)
+			ext2fs_dblist_readahead(fs->dblist, i,
+						DIR_READAHEAD_BATCH);
+		ext2fs_dblist_readahead(fs->dblist, i + pw->num_workers *
+					DIR_READAHEAD_BATCH,
+					DIR_READAHEAD_BATCH);
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.index = i;
+	msg.check = scan_dir_block(pw, db, &msg);
+	if (e2fsck_write_all(pw->fd, &msg, sizeof(msg)) ||
+	    e2fsck_write_all(pw->fd, pw->ents,
+			     msg.num_ents * sizeof(struct pass2_ent)))
+		return DIRENT_ABORT;
+	return 0;
+}
+
+static int pass2_worker(e2fsck_t ctx, int worker, int fd, void *priv_data)
+{
+	struct pass2_worker_struct *pw;
+
+	pw = (struct pass2_worker_struct *) priv_data;
+	pw->worker = worker;
+	pw->fd = fd;
+	pw->buf = (char *) e2fsck_allocate_memory(ctx, ctx->fs->blocksize,
+						  "directory scan buffer");
+	dnode_pool_init(&pw->de_pool);
+	ext2fs_dblist_iterate(ctx->fs->dblist, pass2_worker_proc, pw);
+	return 0;
+}
+
+/*
+ * Start the pass 2 workers on the rest of the directory block list,
+ * from cd->index on.
+ */
+static void start_pass2_workers(struct check_dir_struct *cd)
+{
+	e2fsck_t	ctx = cd->ctx;
+	struct pass2_worker_struct pw;
+	int		num_workers = ctx->pass2_workers;
+
+	cd->num_workers = -1;
+	if (num_workers < 2 ||
+	    cd->max - cd->index <= DIR_READAHEAD_BATCH)
+		return;
+	memset(&pw, 0, sizeof(pw));
+	pw.ctx = ctx;
+	pw.num_workers = num_workers;
+	pw.start = cd->worker_start = cd->index;
+	cd->workers = (struct e2fsck_worker *)
+		e2fsck_allocate_memory(ctx, num_workers *
+				       sizeof(struct e2fsck_worker),
+				       "pass 2 workers");
+	if (!e2fsck_start_workers(ctx, cd->workers, num_workers,
+				  pass2_worker, &pw)) {
+		ext2fs_free_mem(&cd->workers);
+		return;
+	}
+	cd->num_workers = num_workers;
+}
+
+static void stop_pass2_workers(struct check_dir_struct *cd)
+{
+	if (cd->num_workers <= 0)
+		return;
+	e2fsck_stop_workers(cd->workers, cd->num_workers);
+	ext2fs_free_mem(&cd->workers);
+	ext2fs_free_mem(&cd->ents);
+	cd->num_workers = -1;
+}
+
+/*
+ * Read what the worker found out about the block at cd->index.
+ * Returns 0 if the block needs no fixing, and 1 if it has to go
+ * through check_dir_block(), which is also the case if the worker has
+ * gone away.
+ */
+static int read_dir_block_result(struct check_dir_struct *cd)
+{
+	struct e2fsck_worker *w;
+	struct pass2_msg *msg = &cd->msg;
+	int		new_max;
+
+	w = &cd->workers[((cd->index - cd->worker_start) /
+			  DIR_READAHEAD_BATCH) % cd->num_workers];
+	if (w->fd < 0)
+		return 1;
+	if (e2fsck_read_all(w->fd, msg, sizeof(*msg)) ||
+	    msg->index != cd->index || msg->num_ents < 0)
+		goto fail;
+	if (msg->num_ents > cd->max_ents) {
+		new_max = msg->num_ents;
+		if (ext2fs_resize_mem(cd->max_ents * sizeof(struct pass2_ent),
+				      new_max * sizeof(struct pass2_ent),
+				      &cd->ents))
+			goto fail;
+		cd->max_ents = new_max;
+	}
+	if (e2fsck_read_all(w->fd, cd->ents,
+			    msg->num_ents * sizeof(struct pass2_ent)))
+		goto fail;
+	return msg->check;
+fail:
+	close(w->fd);
+	w->fd = -1;
+	return 1;
+}
+
+/*
+ * Account for the entries of a directory block which a worker found
+ * to need no fixing: the link counts, the parents of subdirectories
+ * and '..', and the hash range of an htree leaf.  Returns 1 without
+ * changing anything if something has changed since the worker looked
+ * at the block, in which case check_dir_block() has to check it after
+ * all.
+ */
+static int replay_dir_block(e2fsck_t ctx, struct ext2_db_entry *db,
+			    struct check_dir_struct *cd)
+{
+	struct pass2_msg	*msg = &cd->msg;
+	struct pass2_ent	*ent;
+	struct dir_info		*dir;
+	struct dx_dir_info	*dx_dir = 0;
+	int			i;
+	__u16			links;
+
+	for (i = 0, ent = cd->ents; i < msg->num_ents; i++, ent++) {
+		if (!ext2fs_test_inode_bitmap(ctx->inode_used_map, ent->ino) ||
+		    (ctx->inode_bb_map &&
+		     ext2fs_test_inode_bitmap(ctx->inode_bb_map, ent->ino)) ||
+		    (ctx->inode_bad_map &&
+		     ext2fs_test_inode_bitmap(ctx->inode_bad_map, ent->ino)))
+			return 1;
+		if (ent->dot_state == 1) {
+			if (!e2fsck_get_dir_info(ctx, db->ino))
+				return 1;
+		} else if (ent->dot_state > 1 &&
+			   ext2fs_test_inode_bitmap(ctx->inode_dir_map,
+						    ent->ino)) {
+			dir = e2fsck_get_dir_info(ctx, ent->ino);
+			if (!dir || dir->parent)
+				return 1;
+		}
+	}
+#ifdef ENABLE_HTREE
+	dx_dir = e2fsck_get_dx_dir_info(ctx, db->ino);
+	if (dx_dir && !dx_dir->numblocks)
+		dx_dir = 0;
+	if (dx_dir && (!msg->dx_leaf ||
+		       msg->hash_version != dx_dir->hashversion))
+		return 1;
+#endif
+
+	for (i = 0, ent = cd->ents; i < msg->num_ents; i++, ent++) {
+		if (ent->dot_state == 1)
+			e2fsck_get_dir_info(ctx, db->ino)->dotdot = ent->ino;
+		else if (ent->dot_state > 1 &&
+			 ext2fs_test_inode_bitmap(ctx->inode_dir_map,
+						  ent->ino))
+			e2fsck_get_dir_info(ctx, ent->ino)->parent = db->ino;
+		ext2fs_icount_increment(ctx->inode_count, ent->ino, &links);
+		if (links > 1)
+			ctx->fs_links_count++;
+		ctx->fs_total_count++;
+	}
+#ifdef ENABLE_HTREE
+	if (dx_dir) {
+		dx_dir->dx_block[db->blockcnt].type = DX_DIRBLOCK_LEAF;
+		dx_dir->dx_block[db->blockcnt].phys = db->blk;
+		dx_dir->dx_block[db->blockcnt].min_hash = msg->min_hash;
+		dx_dir->dx_block[db->blockcnt].max_hash = msg->max_hash;
+		cd->pctx.dir = cd->pctx.ino;
+	}
+#endif
+	return 0;
+}
+
 static int check_dir_block(ext2_filsys fs,
 			   struct ext2_db_entry *db,
 			   void *priv_data)
@@ -719,6 +1212,7 @@ static int check_dir_block(ext2_filsys fs,
 	static dict_t de_dict;
 	struct problem_context	pctx;
 	int	dups_found = 0;
+	int	clean = 0;
 
 	cd = (struct check_dir_struct *) priv_data;
 	buf = cd->buf;
@@ -729,6 +1223,23 @@ static int check_dir_block(ext2_filsys fs,
 	
 	if (ctx->progress && (ctx->progress)(ctx, 2, cd->count++, cd->max))
 		return DIRENT_ABORT;
+
+	/*
+	 * The workers, if any, read ahead their own blocks.  Otherwise,
+	 * since the directory block list is sorted, reading ahead the
+	 * blocks for the next batch of entries lets the disk stream
+	 * through them while we check this one.
+	 */
+	if (cd->num_workers == 0)
+		start_pass2_workers(cd);
+	if (cd->num_workers > 0)
+		clean = !read_dir_block_result(cd);
+	else if (cd->readahead_next <= cd->index + DIR_READAHEAD_BATCH) {
+		ext2fs_dblist_readahead(fs->dblist, cd->readahead_next,
+					DIR_READAHEAD_BATCH);
+		cd->readahead_next += DIR_READAHEAD_BATCH;
+	}
+	cd->index++;
 	
 	/*
 	 * Make sure the inode is still in use (could have been 
@@ -744,6 +1255,9 @@ static int check_dir_block(ext2_filsys fs,
 	cd->pctx.dirent = 0;
 	cd->pctx.num = 0;
 
+	if (clean && !replay_dir_block(ctx, db, cd))
+		return 0;
+
 	if (db->blk == 0) {
 		if (allocate_dir_block(ctx, db, buf, &cd->pctx))
 			return 0;
@@ -813,7 +1327,13 @@ static int check_dir_block(ext2_filsys fs,
 	}
 #endif /* ENABLE_HTREE */
 
+	/*
+	 * The dictionary is filled and emptied again for every
+	 * directory block, so recycle its nodes through a pool.
+	 */
 	dict_init(&de_dict, DICTCOUNT_T_MAX, dict_de_cmp);
+	dict_set_allocator(&de_dict, dnode_pool_alloc, dnode_pool_free,
+			   &cd->de_pool);
 	prev = 0;
 	do {
 		problem = 0;
@@ -111,7 +111,8 @@ static void print_bitmap_problem(e2fsck_t ctx, int problem,
 static void check_block_bitmaps(e2fsck_t ctx)
 {
 	ext2_filsys fs = ctx->fs;
-	blk_t	i, super;
+	blk_t	i, super, next, group_end;
+	unsigned int	used;
 	int	*free_array;
 	int	group = 0;
 	unsigned int	blocks = 0;
@@ -123,6 +124,7 @@ static void check_block_bitmaps(e2fsck_t ctx)
 	errcode_t	retval;
 	int		lazy_bg = 0;
 	int		skip_group = 0;
+	int		has_super = 0;
 	
 	clear_problem_context(&pctx);
 	free_array = (int *) e2fsck_allocate_memory(ctx,
@@ -167,18 +169,48 @@ redo_counts:
 	save_problem = 0;
 	pctx.blk = pctx.blk2 = NO_BLK;
 	if (lazy_bg && (fs->group_desc[group].bg_flags &
-			EXT2_BG_BLOCK_UNINIT))
+			EXT2_BG_BLOCK_UNINIT)) {
 		skip_group++;
+		has_super = ext2fs_bg_has_super(fs, group);
+	}
 	super = fs->super->s_first_data_block;
 	for (i = fs->super->s_first_data_block;
 	     i < fs->super->s_blocks_count;
 	     i++) {
+		/*
+		 * Skip over the part of this group where the two
+		 * bitmaps agree, counting its free blocks a word at a
+		 * time.
+		 */
+		if (!skip_group) {
+			group_end = i + (fs->super->s_blocks_per_group -
+					 blocks) - 1;
+			if (group_end > fs->super->s_blocks_count - 1)
+				group_end = fs->super->s_blocks_count - 1;
+			if (ext2fs_find_first_diff_generic_bitmap(
+				    ctx->block_found_map, fs->block_map,
+				    i, group_end, &next))
+				next = group_end + 1;
+			if (next > i) {
+				used = ext2fs_count_generic_bitmap_range(
+					fs->block_map, i, next - 1);
+				group_free += (next - i) - used;
+				free_blocks += (next - i) - used;
+				blocks += next - i;
+				if (next > group_end) {
+					i = group_end;
+					goto end_of_group;
+				}
+				i = next;
+			}
+		}
+
 		actual = ext2fs_fast_test_block_bitmap(ctx->block_found_map, i);
 
 		if (skip_group) {
 			if ((i >= super) &&
 			    (i <= super + fs->desc_blocks) &&
-			    ext2fs_bg_has_super(fs, group))
+			    has_super)
 				bitmap = 1;
 			else if (i == fs->group_desc[group].bg_block_bitmap)
 				bitmap = 1;
@@ -230,6 +262,7 @@ redo_counts:
 			free_blocks++;
 		}
 		blocks ++;
+	end_of_group:
 		if ((blocks == fs->super->s_blocks_per_group) ||
 		    (i == fs->super->s_blocks_count-1)) {
 			free_array[group] = group_free;
@@ -245,8 +278,10 @@ redo_counts:
 			if (lazy_bg &&
 			    (i != fs->super->s_blocks_count-1) &&
 			    (fs->group_desc[group].bg_flags &
-			     EXT2_BG_BLOCK_UNINIT))
+			     EXT2_BG_BLOCK_UNINIT)) {
 				skip_group++;
+				has_super = ext2fs_bg_has_super(fs, group);
+			}
 		}
 	}
 	if (pctx.blk != NO_BLK)
@@ -306,10 +341,30 @@ redo_counts:
 	ext2fs_free_mem(&free_array);
 }
 			
+/*
+ * Count the directories from first to last which are marked in use in
+ * the on-disk inode bitmap.
+ */
+static int count_dirs(e2fsck_t ctx, ext2_ino_t first, ext2_ino_t last)
+{
+	ext2_ino_t	ino;
+	int		count = 0;
+
+	for (ino = first; ino <= last; ino++) {
+		if (ext2fs_find_first_set_generic_bitmap(ctx->inode_dir_map,
+							 ino, last, &ino))
+			break;
+		if (ext2fs_fast_test_inode_bitmap(ctx->fs->inode_map, ino))
+			count++;
+	}
+	return count;
+}
+
 static void check_inode_bitmaps(e2fsck_t ctx)
 {
 	ext2_filsys fs = ctx->fs;
-	ext2_ino_t	i;
+	ext2_ino_t	i, next, group_end;
+	unsigned int	used;
 	unsigned int	free_inodes = 0;
 	int		group_free = 0;
 	int		dirs_count = 0;
@@ -371,6 +426,35 @@ redo_counts:
 		skip_group++;
 
 	for (i = 1; i <= fs->super->s_inodes_count; i++) {
+		/*
+		 * Skip over the part of this group where the two
+		 * bitmaps agree, counting its free inodes a word at a
+		 * time.
+		 */
+		if (!skip_group) {
+			group_end = i + (fs->super->s_inodes_per_group -
+					 inodes) - 1;
+			if (group_end > fs->super->s_inodes_count)
+				group_end = fs->super->s_inodes_count;
+			if (ext2fs_find_first_diff_generic_bitmap(
+				    ctx->inode_used_map, fs->inode_map,
+				    i, group_end, &next))
+				next = group_end + 1;
+			if (next > i) {
+				used = ext2fs_count_generic_bitmap_range(
+					fs->inode_map, i, next - 1);
+				group_free += (next - i) - used;
+				free_inodes += (next - i) - used;
+				dirs_count += count_dirs(ctx, i, next - 1);
+				inodes += next - i;
+				if (next > group_end) {
+					i = group_end;
+					goto end_of_group;
+				}
+				i = next;
+			}
+		}
+
 		actual = ext2fs_fast_test_inode_bitmap(ctx->inode_used_map, i);
 		if (skip_group) 
 			bitmap = 0;
@@ -415,6 +499,7 @@ do_counts:
 			free_inodes++;
 		}
 		inodes++;
+	end_of_group:
 		if ((inodes == fs->super->s_inodes_per_group) ||
 		    (i == fs->super->s_inodes_count)) {
 			free_array[group] = group_free;
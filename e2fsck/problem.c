@@ -1592,6 +1592,16 @@ int fix_problem(e2fsck_t ctx, problem_t code, struct problem_context *pctx)
 	int		print_answer = 0;
 	int		suppress = 0;
 
+	/*
+	 * A worker process never asks or changes anything; it leaves
+	 * whatever it was doing to the parent, which will run into
+	 * the same problem again.
+	 */
+	if (ctx->flags & E2F_FLAG_WORKER) {
+		ctx->flags |= E2F_FLAG_WORKER_PUNT;
+		return 0;
+	}
+
 	ptr = find_problem(code);
 	if (!ptr) {
 		printf(_("Unhandled error code (0x%x)!\n"), code);
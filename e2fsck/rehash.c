@@ -43,6 +43,13 @@
  * filesystems (when we reach the level of tens of millions of files
  * in a single directory).  It will probably be easier to simply
  * require that e2fsck use VM first.
+ *
+ * In the meantime, the directory buffers and the hash array are
+ * allocated as scratch memory, so that if a scratch directory has been
+ * configured in e2fsck.conf they are kept in files there rather than
+ * in RAM.  In that case large hash arrays are also sorted as a series
+ * of runs which are then merged, so that the sort works through the
+ * scratch file sequentially instead of paging it in at random.
  */
 
 #include <string.h>
@@ -61,6 +68,10 @@ struct fill_dir_struct {
 	int dir_size;
 	int compress;
 	ino_t parent;
+	/* Used to hash the names in each block all at once */
+	const char **names;
+	int *lens;
+	ext2_dirhash_t *hashes, *minor_hashes;
 };
 
 struct hash_entry {
@@ -84,10 +95,11 @@ static int fill_dir_block(ext2_filsys fs,
 			  void *priv_data)
 {
 	struct fill_dir_struct	*fd = (struct fill_dir_struct *) priv_data;
-	struct hash_entry 	*new_array, *ent;
+	struct hash_entry 	*ent;
 	struct ext2_dir_entry 	*dirent;
 	char			*dir;
 	unsigned int		offset, dir_offset;
+	int			i, first;
 	
 	if (blockcnt < 0)
 		return 0;
@@ -108,6 +120,7 @@ static int fill_dir_block(ext2_filsys fs,
 			return BLOCK_ABORT;
 	}
 	/* While the directory block is "hot", index it. */
+	first = fd->num_array;
 	dir_offset = 0;
 	while (dir_offset < fs->blocksize) {
 		dirent = (struct ext2_dir_entry *) (dir + dir_offset);
@@ -130,31 +143,37 @@ static int fill_dir_block(ext2_filsys fs,
 			continue;
 		}
 		if (fd->num_array >= fd->max_array) {
-			new_array = realloc(fd->harray,
-			    sizeof(struct hash_entry) * (fd->max_array+500));
-			if (!new_array) {
-				fd->err = ENOMEM;
+			fd->err = ext2fs_resize_scratch_mem(0,
+			    sizeof(struct hash_entry) * (fd->max_array * 2 + 500),
+			    &fd->harray);
+			if (fd->err)
 				return BLOCK_ABORT;
-			}
-			fd->harray = new_array;
-			fd->max_array += 500;
+			fd->max_array = fd->max_array * 2 + 500;
 		}
 		ent = fd->harray + fd->num_array++;
 		ent->dir = dirent;
 		fd->dir_size += EXT2_DIR_REC_LEN(dirent->name_len & 0xFF);
-		if (fd->compress)
-			ent->hash = ent->minor_hash = 0;
-		else {
-			fd->err = ext2fs_dirhash(fs->super->s_def_hash_version,
-						 dirent->name,
-						 dirent->name_len & 0xFF,
-						 fs->super->s_hash_seed,
-						 &ent->hash, &ent->minor_hash);
-			if (fd->err)
-				return BLOCK_ABORT;
-		}
+		ent->hash = ent->minor_hash = 0;
+	}
+	if (fd->compress || fd->num_array == first)
+		return 0;
+
+	/* Hash all of the names in this block in one go */
+	for (i = first; i < fd->num_array; i++) {
+		dirent = fd->harray[i].dir;
+		fd->names[i - first] = dirent->name;
+		fd->lens[i - first] = dirent->name_len & 0xFF;
+	}
+	fd->err = ext2fs_dirhash_many(fs->super->s_def_hash_version,
+				      fd->num_array - first, fd->names,
+				      fd->lens, fs->super->s_hash_seed,
+				      fd->hashes, fd->minor_hashes);
+	if (fd->err)
+		return BLOCK_ABORT;
+	for (i = first; i < fd->num_array; i++) {
+		fd->harray[i].hash = fd->hashes[i - first];
+		fd->harray[i].minor_hash = fd->minor_hashes[i - first];
 	}
-	
 	return 0;
 }
 
@@ -204,24 +223,88 @@ static EXT2_QSORT_TYPE hash_cmp(const void *a, const void *b)
 	return ret;
 }
 
+/*
+ * Number of hash entries sorted at a time when the hash array is in
+ * a scratch file; see sort_entries().
+ */
+#define REHASH_SORT_RUN		65536
+
+/*
+ * Sort num hash entries.  If the array is in a scratch file, sort it
+ * in runs of REHASH_SORT_RUN entries and then merge the runs pairwise,
+ * so that each pass reads and writes the array in order.
+ */
+static void sort_entries(ext2_filsys fs, struct hash_entry *harray, int num,
+			 EXT2_QSORT_TYPE (*cmp)(const void *, const void *))
+{
+	struct hash_entry	*buf, *src, *dst, *tmp;
+	int			run, i, j, k, d, mid, end;
+
+	if (!fs->scratch_dir || num <= REHASH_SORT_RUN ||
+	    ext2fs_get_scratch_mem(fs, num * sizeof(struct hash_entry),
+				   &buf)) {
+		qsort(harray, num, sizeof(struct hash_entry), cmp);
+		return;
+	}
+
+	for (i = 0; i < num; i += REHASH_SORT_RUN)
+		qsort(harray + i, (num - i < REHASH_SORT_RUN) ?
+		      num - i : REHASH_SORT_RUN,
+		      sizeof(struct hash_entry), cmp);
+
+	src = harray;
+	dst = buf;
+	for (run = REHASH_SORT_RUN; run < num; run *= 2) {
+		for (i = 0; i < num; i += 2 * run) {
+			mid = (num - i < run) ? num : i + run;
+			end = (num - i < 2 * run) ? num : i + 2 * run;
+			j = i;
+			k = mid;
+			d = i;
+			while (j < mid && k < end) {
+				if ((cmp)(&src[k], &src[j]) < 0)
+					dst[d++] = src[k++];
+				else
+					dst[d++] = src[j++];
+			}
+			while (j < mid)
+				dst[d++] = src[j++];
+			while (k < end)
+				dst[d++] = src[k++];
+		}
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	if (src != harray)
+		memcpy(harray, src, num * sizeof(struct hash_entry));
+	ext2fs_free_scratch_mem(&buf);
+}
+
 static errcode_t alloc_size_dir(ext2_filsys fs, struct out_dir *outdir, 
 				int blocks)
 {
 	void			*new_mem;
+	errcode_t		retval;
 
 	if (outdir->max) {
-		new_mem = realloc(outdir->buf, blocks * fs->blocksize);
-		if (!new_mem)
-			return ENOMEM;
-		outdir->buf = new_mem;
+		retval = ext2fs_resize_scratch_mem(0, blocks * fs->blocksize,
+						   &outdir->buf);
+		if (retval)
+			return retval;
 		new_mem = realloc(outdir->hashes,
 				  blocks * sizeof(ext2_dirhash_t));
 		if (!new_mem)
 			return ENOMEM;
 		outdir->hashes = new_mem;
 	} else {
-		outdir->buf = malloc(blocks * fs->blocksize);
+		retval = ext2fs_get_scratch_mem(fs, blocks * fs->blocksize,
+						&outdir->buf);
+		if (retval)
+			return retval;
 		outdir->hashes = malloc(blocks * sizeof(ext2_dirhash_t));
+		if (!outdir->hashes)
+			return ENOMEM;
 		outdir->num = 0;
 	}
 	outdir->max = blocks;
@@ -231,7 +314,7 @@ static errcode_t alloc_size_dir(ext2_filsys fs, struct out_dir *outdir,
 static void free_out_dir(struct out_dir *outdir)
 {
 	if (outdir->buf)
-		free(outdir->buf);
+		ext2fs_free_scratch_mem(&outdir->buf);
 	if (outdir->hashes)
 		free(outdir->hashes);
 	outdir->max = 0;
@@ -374,6 +457,27 @@ static int duplicate_search_and_fix(e2fsck_t ctx, ext2_filsys fs,
 	return fixed;
 }
 
+/*
+ * Return 1 if the sorted hash array has two entries with the same
+ * name, without trying to fix them.
+ */
+static int duplicate_search(struct fill_dir_struct *fd)
+{
+	struct hash_entry 	*ent, *prev;
+	int			i;
+
+	for (i=1; i < fd->num_array; i++) {
+		ent = fd->harray + i;
+		prev = ent - 1;
+		if (ent->dir->inode &&
+		    ((ent->dir->name_len & 0xFF) ==
+		     (prev->dir->name_len & 0xFF)) &&
+		    !strncmp(ent->dir->name, prev->dir->name,
+			     ent->dir->name_len & 0xFF))
+			return 1;
+	}
+	return 0;
+}
 
 static errcode_t copy_dir_entries(ext2_filsys fs,
 				  struct fill_dir_struct *fd,
@@ -654,30 +758,54 @@ static errcode_t write_directory(e2fsck_t ctx, ext2_filsys fs,
 	return 0;
 }
 
-errcode_t e2fsck_rehash_dir(e2fsck_t ctx, ext2_ino_t ino)
+/*
+ * Read in a directory and build its new contents in outdir.  A
+ * rehash worker (see below) must not report or fix any problems, so
+ * if in_worker is set, a directory with duplicate entries is left for
+ * the parent to rebuild by returning EEXIST.
+ */
+static errcode_t rebuild_dir(e2fsck_t ctx, ext2_ino_t ino,
+			     struct out_dir *outdir, int *compress,
+			     int in_worker)
 {
 	ext2_filsys 		fs = ctx->fs;
 	errcode_t		retval;
 	struct ext2_inode 	inode;
 	char			*dir_buf = 0;
 	struct fill_dir_struct	fd;
-	struct out_dir		outdir;
-	
-	outdir.max = outdir.num = 0;
-	outdir.buf = 0;
-	outdir.hashes = 0;
-	e2fsck_read_inode(ctx, ino, &inode, "rehash_dir");
+	int			i;
+
+	if (in_worker) {
+		retval = ext2fs_read_inode(fs, ino, &inode);
+		if (retval)
+			return retval;
+	} else
+		e2fsck_read_inode(ctx, ino, &inode, "rehash_dir");
 
-	retval = ENOMEM;
 	fd.harray = 0;
-	dir_buf = malloc(inode.i_size);
-	if (!dir_buf)
+	fd.names = 0;
+	fd.lens = 0;
+	fd.hashes = fd.minor_hashes = 0;
+	retval = ext2fs_get_scratch_mem(fs, inode.i_size, &dir_buf);
+	if (retval)
 		goto errout;
 
 	fd.max_array = inode.i_size / 32;
 	fd.num_array = 0;
-	fd.harray = malloc(fd.max_array * sizeof(struct hash_entry));
-	if (!fd.harray)
+	retval = ext2fs_get_scratch_mem(fs, fd.max_array *
+					sizeof(struct hash_entry),
+					&fd.harray);
+	if (retval)
+		goto errout;
+
+	/* No more than one entry for every 8 bytes of a block */
+	i = fs->blocksize / 8;
+	retval = ENOMEM;
+	fd.names = malloc(i * sizeof(const char *));
+	fd.lens = malloc(i * sizeof(int));
+	fd.hashes = malloc(i * sizeof(ext2_dirhash_t));
+	fd.minor_hashes = malloc(i * sizeof(ext2_dirhash_t));
+	if (!fd.names || !fd.lens || !fd.hashes || !fd.minor_hashes)
 		goto errout;
 
 	fd.ctx = ctx;
@@ -707,16 +835,19 @@ errcode_t e2fsck_rehash_dir(e2fsck_t ctx, ext2_ino_t ino)
 	/* Sort the list */
 resort:
 	if (fd.compress)
-		qsort(fd.harray+2, fd.num_array-2,
-		      sizeof(struct hash_entry), name_cmp);
+		sort_entries(fs, fd.harray+2, fd.num_array-2, name_cmp);
 	else
-		qsort(fd.harray, fd.num_array,
-		      sizeof(struct hash_entry), hash_cmp);
+		sort_entries(fs, fd.harray, fd.num_array, hash_cmp);
 
 	/*
 	 * Look for duplicates
 	 */
-	if (duplicate_search_and_fix(ctx, fs, ino, &fd))
+	if (in_worker) {
+		if (duplicate_search(&fd)) {
+			retval = EEXIST;
+			goto errout;
+		}
+	} else if (duplicate_search_and_fix(ctx, fs, ino, &fd))
 		goto resort;
 
 	if (ctx->options & E2F_OPT_NO) {
@@ -728,33 +859,196 @@ resort:
 	 * Copy the directory entries.  In a htree directory these
 	 * will become the leaf nodes.
 	 */
-	retval = copy_dir_entries(fs, &fd, &outdir);
+	retval = copy_dir_entries(fs, &fd, outdir);
 	if (retval)
 		goto errout;
 	
-	free(dir_buf); dir_buf = 0;
+	ext2fs_free_scratch_mem(&dir_buf);
 
 	if (!fd.compress) {
 		/* Calculate the interior nodes */
-		retval = calculate_tree(fs, &outdir, ino, fd.parent);
+		retval = calculate_tree(fs, outdir, ino, fd.parent);
 		if (retval)
 			goto errout;
 	}
-	
-	retval = write_directory(ctx, fs, &outdir, ino, fd.compress);
-	if (retval)
-		goto errout;
+	*compress = fd.compress;
 
 errout:
 	if (dir_buf)
-		free(dir_buf);
+		ext2fs_free_scratch_mem(&dir_buf);
 	if (fd.harray)
-		free(fd.harray);
+		ext2fs_free_scratch_mem(&fd.harray);
+	if (fd.names)
+		free(fd.names);
+	if (fd.lens)
+		free(fd.lens);
+	if (fd.hashes)
+		free(fd.hashes);
+	if (fd.minor_hashes)
+		free(fd.minor_hashes);
+	return retval;
+}
 
+errcode_t e2fsck_rehash_dir(e2fsck_t ctx, ext2_ino_t ino)
+{
+	errcode_t		retval;
+	struct out_dir		outdir;
+	int			compress = 0;
+
+	outdir.max = outdir.num = 0;
+	outdir.buf = 0;
+	outdir.hashes = 0;
+	retval = rebuild_dir(ctx, ino, &outdir, &compress, 0);
+	if (!retval && !(ctx->options & E2F_OPT_NO))
+		retval = write_directory(ctx, ctx->fs, &outdir, ino,
+					 compress);
 	free_out_dir(&outdir);
 	return retval;
 }
 
+/*
+ * With the rehash_workers extended option, the directories are
+ * rebuilt in memory by several child processes at once, each taking
+ * every n'th directory in the list.  The parent takes the results in
+ * list order and does all of the block allocation and writing itself,
+ * so the filesystem ends up the same as if it had done all the work.
+ * A directory which a worker can't rebuild without help (because it
+ * has duplicate entries which need to be fixed, or because of an
+ * error) is rebuilt by the parent in the usual way, so that problems
+ * are reported in the same order as well.
+ */
+struct rehash_result {
+	ext2_ino_t	ino;
+	int		compress;
+	int		num;		/* Blocks which follow; 0 if none */
+};
+
+struct rehash_worker_struct {
+	ext2_ino_t	*dirs;
+	int		num;
+	int		step;
+};
+
+/*
+ * The body of a worker process, which takes every step'th directory
+ * in the list starting with the first'th one.
+ */
+static int rehash_worker(e2fsck_t ctx, int first, int fd, void *priv_data)
+{
+	struct rehash_worker_struct *rw;
+	struct rehash_result	res;
+	struct out_dir		outdir;
+	int			i;
+
+	rw = (struct rehash_worker_struct *) priv_data;
+	for (i = first; i < rw->num; i += rw->step) {
+		outdir.max = outdir.num = 0;
+		outdir.buf = 0;
+		outdir.hashes = 0;
+		res.ino = rw->dirs[i];
+		res.compress = 0;
+		res.num = 0;
+		if (rebuild_dir(ctx, rw->dirs[i], &outdir, &res.compress,
+				1) == 0)
+			res.num = outdir.num;
+		if (e2fsck_write_all(fd, &res, sizeof(res)) ||
+		    e2fsck_write_all(fd, outdir.buf,
+				     res.num * ctx->fs->blocksize))
+			return 1;
+		free_out_dir(&outdir);
+	}
+	return 0;
+}
+
+/*
+ * Write out the directory which the worker rebuilt.  Returns 0 if the
+ * parent still needs to rebuild it itself.
+ */
+static int finish_worker_dir(e2fsck_t ctx, struct e2fsck_worker *worker,
+			     ext2_ino_t ino, errcode_t *ret)
+{
+	ext2_filsys		fs = ctx->fs;
+	struct rehash_result	res;
+	struct out_dir		outdir;
+
+	if (worker->fd < 0)
+		return 0;
+	outdir.max = outdir.num = 0;
+	outdir.buf = 0;
+	outdir.hashes = 0;
+	if (e2fsck_read_all(worker->fd, &res, sizeof(res)) || res.ino != ino)
+		goto worker_failed;
+	if (!res.num)
+		return 0;
+	if (alloc_size_dir(fs, &outdir, res.num) ||
+	    e2fsck_read_all(worker->fd, outdir.buf,
+			    res.num * fs->blocksize)) {
+		free_out_dir(&outdir);
+		goto worker_failed;
+	}
+	outdir.num = res.num;
+	*ret = write_directory(ctx, fs, &outdir, ino, res.compress);
+	free_out_dir(&outdir);
+	return 1;
+
+worker_failed:
+	/* Do the rest of this worker's directories here */
+	close(worker->fd);
+	worker->fd = -1;
+	return 0;
+}
+
+/*
+ * Number of directories whose blocks we try to have read in ahead of
+ * the one being rebuilt.
+ */
+#define REHASH_READAHEAD	16
+
+struct readahead_dir_struct {
+	io_channel	io;
+	blk_t		first, next;
+};
+
+static int readahead_dir_block(ext2_filsys fs EXT2FS_ATTR((unused)),
+			       blk_t	*block_nr,
+			       e2_blkcnt_t blockcnt EXT2FS_ATTR((unused)),
+			       blk_t ref_block EXT2FS_ATTR((unused)),
+			       int ref_offset EXT2FS_ATTR((unused)),
+			       void *priv_data)
+{
+	struct readahead_dir_struct *rd;
+
+	rd = (struct readahead_dir_struct *) priv_data;
+	if (*block_nr == rd->next) {
+		rd->next++;
+		return 0;
+	}
+	if (rd->first)
+		io_channel_readahead(rd->io, rd->first,
+				     (int) (rd->next - rd->first));
+	rd->first = *block_nr;
+	rd->next = rd->first + 1;
+	return 0;
+}
+
+/*
+ * Start reading in the blocks of a directory which is going to be
+ * rebuilt soon, combining adjacent blocks into a single request.
+ */
+static void readahead_dir(e2fsck_t ctx, ext2_ino_t ino)
+{
+	struct readahead_dir_struct rd;
+
+	rd.io = ctx->fs->io;
+	rd.first = rd.next = 0;
+	if (ext2fs_block_iterate2(ctx->fs, ino, BLOCK_FLAG_DATA_ONLY, 0,
+				  readahead_dir_block, &rd))
+		return;
+	if (rd.first)
+		io_channel_readahead(rd.io, rd.first,
+				     (int) (rd.next - rd.first));
+}
+
 void e2fsck_rehash_directories(e2fsck_t ctx)
 {
 	struct problem_context	pctx;
@@ -763,9 +1057,12 @@ void e2fsck_rehash_directories(e2fsck_t ctx)
 #endif
 	struct dir_info		*dir;
 	ext2_u32_iterate 	iter;
-	ext2_ino_t		ino;
+	ext2_ino_t		ino, *dirs;
 	errcode_t		retval;
 	int			i, cur, max, all_dirs, dir_index, first = 1;
+	int			num, ra, num_workers = 0;
+	struct e2fsck_worker	*workers = 0;
+	struct rehash_worker_struct rw;
 
 #ifdef RESOURCE_TRACK
 	init_resource_track(&rtrack);
@@ -795,7 +1092,17 @@ void e2fsck_rehash_directories(e2fsck_t ctx)
 		}
 		max = ext2fs_u32_list_count(ctx->dirs_to_hash);
 	}
-	while (1) {
+
+	/*
+	 * Make the list of directories to rebuild up front, so that
+	 * the blocks of the next few directories can be read in while
+	 * we're rebuilding the current one.
+	 */
+	dirs = (ext2_ino_t *) e2fsck_allocate_memory(ctx,
+				(max ? max : 1) * sizeof(ext2_ino_t),
+				"directories to rebuild");
+	num = 0;
+	while (num < max) {
 		if (all_dirs) {
 			if ((dir = e2fsck_dir_info_iter(ctx, &i)) == 0)
 				break;
@@ -806,6 +1113,29 @@ void e2fsck_rehash_directories(e2fsck_t ctx)
 		}
 		if (ino == ctx->lost_and_found)
 			continue;
+		dirs[num++] = ino;
+	}
+
+	if (ctx->rehash_workers > 1 && num > 1 &&
+	    !(ctx->options & E2F_OPT_NO)) {
+		num_workers = ctx->rehash_workers;
+		if (num_workers > num)
+			num_workers = num;
+		workers = (struct e2fsck_worker *) e2fsck_allocate_memory(ctx,
+				num_workers * sizeof(struct e2fsck_worker),
+				"rehash workers");
+		rw.dirs = dirs;
+		rw.num = num;
+		rw.step = num_workers;
+		num_workers = e2fsck_start_workers(ctx, workers, num_workers,
+						   rehash_worker, &rw);
+	}
+
+	for (cur = 0, ra = 0; cur < num; cur++) {
+		while (!num_workers && ra < num &&
+		       ra <= cur + REHASH_READAHEAD)
+			readahead_dir(ctx, dirs[ra++]);
+		ino = dirs[cur];
 		pctx.dir = ino;
 		if (first) {
 			fix_problem(ctx, PR_3A_PASS_HEADER, &pctx);
@@ -814,16 +1144,24 @@ void e2fsck_rehash_directories(e2fsck_t ctx)
 #if 0
 		fix_problem(ctx, PR_3A_OPTIMIZE_DIR, &pctx);
 #endif
-		pctx.errcode = e2fsck_rehash_dir(ctx, ino);
+		pctx.errcode = 0;
+		if (!num_workers ||
+		    !finish_worker_dir(ctx, &workers[cur % num_workers], ino,
+				       &pctx.errcode))
+			pctx.errcode = e2fsck_rehash_dir(ctx, ino);
 		if (pctx.errcode) {
 			end_problem_latch(ctx, PR_LATCH_OPTIMIZE_DIR);
 			fix_problem(ctx, PR_3A_OPTIMIZE_DIR_ERR, &pctx);
 		}
 		if (ctx->progress && !ctx->progress_fd)
 			e2fsck_simple_progress(ctx, "Rebuilding directory",
-			       100.0 * (float) (++cur) / (float) max, ino);
+			       100.0 * (float) (cur + 1) / (float) max, ino);
 	}
 	end_problem_latch(ctx, PR_LATCH_OPTIMIZE_DIR);
+	e2fsck_stop_workers(workers, num_workers);
+	if (workers)
+		ext2fs_free_mem(&workers);
+	ext2fs_free_mem(&dirs);
 	if (!all_dirs)
 		ext2fs_u32_list_iterate_end(iter);
 	
@@ -78,6 +78,7 @@ static kmem_cache_t *revoke_table_cache;
    journal replay, this involves recording the transaction ID of the
    last transaction to revoke this block. */
 
+#ifdef __KERNEL__
 struct jbd_revoke_record_s 
 {
 	struct list_head  hash;
@@ -95,6 +96,31 @@ struct jbd_revoke_table_s
 	int		  hash_shift; 
 	struct list_head *hash_table;
 };
+#else
+/*
+ * Outside the kernel the revoke table is only used for recovery,
+ * where a busy journal can hold hundreds of thousands of revoke
+ * records.  So the records are kept directly in an open-addressed
+ * hash table, which is doubled in size whenever it gets three
+ * quarters full.
+ */
+struct jbd_revoke_record_s 
+{
+	unsigned long	  blocknr;	
+	tid_t		  sequence;
+	int		  in_use;
+};
+
+struct jbd_revoke_table_s
+{
+	int		  hash_size;	/* Must be a power of two */
+	int		  hash_shift; 
+	int		  count;
+	struct jbd_revoke_record_s *hash_table;
+};
+
+#define REVOKE_HASH_MIN	16
+#endif
 
 
 #ifdef __KERNEL__
@@ -106,6 +132,7 @@ static void flush_descriptor(journal_t *, struct journal_head *, int);
 
 /* Utility functions to maintain the revoke table */
 
+#ifdef __KERNEL__
 /* Borrowed from buffer.c: this is a tried and tested block hash function */
 static inline int hash(journal_t *journal, unsigned long block)
 {
@@ -167,6 +194,87 @@ static struct jbd_revoke_record_s *find_revoke_record(journal_t *journal,
 	}
 	return NULL;
 }
+#else
+/* Multiplicative hash, so that runs of block numbers spread out */
+static inline int hash(journal_t *journal, unsigned long block)
+{
+	return ((__u32) block * 0x9E3779B1U) >>
+		(32 - journal->j_revoke->hash_shift);
+}
+
+/* Return blocknr's record, or the empty slot where it belongs. */
+static struct jbd_revoke_record_s *revoke_slot(journal_t *journal,
+					       unsigned long blocknr)
+{
+	struct jbd_revoke_table_s *table = journal->j_revoke;
+	struct jbd_revoke_record_s *record;
+	int i;
+
+	i = hash(journal, blocknr);
+	while (1) {
+		record = &table->hash_table[i];
+		if (!record->in_use || record->blocknr == blocknr)
+			return record;
+		i = (i + 1) & (table->hash_size - 1);
+	}
+}
+
+static int resize_revoke_table(journal_t *journal, int hash_size)
+{
+	struct jbd_revoke_table_s *table = journal->j_revoke;
+	struct jbd_revoke_record_s *old_table, *record;
+	int old_size, i;
+
+	record = kmalloc(hash_size * sizeof(struct jbd_revoke_record_s),
+			 GFP_KERNEL);
+	if (!record)
+		return -ENOMEM;
+	memset(record, 0, hash_size * sizeof(struct jbd_revoke_record_s));
+
+	old_table = table->hash_table;
+	old_size = table->hash_size;
+	table->hash_table = record;
+	table->hash_size = hash_size;
+	for (table->hash_shift = 0; hash_size > 1; hash_size >>= 1)
+		table->hash_shift++;
+
+	for (i = 0; i < old_size; i++) {
+		if (!old_table[i].in_use)
+			continue;
+		record = revoke_slot(journal, old_table[i].blocknr);
+		*record = old_table[i];
+	}
+	kfree(old_table);
+	return 0;
+}
+
+static int insert_revoke_hash(journal_t *journal, unsigned long blocknr,
+			      tid_t seq)
+{
+	struct jbd_revoke_table_s *table = journal->j_revoke;
+	struct jbd_revoke_record_s *record;
+
+	if ((table->count + 1) * 4 > table->hash_size * 3 &&
+	    resize_revoke_table(journal, table->hash_size * 2))
+		return -ENOMEM;
+
+	record = revoke_slot(journal, blocknr);
+	record->blocknr = blocknr;
+	record->sequence = seq;
+	record->in_use = 1;
+	table->count++;
+	return 0;
+}
+
+static struct jbd_revoke_record_s *find_revoke_record(journal_t *journal,
+						      unsigned long blocknr)
+{
+	struct jbd_revoke_record_s *record;
+
+	record = revoke_slot(journal, blocknr);
+	return record->in_use ? record : NULL;
+}
+#endif
 
 int __init journal_init_revoke_caches(void)
 {
@@ -197,6 +305,7 @@ void journal_destroy_revoke_caches(void)
 
 /* Initialise the revoke table for a given journal to a given size. */
 
+#ifdef __KERNEL__
 int journal_init_revoke(journal_t *journal, int hash_size)
 {
 	int shift, tmp;
@@ -253,6 +362,50 @@ void journal_destroy_revoke(journal_t *journal)
 	kmem_cache_free(revoke_table_cache, table);
 	journal->j_revoke = NULL;
 }
+#else
+/*
+ * The table starts out at hash_size slots and grows as revoke records
+ * are added to it.
+ */
+int journal_init_revoke(journal_t *journal, int hash_size)
+{
+	J_ASSERT (journal->j_revoke == NULL);
+
+	journal->j_revoke = kmem_cache_alloc(revoke_table_cache, GFP_KERNEL);
+	if (!journal->j_revoke)
+		return -ENOMEM;
+	memset(journal->j_revoke, 0, sizeof(struct jbd_revoke_table_s));
+
+	/* Check that the hash_size is a power of two */
+	J_ASSERT ((hash_size & (hash_size-1)) == 0);
+	if (hash_size < REVOKE_HASH_MIN)
+		hash_size = REVOKE_HASH_MIN;
+
+	if (resize_revoke_table(journal, hash_size)) {
+		kmem_cache_free(revoke_table_cache, journal->j_revoke);
+		journal->j_revoke = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/* Destoy a journal's revoke table.  The table must already be empty! */
+
+void journal_destroy_revoke(journal_t *journal)
+{
+	struct jbd_revoke_table_s *table;
+
+	table = journal->j_revoke;
+	if (!table)
+		return;
+
+	J_ASSERT (table->count == 0);
+
+	kfree(table->hash_table);
+	kmem_cache_free(revoke_table_cache, table);
+	journal->j_revoke = NULL;
+}
+#endif
 
 
 #ifdef __KERNEL__
@@ -619,6 +772,7 @@ int journal_test_revoke(journal_t *journal,
  * that it can be reused by the running filesystem.
  */
 
+#ifdef __KERNEL__
 void journal_clear_revoke(journal_t *journal)
 {
 	int i;
@@ -637,4 +791,14 @@ void journal_clear_revoke(journal_t *journal)
 		}
 	}
 }
+#else
+void journal_clear_revoke(journal_t *journal)
+{
+	struct jbd_revoke_table_s *revoke;
 
+	revoke = journal->j_revoke;
+	memset(revoke->hash_table, 0,
+	       revoke->hash_size * sizeof(struct jbd_revoke_record_s));
+	revoke->count = 0;
+}
+#endif
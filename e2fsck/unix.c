@@ -514,7 +514,7 @@ static void signal_cancel(int sig EXT2FS_ATTR((unused)))
 static void parse_extended_opts(e2fsck_t ctx, const char *opts)
 {
 	char	*buf, *token, *next, *p, *arg;
-	int	ea_ver;
+	int	ea_ver, workers;
 	int	extended_usage = 0;
 
 	buf = string_copy(ctx, opts, 0);
@@ -544,6 +544,45 @@ static void parse_extended_opts(e2fsck_t ctx, const char *opts)
 				continue;
 			}
 			ctx->ext_attr_ver = ea_ver;
+		} else if (strcmp(token, "rehash_workers") == 0) {
+			if (!arg) {
+				extended_usage++;
+				continue;
+			}
+			workers = strtoul(arg, &p, 0);
+			if (*p || workers < 1 || workers > MAX_REHASH_WORKERS) {
+				fprintf(stderr,
+					_("Invalid number of rehash workers.\n"));
+				extended_usage++;
+				continue;
+			}
+			ctx->rehash_workers = workers;
+		} else if (strcmp(token, "pass1_workers") == 0) {
+			if (!arg) {
+				extended_usage++;
+				continue;
+			}
+			workers = strtoul(arg, &p, 0);
+			if (*p || workers < 1 || workers > MAX_PASS1_WORKERS) {
+				fprintf(stderr,
+					_("Invalid number of pass 1 workers.\n"));
+				extended_usage++;
+				continue;
+			}
+			ctx->pass1_workers = workers;
+		} else if (strcmp(token, "pass2_workers") == 0) {
+			if (!arg) {
+				extended_usage++;
+				continue;
+			}
+			workers = strtoul(arg, &p, 0);
+			if (*p || workers < 1 || workers > MAX_PASS2_WORKERS) {
+				fprintf(stderr,
+					_("Invalid number of pass 2 workers.\n"));
+				extended_usage++;
+				continue;
+			}
+			ctx->pass2_workers = workers;
 		} else {
 			fprintf(stderr, _("Unknown extended option: %s\n"),
 				token);
@@ -555,7 +594,11 @@ static void parse_extended_opts(e2fsck_t ctx, const char *opts)
 		       "and may take an argument which\n"
 		       "is set off by an equals ('=') sign.  "
 			"Valid extended options are:\n"
-		       "\tea_ver=<ea_version (1 or 2)>\n\n"), stderr);
+		       "\tea_ver=<ea_version (1 or 2)>\n"
+		       "\trehash_workers=<number of processes (1-64)>\n"
+		       "\tpass1_workers=<number of processes (1-64)>\n"
+		       "\tpass2_workers=<number of processes (1-64)>\n\n"),
+		      stderr);
 		exit(1);
 	}
 }	
@@ -832,6 +875,27 @@ static errcode_t PRS(int argc, char *argv[], e2fsck_t *ret_ctx)
 	return 0;
 }
 
+/*
+ * If the [scratch_files] stanza of e2fsck.conf names a directory, keep
+ * e2fsck's large tables in files there, so that checking a large
+ * filesystem doesn't need to fit them all in memory.
+ */
+static void setup_scratch_dir(e2fsck_t ctx)
+{
+	char		*dir = 0;
+	errcode_t	retval;
+
+	profile_get_string(ctx->profile, "scratch_files", "directory", 0, 0,
+			   &dir);
+	if (!dir)
+		return;
+	retval = ext2fs_set_scratch_dir(ctx->fs, dir);
+	if (retval)
+		com_err(ctx->program_name, retval,
+			_("while setting up scratch directory %s"), dir);
+	free(dir);
+}
+
 static const char *my_ver_string = E2FSPROGS_VERSION;
 static const char *my_ver_date = E2FSPROGS_DATE;
 					
@@ -980,6 +1044,7 @@ restart:
 	ctx->fs = fs;
 	fs->priv_data = ctx;
 	fs->now = ctx->now;
+	setup_scratch_dir(ctx);
 	sb = fs->super;
 	if (sb->s_rev_level > E2FSCK_CURRENT_REV) {
 		com_err(ctx->program_name, EXT2_ET_REV_TOO_HIGH,
@@ -28,6 +28,11 @@
 #ifdef HAVE_MALLOC_H
 #include <malloc.h>
 #endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include "e2fsck.h"
 
@@ -40,6 +45,9 @@ void fatal_error(e2fsck_t ctx, const char *msg)
 {
 	if (msg) 
 		fprintf (stderr, "e2fsck: %s\n", msg);
+	/* A worker just goes away; the parent will do its work */
+	if (ctx->flags & E2F_FLAG_WORKER)
+		_exit(FSCK_ERROR);
 	if (ctx->fs && ctx->fs->io) {
 		if (ctx->fs->io->magic == EXT2_ET_MAGIC_IO_CHANNEL)
 			io_channel_flush(ctx->fs->io);
@@ -70,6 +78,27 @@ void *e2fsck_allocate_memory(e2fsck_t ctx, unsigned int size,
 	return ret;
 }
 
+/*
+ * Allocate a large table which may be put in the scratch directory;
+ * it must be freed with ext2fs_free_scratch_mem().
+ */
+void *e2fsck_allocate_scratch_memory(e2fsck_t ctx, unsigned int size,
+				     const char *description)
+{
+	void *ret;
+	char buf[256];
+
+#ifdef DEBUG_ALLOCATE_MEMORY
+	printf("Allocating %d scratch bytes for %s...\n", size, description);
+#endif
+	if (ext2fs_get_scratch_mem(ctx->fs, size, &ret)) {
+		sprintf(buf, "Can't allocate %s\n", description);
+		fatal_error(ctx, buf);
+	}
+	memset(ret, 0, size);
+	return ret;
+}
+
 char *string_copy(e2fsck_t ctx EXT2FS_ATTR((unused)), 
 		  const char *str, int len)
 {
@@ -499,3 +528,132 @@ int ext2_file_type(unsigned int mode)
 	
 	return 0;
 }
+
+int e2fsck_read_all(int fd, void *buf, size_t count)
+{
+	char	*cp = buf;
+	ssize_t	got;
+
+	while (count) {
+		got = read(fd, cp, count);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return -1;
+		cp += got;
+		count -= got;
+	}
+	return 0;
+}
+
+int e2fsck_write_all(int fd, const void *buf, size_t count)
+{
+	const char	*cp = buf;
+	ssize_t		got;
+
+	while (count) {
+		got = write(fd, cp, count);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return -1;
+		cp += got;
+		count -= got;
+	}
+	return 0;
+}
+
+/*
+ * Start num_workers child processes, each of which runs func() and
+ * sends its results back to the parent through a pipe.  A worker
+ * reads the filesystem through an I/O channel of its own, since it
+ * must neither share the parent's file offset nor ever write
+ * anything back, and it never asks the user anything: fix_problem()
+ * just sets E2F_FLAG_WORKER_PUNT, so that the parent knows to redo
+ * that piece of work itself.
+ *
+ * Returns the number of workers started, which is 0 (with all of
+ * them reaped again) unless every one of them could be started.
+ */
+int e2fsck_start_workers(e2fsck_t ctx, struct e2fsck_worker *workers,
+			 int num_workers,
+			 int (*func)(e2fsck_t ctx, int worker, int fd,
+				     void *priv_data),
+			 void *priv_data)
+{
+	ext2_filsys	fs = ctx->fs;
+	io_channel	io;
+	int		i, j, fds[2];
+	errcode_t	retval;
+	errcode_t (*write_error)(io_channel, unsigned long, int, const void *,
+				 size_t, int, errcode_t);
+
+	/*
+	 * The workers read the disk directly, so it must be up to date.
+	 * If it can't be (say, with a read-only device), the parent does
+	 * all the work, and reports the write error when it would have
+	 * anyway.
+	 */
+	write_error = fs->io->write_error;
+	fs->io->write_error = 0;
+	retval = io_channel_flush(fs->io);
+	fs->io->write_error = write_error;
+	if (retval)
+		return 0;
+	fflush(stdout);
+	fflush(stderr);
+
+	for (i = 0; i < num_workers; i++) {
+		if (pipe(fds) < 0)
+			break;
+		workers[i].pid = fork();
+		if (workers[i].pid < 0) {
+			close(fds[0]);
+			close(fds[1]);
+			break;
+		}
+		if (workers[i].pid == 0) {
+			for (j = 0; j < i; j++)
+				close(workers[j].fd);
+			close(fds[0]);
+			ctx->flags |= E2F_FLAG_WORKER;
+			ctx->flags &= ~E2F_FLAG_SETJMP_OK;
+			ctx->progress = 0;
+			if (fs->io->manager->open(fs->device_name, 0, &io))
+				_exit(FSCK_ERROR);
+			if (ctx->io_options &&
+			    io_channel_set_options(io, ctx->io_options))
+				_exit(FSCK_ERROR);
+			if (io_channel_set_blksize(io, fs->blocksize))
+				_exit(FSCK_ERROR);
+			fs->io = io;
+			_exit((func)(ctx, i, fds[1], priv_data));
+		}
+		close(fds[1]);
+		workers[i].fd = fds[0];
+	}
+	if (i == num_workers)
+		return i;
+
+	/* Couldn't start them all; the rest would leave holes */
+	e2fsck_stop_workers(workers, i);
+	return 0;
+}
+
+/*
+ * Close the pipes from the workers and wait for them to exit.  A
+ * worker which is still running gets SIGPIPE the next time it tries
+ * to send something.
+ */
+void e2fsck_stop_workers(struct e2fsck_worker *workers, int num_workers)
+{
+	int	i;
+
+	for (i = 0; i < num_workers; i++) {
+		if (workers[i].fd >= 0)
+			close(workers[i].fd);
+		workers[i].fd = -1;
+	}
+	for (i = 0; i < num_workers; i++)
+		waitpid(workers[i].pid, 0, 0);
+}
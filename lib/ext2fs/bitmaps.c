@@ -27,14 +27,20 @@
 #include "ext2_fs.h"
 #include "ext2fs.h"
 
+#define LAZY_GROUPS_SIZE(bmap)	(((bmap)->fs->group_desc_count + 7) / 8)
+
 static errcode_t make_bitmap(__u32 start, __u32 end, __u32 real_end,
-			     const char *descr, char *init_map,
+			     int type, const char *descr,
+			     ext2fs_generic_bitmap src,
 			     ext2fs_generic_bitmap *ret)
 {
 	ext2fs_generic_bitmap	bitmap;
 	errcode_t		retval;
 	size_t			size;
 
+	if ((type != EXT2FS_BMAP_BITARRAY) && (type != EXT2FS_BMAP_EXTENT))
+		return EXT2_ET_INVALID_ARGUMENT;
+
 	retval = ext2fs_get_mem(sizeof(struct ext2fs_struct_generic_bitmap), 
 				&bitmap);
 	if (retval)
@@ -46,6 +52,10 @@ static errcode_t make_bitmap(__u32 start, __u32 end, __u32 real_end,
 	bitmap->end = end;
 	bitmap->real_end = real_end;
 	bitmap->base_error_code = EXT2_ET_BAD_GENERIC_MARK;
+	bitmap->type = type;
+	bitmap->bitmap = 0;
+	bitmap->extents = 0;
+	bitmap->lazy_groups = 0;
 	if (descr) {
 		retval = ext2fs_get_mem(strlen(descr)+1, &bitmap->description);
 		if (retval) {
@@ -56,6 +66,21 @@ static errcode_t make_bitmap(__u32 start, __u32 end, __u32 real_end,
 	} else
 		bitmap->description = 0;
 
+	if (type == EXT2FS_BMAP_EXTENT) {
+		if (src)
+			retval = ext2fs_extent_bitmap_copy(src, bitmap);
+		else
+			retval = ext2fs_extent_bitmap_new(bitmap);
+		if (retval) {
+			if (bitmap->description)
+				ext2fs_free_mem(&bitmap->description);
+			ext2fs_free_mem(&bitmap);
+			return retval;
+		}
+		*ret = bitmap;
+		return 0;
+	}
+
 	size = (size_t) (((bitmap->real_end - bitmap->start) / 8) + 1);
 	//bitmap->bitmapbitmap
 	retval = ext2fs_get_mem(size, &bitmap->bitmap);
@@ -66,8 +91,24 @@ static errcode_t make_bitmap(__u32 start, __u32 end, __u32 real_end,
 	}
 
 	//init_mapNULL,bitmap->bitmapʹmap,bitmap->bitmap
-	if (init_map)
-		memcpy(bitmap->bitmap, init_map, size);
+	if (src && src->lazy_groups) {
+		/*
+		 * Groups which haven't been read in yet can be read in
+		 * for the copy later, just as for the original.
+		 */
+		retval = ext2fs_get_mem(LAZY_GROUPS_SIZE(src),
+					&bitmap->lazy_groups);
+		if (retval) {
+			ext2fs_free_mem(&bitmap->bitmap);
+			ext2fs_free_mem(&bitmap->description);
+			ext2fs_free_mem(&bitmap);
+			return retval;
+		}
+		memcpy(bitmap->lazy_groups, src->lazy_groups,
+		       LAZY_GROUPS_SIZE(src));
+	}
+	if (src)
+		memcpy(bitmap->bitmap, src->bitmap, size);
 	else
 		memset(bitmap->bitmap, 0, size);
 	*ret = bitmap;
@@ -80,7 +121,8 @@ errcode_t ext2fs_allocate_generic_bitmap(__u32 start,
 					 const char *descr,
 					 ext2fs_generic_bitmap *ret)
 {
-	return make_bitmap(start, end, real_end, descr, 0, ret);
+	return make_bitmap(start, end, real_end, EXT2FS_BMAP_BITARRAY,
+			   descr, 0, ret);
 }
 
 errcode_t ext2fs_copy_bitmap(ext2fs_generic_bitmap src,
@@ -89,8 +131,8 @@ errcode_t ext2fs_copy_bitmap(ext2fs_generic_bitmap src,
 	errcode_t		retval;
 	ext2fs_generic_bitmap	new_map;
 
-	retval = make_bitmap(src->start, src->end, src->real_end,
-			     src->description, src->bitmap, &new_map);
+	retval = make_bitmap(src->start, src->end, src->real_end, src->type,
+			     src->description, src, &new_map);
 	if (retval)
 		return retval;
 	new_map->magic = src->magic;
@@ -104,15 +146,23 @@ void ext2fs_set_bitmap_padding(ext2fs_generic_bitmap map)
 {
 	__u32	i, j;
 
+	if (map->type == EXT2FS_BMAP_EXTENT) {
+		if (map->real_end > map->end)
+			ext2fs_extent_bitmap_mark_range(map, map->end+1,
+							map->real_end - map->end);
+		return;
+	}
+	if (map->real_end > map->end)
+		EXT2FS_LAZY_LOAD(map, map->end+1, map->real_end - map->end);
 	for (i=map->end+1, j = i - map->start; i <= map->real_end; i++, j++)
 		ext2fs_set_bit(j, map->bitmap);
 
 	return;
 }	
 
-errcode_t ext2fs_allocate_inode_bitmap(ext2_filsys fs,
-				       const char *descr,
-				       ext2fs_inode_bitmap *ret)
+errcode_t ext2fs_allocate_inode_bitmap_type(ext2_filsys fs, int type,
+					    const char *descr,
+					    ext2fs_inode_bitmap *ret)
 {
 	ext2fs_inode_bitmap bitmap;
 	errcode_t	retval;
@@ -128,8 +178,7 @@ errcode_t ext2fs_allocate_inode_bitmap(ext2_filsys fs,
 	//һgroupһinode
 	real_end = (EXT2_INODES_PER_GROUP(fs->super) * fs->group_desc_count);
 
-	retval = ext2fs_allocate_generic_bitmap(start, end, real_end,
-						descr, &bitmap);
+	retval = make_bitmap(start, end, real_end, type, descr, 0, &bitmap);
 	if (retval)
 		return retval;
 	
@@ -141,9 +190,17 @@ errcode_t ext2fs_allocate_inode_bitmap(ext2_filsys fs,
 	return 0;
 }
 
-errcode_t ext2fs_allocate_block_bitmap(ext2_filsys fs,
+errcode_t ext2fs_allocate_inode_bitmap(ext2_filsys fs,
 				       const char *descr,
-				       ext2fs_block_bitmap *ret)
+				       ext2fs_inode_bitmap *ret)
+{
+	return ext2fs_allocate_inode_bitmap_type(fs, EXT2FS_BMAP_BITARRAY,
+						 descr, ret);
+}
+
+errcode_t ext2fs_allocate_block_bitmap_type(ext2_filsys fs, int type,
+					    const char *descr,
+					    ext2fs_block_bitmap *ret)
 {
 	ext2fs_block_bitmap bitmap;
 	errcode_t	retval;
@@ -159,8 +216,7 @@ errcode_t ext2fs_allocate_block_bitmap(ext2_filsys fs,
 	real_end = (EXT2_BLOCKS_PER_GROUP(fs->super)  
 		    * fs->group_desc_count)-1 + start;
 	
-	retval = ext2fs_allocate_generic_bitmap(start, end, real_end,
-						descr, &bitmap);
+	retval = make_bitmap(start, end, real_end, type, descr, 0, &bitmap);
 	if (retval)
 		return retval;
 
@@ -172,6 +228,14 @@ errcode_t ext2fs_allocate_block_bitmap(ext2_filsys fs,
 	return 0;
 }
 
+errcode_t ext2fs_allocate_block_bitmap(ext2_filsys fs,
+				       const char *descr,
+				       ext2fs_block_bitmap *ret)
+{
+	return ext2fs_allocate_block_bitmap_type(fs, EXT2FS_BMAP_BITARRAY,
+						 descr, ret);
+}
+
 errcode_t ext2fs_fudge_inode_bitmap_end(ext2fs_inode_bitmap bitmap,
 					ext2_ino_t end, ext2_ino_t *oend)
 {
@@ -203,8 +267,14 @@ void ext2fs_clear_inode_bitmap(ext2fs_inode_bitmap bitmap)
 	if (!bitmap || (bitmap->magic != EXT2_ET_MAGIC_INODE_BITMAP))
 		return;
 
+	if (bitmap->type == EXT2FS_BMAP_EXTENT) {
+		ext2fs_extent_bitmap_clear(bitmap);
+		return;
+	}
 	memset(bitmap->bitmap, 0,
 	       (size_t) (((bitmap->real_end - bitmap->start) / 8) + 1));
+	if (bitmap->lazy_groups)
+		ext2fs_free_mem(&bitmap->lazy_groups);
 }
 
 void ext2fs_clear_block_bitmap(ext2fs_block_bitmap bitmap)
@@ -212,6 +282,12 @@ void ext2fs_clear_block_bitmap(ext2fs_block_bitmap bitmap)
 	if (!bitmap || (bitmap->magic != EXT2_ET_MAGIC_BLOCK_BITMAP))
 		return;
 
+	if (bitmap->type == EXT2FS_BMAP_EXTENT) {
+		ext2fs_extent_bitmap_clear(bitmap);
+		return;
+	}
 	memset(bitmap->bitmap, 0,
 	       (size_t) (((bitmap->real_end - bitmap->start) / 8) + 1));
+	if (bitmap->lazy_groups)
+		ext2fs_free_mem(&bitmap->lazy_groups);
 }
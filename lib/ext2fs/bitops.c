@@ -11,6 +11,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #if HAVE_SYS_TYPES_H
 #include <sys/types.h>
 #endif
@@ -89,3 +90,222 @@ void ext2fs_warn_bitmap2(ext2fs_generic_bitmap bitmap,
 #endif
 }
 
+
+/*
+ * Bit range operations.  Since bit nr always lives in byte (nr >> 3),
+ * the interior of a range can be scanned a long at a time whatever
+ * the byte order; only the bytes at the ends need to be masked, and
+ * only a word that is known to be interesting is searched byte by
+ * byte.
+ */
+
+#define BITS_PER_LONG	(8 * sizeof(unsigned long))
+
+#define LONG_ALIGNED(p)	((((unsigned long) (p)) & (sizeof(long) - 1)) == 0)
+
+#if defined(__GNUC__) && \
+    ((__GNUC__ > 3) || ((__GNUC__ == 3) && (__GNUC_MINOR__ >= 4)))
+#define popcount_long(w)	__builtin_popcountl(w)
+#else
+static int popcount_long(unsigned long w)
+{
+	int	count = 0;
+
+	for (; w; count++)
+		w &= w - 1;
+	return count;
+}
+#endif
+
+static int popcount_byte(unsigned char c)
+{
+	return popcount_long((unsigned long) c);
+}
+
+/*
+ * Mask of the bits in the byte holding bit start which are at or
+ * above start and below end (end is exclusive, and may be in a later
+ * byte).
+ */
+static unsigned char byte_mask(unsigned int start, unsigned int end)
+{
+	unsigned char	mask = 0xff << (start & 7);
+
+	if ((end >> 3) == (start >> 3))
+		mask &= 0xff >> (8 - (end & 7));
+	return mask;
+}
+
+void ext2fs_set_bit_range(unsigned int nr, unsigned int len, void *addr)
+{
+	unsigned char	*ADDR = (unsigned char *) addr;
+	unsigned int	end = nr + len;
+
+	if (!len)
+		return;
+	if (nr & 7) {
+		ADDR[nr >> 3] |= byte_mask(nr, end);
+		nr = (nr | 7) + 1;
+		if (nr >= end)
+			return;
+	}
+	memset(ADDR + (nr >> 3), 0xff, (end - nr) >> 3);
+	if (end & 7)
+		ADDR[end >> 3] |= 0xff >> (8 - (end & 7));
+}
+
+void ext2fs_clear_bit_range(unsigned int nr, unsigned int len, void *addr)
+{
+	unsigned char	*ADDR = (unsigned char *) addr;
+	unsigned int	end = nr + len;
+
+	if (!len)
+		return;
+	if (nr & 7) {
+		ADDR[nr >> 3] &= ~byte_mask(nr, end);
+		nr = (nr | 7) + 1;
+		if (nr >= end)
+			return;
+	}
+	memset(ADDR + (nr >> 3), 0, (end - nr) >> 3);
+	if (end & 7)
+		ADDR[end >> 3] &= ~(0xff >> (8 - (end & 7)));
+}
+
+/*
+ * Return the number of bits set in the len bits starting at nr.
+ */
+unsigned int ext2fs_count_bit_range(unsigned int nr, unsigned int len,
+				    const void *addr)
+{
+	const unsigned char	*ADDR = (const unsigned char *) addr;
+	const unsigned long	*WADDR;
+	unsigned int		end = nr + len, count = 0;
+
+	if (!len)
+		return 0;
+	if (nr & 7) {
+		count = popcount_byte(ADDR[nr >> 3] & byte_mask(nr, end));
+		nr = (nr | 7) + 1;
+		if (nr >= end)
+			return count;
+	}
+	ADDR += nr >> 3;
+	while ((end - nr >= 8) && !LONG_ALIGNED(ADDR)) {
+		count += popcount_byte(*ADDR++);
+		nr += 8;
+	}
+	for (WADDR = (const unsigned long *) ADDR;
+	     end - nr >= BITS_PER_LONG; nr += BITS_PER_LONG)
+		count += popcount_long(*WADDR++);
+	for (ADDR = (const unsigned char *) WADDR; end - nr >= 8; nr += 8)
+		count += popcount_byte(*ADDR++);
+	if (nr < end)
+		count += popcount_byte(*ADDR & byte_mask(nr, end));
+	return count;
+}
+
+#define FIND_ONE	0
+#define FIND_ZERO	1
+#define FIND_DIFF	2
+
+static unsigned long fetch_long(const unsigned char *a,
+			       const unsigned char *b, int how,
+			       unsigned int pos)
+{
+	unsigned long	w = *((const unsigned long *) (a + pos));
+
+	if (how == FIND_ZERO)
+		return ~w;
+	if (how == FIND_DIFF)
+		return w ^ *((const unsigned long *) (b + pos));
+	return w;
+}
+
+static unsigned char fetch_byte(const unsigned char *a,
+				const unsigned char *b, int how,
+				unsigned int pos)
+{
+	if (how == FIND_ZERO)
+		return ~a[pos];
+	if (how == FIND_DIFF)
+		return a[pos] ^ b[pos];
+	return a[pos];
+}
+
+static unsigned int first_bit(unsigned int pos, unsigned char c,
+			      unsigned int size)
+{
+	unsigned int	bit;
+
+	for (bit = 0; !(c & (1 << bit)); bit++)
+		;
+	bit += pos << 3;
+	return (bit < size) ? bit : size;
+}
+
+/*
+ * Common code for the ext2fs_find_next_*_bit functions: return the
+ * first bit at or after offset, and before size, which is set in a
+ * (FIND_ONE), clear in a (FIND_ZERO), or different between a and b
+ * (FIND_DIFF).  Returns size if there is no such bit.
+ */
+static unsigned int find_next_bit(const unsigned char *a,
+				  const unsigned char *b, int how,
+				  unsigned int size, unsigned int offset)
+{
+	unsigned int	pos, nbytes = (size >> 3) + ((size & 7) != 0);
+	unsigned char	c;
+
+	if (offset >= size)
+		return size;
+
+	pos = offset >> 3;
+	c = fetch_byte(a, b, how, pos) & (0xff << (offset & 7));
+	if (c)
+		return first_bit(pos, c, size);
+	pos++;
+
+	while (pos < nbytes && !LONG_ALIGNED(a + pos)) {
+		c = fetch_byte(a, b, how, pos);
+		if (c)
+			return first_bit(pos, c, size);
+		pos++;
+	}
+	/*
+	 * Skip over the uninteresting words; the byte loop below
+	 * finds the bit in the word which stopped us, if any.
+	 */
+	if (how != FIND_DIFF || LONG_ALIGNED(b + pos))
+		while ((nbytes - pos >= sizeof(long)) &&
+		       !fetch_long(a, b, how, pos))
+			pos += sizeof(long);
+	for (; pos < nbytes; pos++) {
+		c = fetch_byte(a, b, how, pos);
+		if (c)
+			return first_bit(pos, c, size);
+	}
+	return size;
+}
+
+unsigned int ext2fs_find_next_one_bit(const void *addr, unsigned int size,
+				      unsigned int offset)
+{
+	return find_next_bit(addr, 0, FIND_ONE, size, offset);
+}
+
+unsigned int ext2fs_find_next_zero_bit(const void *addr, unsigned int size,
+				       unsigned int offset)
+{
+	return find_next_bit(addr, 0, FIND_ZERO, size, offset);
+}
+
+/*
+ * Return the first bit at or after offset where the bit arrays a and
+ * b differ, or size if they are the same up to size.
+ */
+unsigned int ext2fs_find_next_diff_bit(const void *a, const void *b,
+				       unsigned int size, unsigned int offset)
+{
+	return find_next_bit(a, b, FIND_DIFF, size, offset);
+}
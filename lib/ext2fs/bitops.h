@@ -19,6 +19,21 @@ extern int ext2fs_clear_bit(unsigned int nr, void * addr);
 extern int ext2fs_test_bit(unsigned int nr, const void * addr);
 extern void ext2fs_fast_set_bit(unsigned int nr,void * addr);
 extern void ext2fs_fast_clear_bit(unsigned int nr, void * addr);
+extern void ext2fs_set_bit_range(unsigned int nr, unsigned int len,
+				 void *addr);
+extern void ext2fs_clear_bit_range(unsigned int nr, unsigned int len,
+				   void *addr);
+extern unsigned int ext2fs_count_bit_range(unsigned int nr, unsigned int len,
+					   const void *addr);
+extern unsigned int ext2fs_find_next_one_bit(const void *addr,
+					     unsigned int size,
+					     unsigned int offset);
+extern unsigned int ext2fs_find_next_zero_bit(const void *addr,
+					      unsigned int size,
+					      unsigned int offset);
+extern unsigned int ext2fs_find_next_diff_bit(const void *a, const void *b,
+					      unsigned int size,
+					      unsigned int offset);
 extern __u16 ext2fs_swab16(__u16 val);
 extern __u32 ext2fs_swab32(__u32 val);
 
@@ -104,6 +119,51 @@ extern int ext2fs_mark_generic_bitmap(ext2fs_generic_bitmap bitmap,
 					 __u32 bitno);
 extern int ext2fs_unmark_generic_bitmap(ext2fs_generic_bitmap bitmap,
 					   blk_t bitno);
+
+/* Range searches and counts, in gen_bitmap.c */
+extern errcode_t ext2fs_find_first_set_generic_bitmap(ext2fs_generic_bitmap bitmap,
+						      __u32 start, __u32 end,
+						      __u32 *out);
+extern errcode_t ext2fs_find_first_zero_generic_bitmap(ext2fs_generic_bitmap bitmap,
+						       __u32 start, __u32 end,
+						       __u32 *out);
+extern errcode_t ext2fs_find_first_diff_generic_bitmap(ext2fs_generic_bitmap bm1,
+						       ext2fs_generic_bitmap bm2,
+						       __u32 start, __u32 end,
+						       __u32 *out);
+extern __u32 ext2fs_count_generic_bitmap_range(ext2fs_generic_bitmap bitmap,
+					       __u32 start, __u32 end);
+
+/* Operations on extent-based bitmaps, in extent_bitmap.c */
+extern int ext2fs_extent_bitmap_mark(ext2fs_generic_bitmap bitmap,
+				     __u32 bitno);
+extern int ext2fs_extent_bitmap_unmark(ext2fs_generic_bitmap bitmap,
+				       __u32 bitno);
+extern int ext2fs_extent_bitmap_test(ext2fs_generic_bitmap bitmap,
+				     __u32 bitno);
+extern void ext2fs_extent_bitmap_mark_range(ext2fs_generic_bitmap bitmap,
+					    __u32 bitno, __u32 num);
+extern void ext2fs_extent_bitmap_unmark_range(ext2fs_generic_bitmap bitmap,
+					      __u32 bitno, __u32 num);
+extern int ext2fs_extent_bitmap_test_clear_range(ext2fs_generic_bitmap bitmap,
+						 __u32 bitno, __u32 num);
+extern errcode_t ext2fs_extent_bitmap_find_first(ext2fs_generic_bitmap bitmap,
+						 __u32 start, __u32 end,
+						 int zero, __u32 *out);
+extern __u32 ext2fs_extent_bitmap_count_range(ext2fs_generic_bitmap bitmap,
+					      __u32 start, __u32 end);
+
+/*
+ * Bitmaps read with EXT2_FLAG_LAZY_BITMAPS set have each group's part
+ * read in from disk the first time one of its bits is used.
+ */
+extern errcode_t ext2fs_lazy_bitmap_load(ext2fs_generic_bitmap bitmap,
+					 __u32 bitno, __u32 num);
+#define EXT2FS_LAZY_LOAD(bmap, bitno, num)				\
+	do {								\
+		if ((bmap)->lazy_groups)				\
+			ext2fs_lazy_bitmap_load((bmap), (bitno), (num));	\
+	} while (0)
 /*
  * The inline routines themselves...
  * 
@@ -403,6 +463,9 @@ _INLINE_ int ext2fs_test_generic_bitmap(ext2fs_generic_bitmap bitmap,
 		ext2fs_warn_bitmap2(bitmap, EXT2FS_TEST_ERROR, bitno);
 		return 0;
 	}
+	EXT2FS_LAZY_LOAD(bitmap, bitno, 1);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT)
+		return ext2fs_extent_bitmap_test(bitmap, bitno);
 	return ext2fs_test_bit(bitno - bitmap->start, bitmap->bitmap);
 }
 
@@ -460,6 +523,11 @@ _INLINE_ void ext2fs_fast_mark_block_bitmap(ext2fs_block_bitmap bitmap,
 		return;
 	}
 #endif	
+	EXT2FS_LAZY_LOAD(bitmap, block, 1);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT) {
+		ext2fs_extent_bitmap_mark(bitmap, block);
+		return;
+	}
 	ext2fs_fast_set_bit(block - bitmap->start, bitmap->bitmap);
 }
 
@@ -473,6 +541,11 @@ _INLINE_ void ext2fs_fast_unmark_block_bitmap(ext2fs_block_bitmap bitmap,
 		return;
 	}
 #endif
+	EXT2FS_LAZY_LOAD(bitmap, block, 1);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT) {
+		ext2fs_extent_bitmap_unmark(bitmap, block);
+		return;
+	}
 	ext2fs_fast_clear_bit(block - bitmap->start, bitmap->bitmap);
 }
 
@@ -486,6 +559,9 @@ _INLINE_ int ext2fs_fast_test_block_bitmap(ext2fs_block_bitmap bitmap,
 		return 0;
 	}
 #endif
+	EXT2FS_LAZY_LOAD(bitmap, block, 1);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT)
+		return ext2fs_extent_bitmap_test(bitmap, block);
 	return ext2fs_test_bit(block - bitmap->start, bitmap->bitmap);
 }
 
@@ -499,6 +575,11 @@ _INLINE_ void ext2fs_fast_mark_inode_bitmap(ext2fs_inode_bitmap bitmap,
 		return;
 	}
 #endif
+	EXT2FS_LAZY_LOAD(bitmap, inode, 1);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT) {
+		ext2fs_extent_bitmap_mark(bitmap, inode);
+		return;
+	}
 	ext2fs_fast_set_bit(inode - bitmap->start, bitmap->bitmap);
 }
 
@@ -512,6 +593,11 @@ _INLINE_ void ext2fs_fast_unmark_inode_bitmap(ext2fs_inode_bitmap bitmap,
 		return;
 	}
 #endif
+	EXT2FS_LAZY_LOAD(bitmap, inode, 1);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT) {
+		ext2fs_extent_bitmap_unmark(bitmap, inode);
+		return;
+	}
 	ext2fs_fast_clear_bit(inode - bitmap->start, bitmap->bitmap);
 }
 
@@ -525,6 +611,9 @@ _INLINE_ int ext2fs_fast_test_inode_bitmap(ext2fs_inode_bitmap bitmap,
 		return 0;
 	}
 #endif
+	EXT2FS_LAZY_LOAD(bitmap, inode, 1);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT)
+		return ext2fs_extent_bitmap_test(bitmap, inode);
 	return ext2fs_test_bit(inode - bitmap->start, bitmap->bitmap);
 }
 
@@ -551,25 +640,23 @@ _INLINE_ ext2_ino_t ext2fs_get_inode_bitmap_end(ext2fs_inode_bitmap bitmap)
 _INLINE_ int ext2fs_test_block_bitmap_range(ext2fs_block_bitmap bitmap,
 					    blk_t block, int num)
 {
-	int	i;
-
 	if ((block < bitmap->start) || (block+num-1 > bitmap->end)) {
 		ext2fs_warn_bitmap(EXT2_ET_BAD_BLOCK_TEST,
 				   block, bitmap->description);
 		return 0;
 	}
-	for (i=0; i < num; i++) {
-		if (ext2fs_fast_test_block_bitmap(bitmap, block+i))
-			return 0;
-	}
-	return 1;
+	EXT2FS_LAZY_LOAD(bitmap, block, num);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT)
+		return ext2fs_extent_bitmap_test_clear_range(bitmap, block, num);
+	return (ext2fs_find_next_one_bit(bitmap->bitmap,
+					 block - bitmap->start + num,
+					 block - bitmap->start) ==
+		block - bitmap->start + num);
 }
 
 _INLINE_ int ext2fs_fast_test_block_bitmap_range(ext2fs_block_bitmap bitmap,
 						 blk_t block, int num)
 {
-	int	i;
-
 #ifdef EXT2FS_DEBUG_FAST_OPS
 	if ((block < bitmap->start) || (block+num-1 > bitmap->end)) {
 		ext2fs_warn_bitmap(EXT2_ET_BAD_BLOCK_TEST,
@@ -577,33 +664,34 @@ _INLINE_ int ext2fs_fast_test_block_bitmap_range(ext2fs_block_bitmap bitmap,
 		return 0;
 	}
 #endif
-	for (i=0; i < num; i++) {
-		if (ext2fs_fast_test_block_bitmap(bitmap, block+i))
-            //bitmapblock + iһλѾλ,0
-			return 0;
-	}
-	return 1;
+	EXT2FS_LAZY_LOAD(bitmap, block, num);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT)
+		return ext2fs_extent_bitmap_test_clear_range(bitmap, block, num);
+	return (ext2fs_find_next_one_bit(bitmap->bitmap,
+					 block - bitmap->start + num,
+					 block - bitmap->start) ==
+		block - bitmap->start + num);
 }
 
 _INLINE_ void ext2fs_mark_block_bitmap_range(ext2fs_block_bitmap bitmap,
 					     blk_t block, int num)
 {
-	int	i;
-	
 	if ((block < bitmap->start) || (block+num-1 > bitmap->end)) {
 		ext2fs_warn_bitmap(EXT2_ET_BAD_BLOCK_MARK, block,
 				   bitmap->description);
 		return;
 	}
-	for (i=0; i < num; i++)
-		ext2fs_fast_set_bit(block + i - bitmap->start, bitmap->bitmap);
+	EXT2FS_LAZY_LOAD(bitmap, block, num);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT) {
+		ext2fs_extent_bitmap_mark_range(bitmap, block, num);
+		return;
+	}
+	ext2fs_set_bit_range(block - bitmap->start, num, bitmap->bitmap);
 }
 
 _INLINE_ void ext2fs_fast_mark_block_bitmap_range(ext2fs_block_bitmap bitmap,
 						  blk_t block, int num)
 {
-	int	i;
-	
 #ifdef EXT2FS_DEBUG_FAST_OPS
 	if ((block < bitmap->start) || (block+num-1 > bitmap->end)) {
 		ext2fs_warn_bitmap(EXT2_ET_BAD_BLOCK_MARK, block,
@@ -611,30 +699,33 @@ _INLINE_ void ext2fs_fast_mark_block_bitmap_range(ext2fs_block_bitmap bitmap,
 		return;
 	}
 #endif	
-	for (i=0; i < num; i++)
-		ext2fs_fast_set_bit(block + i - bitmap->start, bitmap->bitmap);
+	EXT2FS_LAZY_LOAD(bitmap, block, num);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT) {
+		ext2fs_extent_bitmap_mark_range(bitmap, block, num);
+		return;
+	}
+	ext2fs_set_bit_range(block - bitmap->start, num, bitmap->bitmap);
 }
 
 _INLINE_ void ext2fs_unmark_block_bitmap_range(ext2fs_block_bitmap bitmap,
 					       blk_t block, int num)
 {
-	int	i;
-	
 	if ((block < bitmap->start) || (block+num-1 > bitmap->end)) {
 		ext2fs_warn_bitmap(EXT2_ET_BAD_BLOCK_UNMARK, block,
 				   bitmap->description);
 		return;
 	}
-	for (i=0; i < num; i++)
-		ext2fs_fast_clear_bit(block + i - bitmap->start, 
-				      bitmap->bitmap);
+	EXT2FS_LAZY_LOAD(bitmap, block, num);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT) {
+		ext2fs_extent_bitmap_unmark_range(bitmap, block, num);
+		return;
+	}
+	ext2fs_clear_bit_range(block - bitmap->start, num, bitmap->bitmap);
 }
 
 _INLINE_ void ext2fs_fast_unmark_block_bitmap_range(ext2fs_block_bitmap bitmap,
 						    blk_t block, int num)
 {
-	int	i;
-	
 #ifdef EXT2FS_DEBUG_FAST_OPS
 	if ((block < bitmap->start) || (block+num-1 > bitmap->end)) {
 		ext2fs_warn_bitmap(EXT2_ET_BAD_BLOCK_UNMARK, block,
@@ -642,9 +733,12 @@ _INLINE_ void ext2fs_fast_unmark_block_bitmap_range(ext2fs_block_bitmap bitmap,
 		return;
 	}
 #endif	
-	for (i=0; i < num; i++)
-		ext2fs_fast_clear_bit(block + i - bitmap->start, 
-				      bitmap->bitmap);
+	EXT2FS_LAZY_LOAD(bitmap, block, num);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT) {
+		ext2fs_extent_bitmap_unmark_range(bitmap, block, num);
+		return;
+	}
+	ext2fs_clear_bit_range(block - bitmap->start, num, bitmap->bitmap);
 }
 #undef _INLINE_
 #endif
@@ -221,23 +221,177 @@ void ext2fs_update_dynamic_rev(ext2_filsys fs)
 	/* other fields should be left alone */
 }
 
-static errcode_t write_backup_super(ext2_filsys fs, dgrp_t group,
-				    blk_t group_block,
-				    struct ext2_super_block *super_shadow)
+/*
+ * Remember the superblock and group descriptors as they are on the
+ * backups, so that EXT2_FLAG_DEFER_BACKUPS can tell whether the
+ * backups need to be rewritten.  If we run out of memory, the
+ * backups are just always rewritten.
+ */
+void ext2fs_snapshot_backups(ext2_filsys fs)
 {
-	dgrp_t	sgrp = group;
-	
-	if (sgrp > ((1 << 16) - 1))
-		sgrp = (1 << 16) - 1;
+	size_t	size = (size_t) fs->desc_blocks * fs->blocksize;
+
+	if (fs->backup_desc)
+		ext2fs_free_mem(&fs->backup_desc);
+	if (!fs->backup_super &&
+	    ext2fs_get_mem(SUPERBLOCK_SIZE, &fs->backup_super))
+		return;
+	if (ext2fs_get_mem(size, &fs->backup_desc)) {
+		ext2fs_free_mem(&fs->backup_super);
+		return;
+	}
+	memcpy(fs->backup_super, fs->super, SUPERBLOCK_SIZE);
+	memcpy(fs->backup_desc, fs->group_desc, size);
+}
+
+/*
+ * Return 1 if anything other than the free counts, the timestamps,
+ * the mount count and the state has changed in the superblock or the
+ * group descriptors since the backups were last written.
+ */
+static int backups_stale(ext2_filsys fs)
+{
+	struct ext2_super_block	super;
+	struct ext2_group_desc	*gd, *old;
+	dgrp_t			i;
+
+	if (!fs->backup_super || !fs->backup_desc)
+		return 1;
+
+	super = *fs->super;
+	super.s_free_blocks_count = fs->backup_super->s_free_blocks_count;
+	super.s_free_inodes_count = fs->backup_super->s_free_inodes_count;
+	super.s_mtime = fs->backup_super->s_mtime;
+	super.s_wtime = fs->backup_super->s_wtime;
+	super.s_lastcheck = fs->backup_super->s_lastcheck;
+	super.s_mnt_count = fs->backup_super->s_mnt_count;
+	super.s_state = fs->backup_super->s_state;
+	super.s_block_group_nr = fs->backup_super->s_block_group_nr;
+	if (memcmp(&super, fs->backup_super, SUPERBLOCK_SIZE))
+		return 1;
+
+	for (i = 0, gd = fs->group_desc, old = fs->backup_desc;
+	     i < fs->group_desc_count; i++, gd++, old++) {
+		if ((gd->bg_block_bitmap != old->bg_block_bitmap) ||
+		    (gd->bg_inode_bitmap != old->bg_inode_bitmap) ||
+		    (gd->bg_inode_table != old->bg_inode_table) ||
+		    (gd->bg_flags != old->bg_flags))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * The superblock and group descriptor copies are collected into a
+ * list sorted by location, so that the copies in each group (a
+ * backup superblock is followed by the descriptor blocks) can be
+ * written with a single request.
+ */
+#define BACKUP_IO_MAX		64	/* Max blocks in a single request */
+
+struct backup_io {
+	blk_t	blk;
+	int	count;		/* Blocks */
+	dgrp_t	group;		/* Group number, for a backup superblock */
+	char	*data;		/* Descriptor blocks, or 0 for a superblock */
+};
+
+static EXT2_QSORT_TYPE backup_io_cmp(const void *a, const void *b)
+{
+	const struct backup_io *io_a = (const struct backup_io *) a;
+	const struct backup_io *io_b = (const struct backup_io *) b;
+
+	if (io_a->blk < io_b->blk)
+		return -1;
+	return (io_a->blk > io_b->blk);
+}
+
+static void add_backup_io(struct backup_io *list, int *num, blk_t blk,
+			  int count, dgrp_t group, char *data)
+{
+	struct backup_io *ent = list + (*num)++;
+
+	ent->blk = blk;
+	ent->count = count;
+	ent->group = group;
+	ent->data = data;
+}
+
+/*
+ * Write out the list of copies.  Runs of adjacent copies are put
+ * together in buf, which is grown as needed.  A superblock only takes
+ * up the first SUPERBLOCK_SIZE bytes of its block; when it is written
+ * together with the blocks after it, the rest of its block (which
+ * isn't used for anything) is written as zeros.
+ */
+static errcode_t write_backup_list(ext2_filsys fs, struct backup_io *list,
+				   int num, struct ext2_super_block *super_shadow)
+{
+	struct ext2_super_block *sb;
+	struct backup_io *ent;
+	errcode_t	retval = 0;
+	char		*buf = 0, *cp;
+	int		buf_blocks = 0, blocks, n, m, k;
+	dgrp_t		sgrp;
+
+	for (k = 0; k < num; k += n) {
+		blocks = list[k].count;
+		for (n = 1; k + n < num; n++) {
+			ent = list + k + n;
+			if ((ent->blk != ent[-1].blk + ent[-1].count) ||
+			    (blocks + ent->count > BACKUP_IO_MAX))
+				break;
+			blocks += ent->count;
+		}
+		if (n == 1 && list[k].data) {
+			retval = io_channel_write_blk(fs->io, list[k].blk,
+						      list[k].count,
+						      list[k].data);
+			if (retval)
+				break;
+			continue;
+		}
+		if (blocks > buf_blocks) {
+			retval = ext2fs_resize_mem(buf_blocks * fs->blocksize,
+						   blocks * fs->blocksize,
+						   &buf);
+			if (retval)
+				break;
+			buf_blocks = blocks;
+		}
+		for (m = 0, ent = list + k, cp = buf; m < n; m++, ent++) {
+			if (ent->data) {
+				memcpy(cp, ent->data,
+				       ent->count * fs->blocksize);
+				cp += ent->count * fs->blocksize;
+				continue;
+			}
+			memset(cp, 0, fs->blocksize);
+			memcpy(cp, super_shadow, SUPERBLOCK_SIZE);
+			sb = (struct ext2_super_block *) cp;
+			sgrp = ent->group;
+			if (sgrp > ((1 << 16) - 1))
+				sgrp = (1 << 16) - 1;
 #ifdef EXT2FS_ENABLE_SWAPFS
-	if (fs->flags & EXT2_FLAG_SWAP_BYTES)
-		super_shadow->s_block_group_nr = ext2fs_swab16(sgrp);
-	else
+			if (fs->flags & EXT2_FLAG_SWAP_BYTES)
+				sb->s_block_group_nr = ext2fs_swab16(sgrp);
+			else
 #endif
-		fs->super->s_block_group_nr = sgrp;
-
-	return io_channel_write_blk(fs->io, group_block, -SUPERBLOCK_SIZE, 
-				    super_shadow);
+				sb->s_block_group_nr = sgrp;
+			cp += fs->blocksize;
+		}
+		if (n == 1 && fs->blocksize > SUPERBLOCK_SIZE)
+			retval = io_channel_write_blk(fs->io, list[k].blk,
+						      -SUPERBLOCK_SIZE, buf);
+		else
+			retval = io_channel_write_blk(fs->io, list[k].blk,
+						      blocks, buf);
+		if (retval)
+			break;
+	}
+	if (buf)
+		ext2fs_free_mem(&buf);
+	return retval;
 }
 
 
@@ -250,13 +404,21 @@ errcode_t ext2fs_flush(ext2_filsys fs)
 	struct ext2_super_block *super_shadow = 0;
 	struct ext2_group_desc *group_shadow = 0;
 	struct ext2_group_desc *s, *t;
+	struct backup_io *list = 0;
 	char	*group_ptr;
-	int	old_desc_blocks;
+	int	old_desc_blocks, master_only, num;
 	
 	EXT2_CHECK_MAGIC(fs, EXT2_ET_MAGIC_EXT2FS_FILSYS);
 
 	fs_state = fs->super->s_state;
 
+	/*
+	 * With EXT2_FLAG_DEFER_BACKUPS, leave the backups alone if only
+	 * the counters have changed since they were last written.
+	 */
+	master_only = (fs->flags & EXT2_FLAG_MASTER_SB_ONLY) ||
+		((fs->flags & EXT2_FLAG_DEFER_BACKUPS) && !backups_stale(fs));
+
 	fs->super->s_wtime = fs->now ? fs->now : time(NULL);
 	fs->super->s_block_group_nr = 0;
 #ifdef EXT2FS_ENABLE_SWAPFS
@@ -321,6 +483,11 @@ errcode_t ext2fs_flush(ext2_filsys fs)
 	else
 		old_desc_blocks = fs->desc_blocks;
 
+	retval = ext2fs_get_mem(3 * fs->group_desc_count *
+				sizeof(struct backup_io), &list);
+	if (retval)
+		goto errout;
+	num = 0;
 	for (i = 0; i < fs->group_desc_count; i++) {
 		blk_t	super_blk, old_desc_blk, new_desc_blk;
 		int	meta_bg;
@@ -328,32 +495,23 @@ errcode_t ext2fs_flush(ext2_filsys fs)
 		ext2fs_super_and_bgd_loc(fs, i, &super_blk, &old_desc_blk, 
 					 &new_desc_blk, &meta_bg);
 
-		if (!(fs->flags & EXT2_FLAG_MASTER_SB_ONLY) &&i && super_blk) {
-            //如果没有置位EXT2_FLAG_MASTER_SB_ONLY,而且当前不是第0组,并且sb不在block 0的位置
-			retval = write_backup_super(fs, i, super_blk,
-						    super_shadow);
-			if (retval)
-				goto errout;
-		}
+		if (!master_only && i && super_blk)
+			add_backup_io(list, &num, super_blk, 1, i, 0);
 		if (fs->flags & EXT2_FLAG_SUPER_ONLY)
-            //只操作sb,不操作group descriptor
 			continue;
-		if ((old_desc_blk) && 
-		    (!(fs->flags & EXT2_FLAG_MASTER_SB_ONLY) || (i == 0))) {
-            //如果desc_blk不在block 0,没有置位EXT2_FLAG_MASTER_SB_ONLY,并且不是第0组
-			retval = io_channel_write_blk(fs->io,
-			      old_desc_blk, old_desc_blocks, group_ptr);
-			if (retval)
-				goto errout;
-		}
-		if (new_desc_blk) {
-            //meta group特性中保存有group desc的group
-			retval = io_channel_write_blk(fs->io, new_desc_blk,
-				1, group_ptr + (meta_bg*fs->blocksize));
-			if (retval)
-				goto errout;
-		}
+		if (old_desc_blk && (!master_only || (i == 0)))
+			add_backup_io(list, &num, old_desc_blk,
+				      old_desc_blocks, i, group_ptr);
+		if (new_desc_blk)
+			add_backup_io(list, &num, new_desc_blk, 1, i,
+				      group_ptr + (meta_bg*fs->blocksize));
 	}
+	qsort(list, num, sizeof(struct backup_io), backup_io_cmp);
+	retval = write_backup_list(fs, list, num, super_shadow);
+	if (retval)
+		goto errout;
+	if (!master_only && !(fs->flags & EXT2_FLAG_SUPER_ONLY))
+		ext2fs_snapshot_backups(fs);
 
 	/*
 	 * If the write_bitmaps() function is present, call it to
@@ -398,6 +556,8 @@ write_primary_superblock_only:
 	retval = io_channel_flush(fs->io);
 errout:
 	fs->super->s_state = fs_state;
+	if (list)
+		ext2fs_free_mem(&list);
 	if (fs->flags & EXT2_FLAG_SWAP_BYTES) {
 		if (super_shadow)
 			ext2fs_free_mem(&super_shadow);
@@ -29,44 +29,60 @@
 errcode_t ext2fs_compare_block_bitmap(ext2fs_block_bitmap bm1,
 				      ext2fs_block_bitmap bm2)
 {
-	blk_t	i;
+	__u32	size;
 	
 	EXT2_CHECK_MAGIC(bm1, EXT2_ET_MAGIC_BLOCK_BITMAP);
 	EXT2_CHECK_MAGIC(bm2, EXT2_ET_MAGIC_BLOCK_BITMAP);
 
+	EXT2FS_LAZY_LOAD(bm1, bm1->start, bm1->real_end - bm1->start + 1);
+	EXT2FS_LAZY_LOAD(bm2, bm2->start, bm2->real_end - bm2->start + 1);
+
+	if ((bm1->type == EXT2FS_BMAP_EXTENT) ||
+	    (bm2->type == EXT2FS_BMAP_EXTENT)) {
+		if ((bm1->start != bm2->start) ||
+		    (bm1->end != bm2->end) ||
+		    ext2fs_extent_bitmap_compare(bm1, bm2))
+			return EXT2_ET_NEQ_BLOCK_BITMAP;
+		return 0;
+	}
+
+	size = bm1->end - bm1->start + 1;
 	if ((bm1->start != bm2->start) ||
 	    (bm1->end != bm2->end) ||
-	    (memcmp(bm1->bitmap, bm2->bitmap,
-		    (size_t) (bm1->end - bm1->start)/8)))
+	    (ext2fs_find_next_diff_bit(bm1->bitmap, bm2->bitmap,
+				       size, 0) != size))
 		return EXT2_ET_NEQ_BLOCK_BITMAP;
 
-	for (i = bm1->end - ((bm1->end - bm1->start) % 8); i <= bm1->end; i++)
-		if (ext2fs_fast_test_block_bitmap(bm1, i) !=
-		    ext2fs_fast_test_block_bitmap(bm2, i))
-			return EXT2_ET_NEQ_BLOCK_BITMAP;
-
 	return 0;
 }
 
 errcode_t ext2fs_compare_inode_bitmap(ext2fs_inode_bitmap bm1,
 				      ext2fs_inode_bitmap bm2)
 {
-	ext2_ino_t	i;
+	__u32		size;
 	
 	EXT2_CHECK_MAGIC(bm1, EXT2_ET_MAGIC_INODE_BITMAP);
 	EXT2_CHECK_MAGIC(bm2, EXT2_ET_MAGIC_INODE_BITMAP);
 
+	EXT2FS_LAZY_LOAD(bm1, bm1->start, bm1->real_end - bm1->start + 1);
+	EXT2FS_LAZY_LOAD(bm2, bm2->start, bm2->real_end - bm2->start + 1);
+
+	if ((bm1->type == EXT2FS_BMAP_EXTENT) ||
+	    (bm2->type == EXT2FS_BMAP_EXTENT)) {
+		if ((bm1->start != bm2->start) ||
+		    (bm1->end != bm2->end) ||
+		    ext2fs_extent_bitmap_compare(bm1, bm2))
+			return EXT2_ET_NEQ_INODE_BITMAP;
+		return 0;
+	}
+
+	size = bm1->end - bm1->start + 1;
 	if ((bm1->start != bm2->start) ||
 	    (bm1->end != bm2->end) ||
-	    (memcmp(bm1->bitmap, bm2->bitmap,
-		    (size_t) (bm1->end - bm1->start)/8)))
+	    (ext2fs_find_next_diff_bit(bm1->bitmap, bm2->bitmap,
+				       size, 0) != size))
 		return EXT2_ET_NEQ_INODE_BITMAP;
 
-	for (i = bm1->end - ((bm1->end - bm1->start) % 8); i <= bm1->end; i++)
-		if (ext2fs_fast_test_inode_bitmap(bm1, i) !=
-		    ext2fs_fast_test_inode_bitmap(bm2, i))
-			return EXT2_ET_NEQ_INODE_BITMAP;
-
 	return 0;
 }
 
@@ -85,7 +85,7 @@ static errcode_t make_dblist(ext2_filsys fs, ext2_ino_t size, ext2_ino_t count,
 	}
 	len = (size_t) sizeof(struct ext2_db_entry) * dblist->size;
 	dblist->count = count;
-	retval = ext2fs_get_mem(len, &dblist->list);
+	retval = ext2fs_get_scratch_mem(fs, len, &dblist->list);
 	if (retval)
 		goto cleanup;
 	
@@ -164,9 +164,10 @@ errcode_t ext2fs_add_dir_block(ext2_dblist dblist, ext2_ino_t ino, blk_t blk,
 	if (dblist->count >= dblist->size) {
 		old_size = dblist->size * sizeof(struct ext2_db_entry);
 		dblist->size += 100;
-		retval = ext2fs_resize_mem(old_size, (size_t) dblist->size *
-					   sizeof(struct ext2_db_entry),
-					   &dblist->list);
+		retval = ext2fs_resize_scratch_mem(old_size,
+						   (size_t) dblist->size *
+						   sizeof(struct ext2_db_entry),
+						   &dblist->list);
 		if (retval) {
 			dblist->size -= 100;
 			return retval;
@@ -258,3 +259,42 @@ int ext2fs_dblist_count(ext2_dblist dblist)
 {
 	return (int) dblist->count;
 }
+
+/*
+ * Ask the I/O channel to start reading the directory blocks of count
+ * entries in the directory block list, starting at entry start.  Runs
+ * of adjacent blocks are combined into a single request, so that a
+ * sorted list results in a few large reads.
+ */
+errcode_t ext2fs_dblist_readahead(ext2_dblist dblist, ext2_ino_t start,
+				  ext2_ino_t count)
+{
+	struct ext2_db_entry	*db;
+	blk_t			first = 0, next = 0;
+	ext2_ino_t		i;
+
+	EXT2_CHECK_MAGIC(dblist, EXT2_ET_MAGIC_DBLIST);
+
+	if (start >= dblist->count)
+		return 0;
+	if (count > dblist->count - start)
+		count = dblist->count - start;
+
+	for (i = 0, db = dblist->list + start; i < count; i++, db++) {
+		if (db->blk == 0 || db->blk == next - 1)
+			continue;
+		if (db->blk == next) {
+			next++;
+			continue;
+		}
+		if (first)
+			io_channel_readahead(dblist->fs->io, first,
+					     (int) (next - first));
+		first = db->blk;
+		next = first + 1;
+	}
+	if (first)
+		io_channel_readahead(dblist->fs->io, first,
+				     (int) (next - first));
+	return 0;
+}
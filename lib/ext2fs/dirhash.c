@@ -107,6 +107,99 @@ static void halfMD4Transform (__u32 buf[4], __u32 const in[])
 	buf[3] += d;
 }
 
+/*
+ * The batched hash functions below hash DIRHASH_LANES names at a time.
+ * Each lane's state is kept in its own element of small arrays, and
+ * every step of the transform is a loop across the lanes, which the
+ * compiler can turn into vector instructions.
+ */
+#define DIRHASH_LANES	8
+
+#define LANE_ROUND(f, a, b, c, d, x, s)			\
+	for (l = 0; l < DIRHASH_LANES; l++)		\
+		ROUND(f, a[l], b[l], c[l], d[l], x, s)
+
+static void halfMD4Transform_lanes(__u32 buf[4][DIRHASH_LANES],
+				   __u32 in[8][DIRHASH_LANES])
+{
+	__u32	a[DIRHASH_LANES], b[DIRHASH_LANES];
+	__u32	c[DIRHASH_LANES], d[DIRHASH_LANES];
+	int	l;
+
+	for (l = 0; l < DIRHASH_LANES; l++) {
+		a[l] = buf[0][l];
+		b[l] = buf[1][l];
+		c[l] = buf[2][l];
+		d[l] = buf[3][l];
+	}
+
+	/* Round 1 */
+	LANE_ROUND(F, a, b, c, d, in[0][l] + K1,  3);
+	LANE_ROUND(F, d, a, b, c, in[1][l] + K1,  7);
+	LANE_ROUND(F, c, d, a, b, in[2][l] + K1, 11);
+	LANE_ROUND(F, b, c, d, a, in[3][l] + K1, 19);
+	LANE_ROUND(F, a, b, c, d, in[4][l] + K1,  3);
+	LANE_ROUND(F, d, a, b, c, in[5][l] + K1,  7);
+	LANE_ROUND(F, c, d, a, b, in[6][l] + K1, 11);
+	LANE_ROUND(F, b, c, d, a, in[7][l] + K1, 19);
+
+	/* Round 2 */
+	LANE_ROUND(G, a, b, c, d, in[1][l] + K2,  3);
+	LANE_ROUND(G, d, a, b, c, in[3][l] + K2,  5);
+	LANE_ROUND(G, c, d, a, b, in[5][l] + K2,  9);
+	LANE_ROUND(G, b, c, d, a, in[7][l] + K2, 13);
+	LANE_ROUND(G, a, b, c, d, in[0][l] + K2,  3);
+	LANE_ROUND(G, d, a, b, c, in[2][l] + K2,  5);
+	LANE_ROUND(G, c, d, a, b, in[4][l] + K2,  9);
+	LANE_ROUND(G, b, c, d, a, in[6][l] + K2, 13);
+
+	/* Round 3 */
+	LANE_ROUND(H, a, b, c, d, in[3][l] + K3,  3);
+	LANE_ROUND(H, d, a, b, c, in[7][l] + K3,  9);
+	LANE_ROUND(H, c, d, a, b, in[2][l] + K3, 11);
+	LANE_ROUND(H, b, c, d, a, in[6][l] + K3, 15);
+	LANE_ROUND(H, a, b, c, d, in[1][l] + K3,  3);
+	LANE_ROUND(H, d, a, b, c, in[5][l] + K3,  9);
+	LANE_ROUND(H, c, d, a, b, in[0][l] + K3, 11);
+	LANE_ROUND(H, b, c, d, a, in[4][l] + K3, 15);
+
+	for (l = 0; l < DIRHASH_LANES; l++) {
+		buf[0][l] += a[l];
+		buf[1][l] += b[l];
+		buf[2][l] += c[l];
+		buf[3][l] += d[l];
+	}
+}
+
+static void TEA_transform_lanes(__u32 buf[4][DIRHASH_LANES],
+				__u32 in[8][DIRHASH_LANES])
+{
+	__u32	sum = 0;
+	__u32	b0[DIRHASH_LANES], b1[DIRHASH_LANES];
+	int	n = 16, l;
+
+	for (l = 0; l < DIRHASH_LANES; l++) {
+		b0[l] = buf[0][l];
+		b1[l] = buf[1][l];
+	}
+
+	do {
+		sum += DELTA;
+		for (l = 0; l < DIRHASH_LANES; l++) {
+			b0[l] += ((b1[l] << 4)+in[0][l]) ^ (b1[l]+sum) ^
+				((b1[l] >> 5)+in[1][l]);
+			b1[l] += ((b0[l] << 4)+in[2][l]) ^ (b0[l]+sum) ^
+				((b0[l] >> 5)+in[3][l]);
+		}
+	} while(--n);
+
+	for (l = 0; l < DIRHASH_LANES; l++) {
+		buf[0][l] += b0[l];
+		buf[1][l] += b1[l];
+	}
+}
+
+#undef LANE_ROUND
 #undef ROUND
 #undef F
 #undef G
@@ -156,6 +249,29 @@ static void str2hashbuf(const char *msg, int len, __u32 *buf, int num)
 		*buf++ = pad;
 }
 
+/*
+ * Set up the initial hash state from the seed, or the default seed if
+ * there isn't one (or it's all zeros).
+ */
+static void dirhash_seed(const __u32 *seed, __u32 buf[4])
+{
+	int	i;
+
+	buf[0] = 0x67452301;
+	buf[1] = 0xefcdab89;
+	buf[2] = 0x98badcfe;
+	buf[3] = 0x10325476;
+
+	if (seed) {
+		for (i=0; i < 4; i++) {
+			if (seed[i])
+				break;
+		}
+		if (i < 4)
+			memcpy(buf, seed, 4 * sizeof(__u32));
+	}
+}
+
 /*
  * Returns the hash of a filename.  If len is 0 and name is NULL, then
  * this function can be used to test whether or not a hash version is
@@ -177,25 +293,10 @@ errcode_t ext2fs_dirhash(int version, const char *name, int len,
 	__u32	hash;
 	__u32	minor_hash = 0;
 	const char	*p;
-	int		i;
 	__u32 		in[8], buf[4];
 
-	/* Initialize the default seed for the hash checksum functions */
-	buf[0] = 0x67452301;
-	buf[1] = 0xefcdab89;
-	buf[2] = 0x98badcfe;
-	buf[3] = 0x10325476;
+	dirhash_seed(seed, buf);
 
-	/* Check to see if the seed is all zero's */
-	if (seed) {
-		for (i=0; i < 4; i++) {
-			if (seed[i])
-				break;
-		}
-		if (i < 4)
-			memcpy(buf, seed, sizeof(buf));
-	}
-		
 	switch (version) {
 	case EXT2_HASH_LEGACY:
 		hash = dx_hack_hash(name, len);
@@ -231,3 +332,101 @@ errcode_t ext2fs_dirhash(int version, const char *name, int len,
 		*ret_minor_hash = minor_hash;
 	return 0;
 }
+
+/*
+ * Returns the hashes of count filenames, which gives the same results
+ * as calling ext2fs_dirhash() on each of them.  ret_minor_hashes may be
+ * NULL.
+ *
+ * The half MD4 and TEA hashes are computed DIRHASH_LANES names at a
+ * time.  Each lane works through its own name a block at a time, and
+ * picks up the next name as soon as it has finished with its current
+ * one, so that names of different lengths can share the lanes.
+ */
+errcode_t ext2fs_dirhash_many(int version, int count,
+			      const char * const *names, const int *lens,
+			      const __u32 *seed,
+			      ext2_dirhash_t *ret_hashes,
+			      ext2_dirhash_t *ret_minor_hashes)
+{
+	__u32		init[4], tmp[8];
+	__u32		buf[4][DIRHASH_LANES], in[8][DIRHASH_LANES];
+	const char	*p[DIRHASH_LANES];
+	int		len[DIRHASH_LANES], idx[DIRHASH_LANES];
+	int		i, j, l, next = 0, active, words, h;
+
+	switch (version) {
+	case EXT2_HASH_LEGACY:
+		for (i = 0; i < count; i++) {
+			ret_hashes[i] = dx_hack_hash(names[i], lens[i]) & ~1;
+			if (ret_minor_hashes)
+				ret_minor_hashes[i] = 0;
+		}
+		return 0;
+	case EXT2_HASH_HALF_MD4:
+		words = 8;
+		h = 1;		/* The hash is in buf[1], minor hash in buf[2] */
+		break;
+	case EXT2_HASH_TEA:
+		words = 4;
+		h = 0;
+		break;
+	default:
+		return EXT2_ET_DIRHASH_UNSUPP;
+	}
+
+	dirhash_seed(seed, init);
+	memset(in, 0, sizeof(in));
+	for (l = 0; l < DIRHASH_LANES; l++)
+		idx[l] = -1;
+
+	while (1) {
+		active = 0;
+		for (l = 0; l < DIRHASH_LANES; l++) {
+			/* Give an idle lane the next name to hash */
+			while (idx[l] < 0 && next < count) {
+				i = next++;
+				for (j = 0; j < 4; j++)
+					buf[j][l] = init[j];
+				if (lens[i] <= 0) {
+					/* Nothing to hash; just the seed */
+					ret_hashes[i] = init[h] & ~1;
+					if (ret_minor_hashes)
+						ret_minor_hashes[i] = init[h+1];
+					continue;
+				}
+				idx[l] = i;
+				p[l] = names[i];
+				len[l] = lens[i];
+			}
+			if (idx[l] < 0)
+				continue;
+			str2hashbuf(p[l], len[l], tmp, words);
+			for (j = 0; j < words; j++)
+				in[j][l] = tmp[j];
+			active++;
+		}
+		if (!active)
+			break;
+
+		if (version == EXT2_HASH_HALF_MD4)
+			halfMD4Transform_lanes(buf, in);
+		else
+			TEA_transform_lanes(buf, in);
+
+		for (l = 0; l < DIRHASH_LANES; l++) {
+			if (idx[l] < 0)
+				continue;
+			len[l] -= words * 4;
+			p[l] += words * 4;
+			if (len[l] > 0)
+				continue;
+			i = idx[l];
+			ret_hashes[i] = buf[h][l] & ~1;
+			if (ret_minor_hashes)
+				ret_minor_hashes[i] = buf[h+1][l];
+			idx[l] = -1;
+		}
+	}
+	return 0;
+}
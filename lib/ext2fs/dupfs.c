@@ -39,6 +39,9 @@ errcode_t ext2fs_dup_handle(ext2_filsys src, ext2_filsys *dest)
 	fs->block_map = 0;
 	fs->badblocks = 0;
 	fs->dblist = 0;
+	fs->scratch_dir = 0;
+	fs->backup_super = 0;
+	fs->backup_desc = 0;
 
 	io_channel_bumpcount(fs->io);
 	if (fs->icache)
@@ -81,6 +84,11 @@ errcode_t ext2fs_dup_handle(ext2_filsys src, ext2_filsys *dest)
 		if (retval)
 			goto errout;
 	}
+	if (src->scratch_dir) {
+		retval = ext2fs_set_scratch_dir(fs, src->scratch_dir);
+		if (retval)
+			goto errout;
+	}
 	if (src->dblist) {
 		retval = ext2fs_copy_dblist(src->dblist, &fs->dblist);
 		if (retval)
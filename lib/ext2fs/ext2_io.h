@@ -70,7 +70,11 @@ struct struct_io_manager {
 				int count, const void *data);
 	errcode_t (*set_option)(io_channel channel, const char *option, 
 				const char *arg);
-	int		reserved[14];
+	errcode_t (*readahead)(io_channel channel, unsigned long block,
+			       int count);
+	errcode_t (*zeroout)(io_channel channel, unsigned long block,
+			     unsigned long count);
+	int		reserved[12];
 };
 
 #define IO_FLAG_RW		0x0001
@@ -92,6 +96,10 @@ extern errcode_t io_channel_set_options(io_channel channel,
 extern errcode_t io_channel_write_byte(io_channel channel, 
 				       unsigned long offset,
 				       int count, const void *data);
+extern errcode_t io_channel_readahead(io_channel channel,
+				      unsigned long block, int count);
+extern errcode_t io_channel_zeroout(io_channel channel,
+				    unsigned long block, unsigned long count);
 
 /* unix_io.c */
 extern io_manager unix_io_manager;
@@ -98,6 +98,18 @@ typedef __u32		ext2_dirhash_t;
 
 typedef struct struct_ext2_filsys *ext2_filsys;
 
+/*
+ * Bitmap backends, chosen when the bitmap is allocated.  A bitarray
+ * bitmap keeps one bit per block or inode in bitmap->bitmap; an extent
+ * bitmap keeps a sorted list of the runs of set bits instead, which is
+ * much smaller for sparsely populated bitmaps.  The filesystem's own
+ * inode_map and block_map are always bitarrays.
+ */
+#define EXT2FS_BMAP_BITARRAY	0
+#define EXT2FS_BMAP_EXTENT	1
+
+struct ext2fs_bmap_extents;
+
 struct ext2fs_struct_generic_bitmap {
 	errcode_t	magic;
 	ext2_filsys 	fs;
@@ -106,7 +118,10 @@ struct ext2fs_struct_generic_bitmap {
 	char	*	description;
 	char	*	bitmap;
 	errcode_t	base_error_code;
-	__u32		reserved[7];
+	int		type;
+	struct ext2fs_bmap_extents *extents;
+	char	*	lazy_groups;	/* Groups read in, if loaded lazily */
+	__u32		reserved[4];
 };
 
 #define EXT2FS_MARK_ERROR 	0
@@ -191,6 +206,8 @@ typedef struct ext2_file *ext2_file_t;
 #define EXT2_FLAG_JOURNAL_DEV_OK	0x1000
 #define EXT2_FLAG_IMAGE_FILE		0x2000
 #define EXT2_FLAG_EXCLUSIVE		0x4000
+#define EXT2_FLAG_LAZY_BITMAPS		0x8000
+#define EXT2_FLAG_DEFER_BACKUPS		0x10000
 
 /*
  * Special flag in the ext2 inode i_flag field that means that this is
@@ -252,6 +269,18 @@ struct struct_ext2_filsys {
 	 */
 	struct ext2_inode_cache		*icache;
 	io_channel			image_io;
+
+	/*
+	 * Directory for file-backed scratch memory (see scratch.c)
+	 */
+	char				*scratch_dir;
+
+	/*
+	 * Superblock and group descriptors as last written to the
+	 * backups, for EXT2_FLAG_DEFER_BACKUPS (see closefs.c)
+	 */
+	struct ext2_super_block		*backup_super;
+	struct ext2_group_desc		*backup_desc;
 };
 
 #if EXT2_FLAT_INCLUDES
@@ -415,6 +444,8 @@ typedef struct ext2_struct_inode_scan *ext2_inode_scan;
  * ext2_icount_t abstraction
  */
 #define EXT2_ICOUNT_OPT_INCREMENT	0x01
+#define EXT2_ICOUNT_OPT_HASH		0x02
+#define EXT2_ICOUNT_OPT_FULLMAP		0x04
 
 typedef struct ext2_icount *ext2_icount_t;
 
@@ -570,6 +601,12 @@ extern errcode_t ext2fs_allocate_block_bitmap(ext2_filsys fs,
 extern errcode_t ext2fs_allocate_inode_bitmap(ext2_filsys fs,
 					      const char *descr,
 					      ext2fs_inode_bitmap *ret);
+extern errcode_t ext2fs_allocate_block_bitmap_type(ext2_filsys fs, int type,
+						   const char *descr,
+						   ext2fs_block_bitmap *ret);
+extern errcode_t ext2fs_allocate_inode_bitmap_type(ext2_filsys fs, int type,
+						   const char *descr,
+						   ext2fs_inode_bitmap *ret);
 extern errcode_t ext2fs_fudge_inode_bitmap_end(ext2fs_inode_bitmap bitmap,
 					       ext2_ino_t end, ext2_ino_t *oend);
 extern errcode_t ext2fs_fudge_block_bitmap_end(ext2fs_block_bitmap bitmap,
@@ -578,6 +615,7 @@ extern void ext2fs_clear_inode_bitmap(ext2fs_inode_bitmap bitmap);
 extern void ext2fs_clear_block_bitmap(ext2fs_block_bitmap bitmap);
 extern errcode_t ext2fs_read_bitmaps(ext2_filsys fs);
 extern errcode_t ext2fs_write_bitmaps(ext2_filsys fs);
+extern errcode_t ext2fs_lazy_bitmap_load_all(ext2fs_generic_bitmap bitmap);
 
 /* block.c */
 extern errcode_t ext2fs_block_iterate(ext2_filsys fs,
@@ -655,6 +693,8 @@ extern errcode_t ext2fs_set_dir_block(ext2_dblist dblist, ext2_ino_t ino,
 extern errcode_t ext2fs_copy_dblist(ext2_dblist src,
 				    ext2_dblist *dest);
 extern int ext2fs_dblist_count(ext2_dblist dblist);
+extern errcode_t ext2fs_dblist_readahead(ext2_dblist dblist,
+					 ext2_ino_t start, ext2_ino_t count);
 
 /* dblist_dir.c */
 extern errcode_t
@@ -685,6 +725,11 @@ extern errcode_t ext2fs_dirhash(int version, const char *name, int len,
 				const __u32 *seed,
 				ext2_dirhash_t *ret_hash,
 				ext2_dirhash_t *ret_minor_hash);
+extern errcode_t ext2fs_dirhash_many(int version, int count,
+				     const char * const *names,
+				     const int *lens, const __u32 *seed,
+				     ext2_dirhash_t *ret_hashes,
+				     ext2_dirhash_t *ret_minor_hashes);
 
 
 /* dir_iterate.c */
@@ -725,6 +770,15 @@ extern errcode_t ext2fs_adjust_ea_refcount(ext2_filsys fs, blk_t blk,
 					   char *block_buf,
 					   int adjust, __u32 *newcount);
 
+/* extent_bitmap.c */
+extern errcode_t ext2fs_extent_bitmap_new(ext2fs_generic_bitmap bmap);
+extern errcode_t ext2fs_extent_bitmap_copy(ext2fs_generic_bitmap src,
+					   ext2fs_generic_bitmap dest);
+extern void ext2fs_extent_bitmap_free(ext2fs_generic_bitmap bmap);
+extern void ext2fs_extent_bitmap_clear(ext2fs_generic_bitmap bmap);
+extern int ext2fs_extent_bitmap_compare(ext2fs_generic_bitmap bm1,
+					ext2fs_generic_bitmap bm2);
+
 /* fileio.c */
 extern errcode_t ext2fs_file_open2(ext2_filsys fs, ext2_ino_t ino,
 				   struct ext2_inode *inode,
@@ -939,6 +993,14 @@ extern errcode_t ext2fs_resize_block_bitmap(__u32 new_end, __u32 new_real_end,
 extern errcode_t ext2fs_copy_bitmap(ext2fs_generic_bitmap src,
 				    ext2fs_generic_bitmap *dest);
 
+/* scratch.c */
+extern errcode_t ext2fs_set_scratch_dir(ext2_filsys fs, const char *dir);
+extern errcode_t ext2fs_get_scratch_mem(ext2_filsys fs, unsigned long size,
+					void *ptr);
+extern errcode_t ext2fs_resize_scratch_mem(unsigned long old_size,
+					   unsigned long size, void *ptr);
+extern errcode_t ext2fs_free_scratch_mem(void *ptr);
+
 /* swapfs.c */
 extern void ext2fs_swap_ext_attr(char *to, char *from, int bufsize, 
 				 int has_header);
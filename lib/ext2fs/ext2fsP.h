@@ -84,6 +84,9 @@ struct ext2_inode_cache_ent {
 
 /* Function prototypes */
 
+/* closefs.c */
+extern void ext2fs_snapshot_backups(ext2_filsys fs);
+
 extern int ext2fs_process_dir_block(ext2_filsys  	fs,
 				    blk_t		*blocknr,
 				    e2_blkcnt_t		blockcnt,
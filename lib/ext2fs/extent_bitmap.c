@@ -0,0 +1,429 @@
+/*
+ * extent_bitmap.c --- Bitmap backend which stores the set bits as a
+ * 	sorted list of extents, for bitmaps that are mostly empty (or
+ * 	mostly made up of long runs).
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ */
+
+#include <stdio.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#if HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include "ext2_fs.h"
+#include "ext2fs.h"
+
+struct bmap_extent {
+	__u32	start;
+	__u32	count;
+};
+
+struct ext2fs_bmap_extents {
+	int			num;
+	int			size;
+	int			cursor;
+	struct bmap_extent	*list;
+};
+
+#define EXTENT_END(ext)	((__u64) (ext)->start + (ext)->count)
+
+errcode_t ext2fs_extent_bitmap_new(ext2fs_generic_bitmap bmap)
+{
+	struct ext2fs_bmap_extents *ex;
+	errcode_t	retval;
+
+	retval = ext2fs_get_mem(sizeof(struct ext2fs_bmap_extents), &ex);
+	if (retval)
+		return retval;
+	memset(ex, 0, sizeof(struct ext2fs_bmap_extents));
+	bmap->extents = ex;
+	return 0;
+}
+
+errcode_t ext2fs_extent_bitmap_copy(ext2fs_generic_bitmap src,
+				    ext2fs_generic_bitmap dest)
+{
+	struct ext2fs_bmap_extents *ex;
+	errcode_t	retval;
+	size_t		size;
+
+	retval = ext2fs_extent_bitmap_new(dest);
+	if (retval)
+		return retval;
+	if (!src->extents->num)
+		return 0;
+
+	ex = dest->extents;
+	size = src->extents->num * sizeof(struct bmap_extent);
+	retval = ext2fs_get_mem(size, &ex->list);
+	if (retval) {
+		ext2fs_free_mem(&dest->extents);
+		return retval;
+	}
+	memcpy(ex->list, src->extents->list, size);
+	ex->num = ex->size = src->extents->num;
+	return 0;
+}
+
+void ext2fs_extent_bitmap_free(ext2fs_generic_bitmap bmap)
+{
+	if (!bmap->extents)
+		return;
+	if (bmap->extents->list)
+		ext2fs_free_mem(&bmap->extents->list);
+	ext2fs_free_mem(&bmap->extents);
+}
+
+void ext2fs_extent_bitmap_clear(ext2fs_generic_bitmap bmap)
+{
+	bmap->extents->num = 0;
+	bmap->extents->cursor = 0;
+}
+
+/*
+ * Return the index of the last extent which starts at or before
+ * bitno, or -1 if there isn't one.  Most callers walk the bitmap in
+ * order, so check the extent used last time (and the one after it)
+ * before falling back to a binary search.
+ */
+static int find_extent(struct ext2fs_bmap_extents *ex, __u32 bitno)
+{
+	int	low, high, mid;
+
+	if (!ex->num || bitno < ex->list[0].start)
+		return -1;
+
+	low = ex->cursor;
+	if (low < ex->num && ex->list[low].start <= bitno) {
+		if (low+1 == ex->num || ex->list[low+1].start > bitno)
+			return low;
+		if (low+2 == ex->num || ex->list[low+2].start > bitno) {
+			ex->cursor = low+1;
+			return low+1;
+		}
+	}
+
+	low = 0;
+	high = ex->num-1;
+	while (low < high) {
+		mid = (low + high + 1) / 2;
+		if (ex->list[mid].start <= bitno)
+			low = mid;
+		else
+			high = mid-1;
+	}
+	ex->cursor = low;
+	return low;
+}
+
+/*
+ * Make room for count extents at index i
+ */
+static int insert_extents(ext2fs_generic_bitmap bmap, int i, int count)
+{
+	struct ext2fs_bmap_extents *ex = bmap->extents;
+	errcode_t	retval;
+	int		new_size;
+
+	if (ex->num + count > ex->size) {
+		new_size = ex->size ? ex->size * 2 : 16;
+		while (new_size < ex->num + count)
+			new_size *= 2;
+		retval = ext2fs_resize_mem(ex->size *
+					   sizeof(struct bmap_extent),
+					   new_size *
+					   sizeof(struct bmap_extent),
+					   &ex->list);
+		if (retval)
+			return retval;
+		ex->size = new_size;
+	}
+	if (i < ex->num)
+		memmove(&ex->list[i+count], &ex->list[i],
+			(ex->num - i) * sizeof(struct bmap_extent));
+	ex->num += count;
+	return 0;
+}
+
+static void remove_extents(struct ext2fs_bmap_extents *ex, int i, int count)
+{
+	if (i + count < ex->num)
+		memmove(&ex->list[i], &ex->list[i+count],
+			(ex->num - i - count) * sizeof(struct bmap_extent));
+	ex->num -= count;
+	if (ex->cursor >= ex->num)
+		ex->cursor = ex->num ? ex->num-1 : 0;
+}
+
+int ext2fs_extent_bitmap_test(ext2fs_generic_bitmap bmap, __u32 bitno)
+{
+	struct ext2fs_bmap_extents *ex = bmap->extents;
+	int	i;
+
+	i = find_extent(ex, bitno);
+	if (i < 0)
+		return 0;
+	return (bitno - ex->list[i].start < ex->list[i].count);
+}
+
+/*
+ * Return 1 if none of the num bits starting at bitno are set.
+ */
+int ext2fs_extent_bitmap_test_clear_range(ext2fs_generic_bitmap bmap,
+					  __u32 bitno, __u32 num)
+{
+	struct ext2fs_bmap_extents *ex = bmap->extents;
+	int	i;
+
+	i = find_extent(ex, bitno);
+	if (i >= 0 && EXTENT_END(&ex->list[i]) > bitno)
+		return 0;
+	i++;
+	if (i < ex->num && ex->list[i].start < (__u64) bitno + num)
+		return 0;
+	return 1;
+}
+
+void ext2fs_extent_bitmap_mark_range(ext2fs_generic_bitmap bmap,
+				     __u32 bitno, __u32 num)
+{
+	struct ext2fs_bmap_extents *ex = bmap->extents;
+	struct bmap_extent *ext;
+	__u64		start = bitno, end = (__u64) bitno + num;
+	int		i, j;
+
+	if (!num)
+		return;
+
+	/* Merge with the extent which starts before us, if it touches */
+	i = find_extent(ex, bitno);
+	if (i >= 0 && EXTENT_END(&ex->list[i]) >= start) {
+		start = ex->list[i].start;
+		if (EXTENT_END(&ex->list[i]) >= end)
+			return;
+	} else
+		i++;
+
+	/* ... and swallow every following extent that we reach */
+	for (j = i; j < ex->num && ex->list[j].start <= end; j++)
+		if (EXTENT_END(&ex->list[j]) > end)
+			end = EXTENT_END(&ex->list[j]);
+
+	if (j == i) {
+		if (insert_extents(bmap, i, 1)) {
+			ext2fs_warn_bitmap(EXT2_ET_NO_MEMORY, bitno,
+					   bmap->description);
+			return;
+		}
+	} else if (j > i+1)
+		remove_extents(ex, i+1, j - i - 1);
+
+	ext = &ex->list[i];
+	ext->start = start;
+	ext->count = end - start;
+	ex->cursor = i;
+}
+
+void ext2fs_extent_bitmap_unmark_range(ext2fs_generic_bitmap bmap,
+				       __u32 bitno, __u32 num)
+{
+	struct ext2fs_bmap_extents *ex = bmap->extents;
+	struct bmap_extent *ext;
+	__u64		end = (__u64) bitno + num, ext_end;
+	int		i, j;
+
+	if (!num)
+		return;
+
+	i = find_extent(ex, bitno);
+	if (i >= 0) {
+		ext = &ex->list[i];
+		ext_end = EXTENT_END(ext);
+		if (ext->start < bitno && ext_end > bitno) {
+			if (ext_end > end) {
+				/* Punch a hole in the middle of the extent */
+				if (insert_extents(bmap, i+1, 1)) {
+					ext2fs_warn_bitmap(EXT2_ET_NO_MEMORY,
+							   bitno,
+							   bmap->description);
+					return;
+				}
+				ext = &ex->list[i];
+				ext[1].start = end;
+				ext[1].count = ext_end - end;
+				ext->count = bitno - ext->start;
+				return;
+			}
+			ext->count = bitno - ext->start;
+			i++;
+		} else if (ext->start < bitno)
+			i++;
+	} else
+		i = 0;
+
+	for (j = i; j < ex->num && EXTENT_END(&ex->list[j]) <= end; j++)
+		;
+	if (j < ex->num && ex->list[j].start < end) {
+		ext = &ex->list[j];
+		ext->count = EXTENT_END(ext) - end;
+		ext->start = end;
+	}
+	if (j > i)
+		remove_extents(ex, i, j - i);
+}
+
+/*
+ * Find the first bit between start and end, inclusive, which is set
+ * (or clear, if zero is set).  Returns ENOENT if there isn't one.
+ * Extents never touch each other, so the bit just past the end of
+ * an extent is always clear.
+ */
+errcode_t ext2fs_extent_bitmap_find_first(ext2fs_generic_bitmap bmap,
+					  __u32 start, __u32 end, int zero,
+					  __u32 *out)
+{
+	struct ext2fs_bmap_extents *ex = bmap->extents;
+	__u64	pos = start;
+	int	i;
+
+	i = find_extent(ex, start);
+	if (zero) {
+		if (i >= 0 && EXTENT_END(&ex->list[i]) > pos)
+			pos = EXTENT_END(&ex->list[i]);
+	} else if (i < 0 || EXTENT_END(&ex->list[i]) <= pos) {
+		if (++i >= ex->num)
+			return ENOENT;
+		pos = ex->list[i].start;
+	}
+	if (pos > end)
+		return ENOENT;
+	*out = pos;
+	return 0;
+}
+
+/*
+ * Return the number of bits set between start and end, inclusive.
+ */
+__u32 ext2fs_extent_bitmap_count_range(ext2fs_generic_bitmap bmap,
+				       __u32 start, __u32 end)
+{
+	struct ext2fs_bmap_extents *ex = bmap->extents;
+	__u64	first, last, limit = (__u64) end + 1;
+	__u32	count = 0;
+	int	i;
+
+	i = find_extent(ex, start);
+	if (i < 0)
+		i = 0;
+	for (; i < ex->num && ex->list[i].start < limit; i++) {
+		first = ex->list[i].start;
+		if (first < start)
+			first = start;
+		last = EXTENT_END(&ex->list[i]);
+		if (last > limit)
+			last = limit;
+		if (last > first)
+			count += last - first;
+	}
+	return count;
+}
+
+int ext2fs_extent_bitmap_mark(ext2fs_generic_bitmap bmap, __u32 bitno)
+{
+	if (ext2fs_extent_bitmap_test(bmap, bitno))
+		return 1;
+	ext2fs_extent_bitmap_mark_range(bmap, bitno, 1);
+	return 0;
+}
+
+int ext2fs_extent_bitmap_unmark(ext2fs_generic_bitmap bmap, __u32 bitno)
+{
+	if (!ext2fs_extent_bitmap_test(bmap, bitno))
+		return 0;
+	ext2fs_extent_bitmap_unmark_range(bmap, bitno, 1);
+	return 1;
+}
+
+/*
+ * Compare the bits between start and end of two bitmaps, at least
+ * one of which is extent-based.  Returns 0 if they are the same.
+ */
+int ext2fs_extent_bitmap_compare(ext2fs_generic_bitmap bm1,
+				 ext2fs_generic_bitmap bm2)
+{
+	struct ext2fs_bmap_extents *ex1, *ex2;
+	__u64	pos, next;
+	int	i;
+
+	if (bm1->type == EXT2FS_BMAP_EXTENT &&
+	    bm2->type == EXT2FS_BMAP_EXTENT) {
+		/* Only look at the extents up to the end of the bitmap */
+		ex1 = bm1->extents;
+		ex2 = bm2->extents;
+		for (i = 0; i < ex1->num && i < ex2->num; i++) {
+			if (ex1->list[i].start > bm1->end &&
+			    ex2->list[i].start > bm1->end)
+				return 0;
+			if (ex1->list[i].start != ex2->list[i].start)
+				return 1;
+			if (ex1->list[i].count != ex2->list[i].count &&
+			    (EXTENT_END(&ex1->list[i]) <= bm1->end ||
+			     EXTENT_END(&ex2->list[i]) <= bm1->end))
+				return 1;
+		}
+		if (i < ex1->num && ex1->list[i].start <= bm1->end)
+			return 1;
+		if (i < ex2->num && ex2->list[i].start <= bm1->end)
+			return 1;
+		return 0;
+	}
+
+	/*
+	 * Walk the extents of the extent-based bitmap, checking that
+	 * the flat bitmap is clear over each gap and set over each run.
+	 */
+	if (bm1->type != EXT2FS_BMAP_EXTENT) {
+		ext2fs_generic_bitmap tmp = bm1;
+		bm1 = bm2;
+		bm2 = tmp;
+	}
+	EXT2FS_LAZY_LOAD(bm2, bm1->start, bm1->end - bm1->start + 1);
+	ex1 = bm1->extents;
+	pos = bm1->start;
+	for (i = 0; pos <= bm1->end; i++) {
+		next = (__u64) bm1->end + 1;
+		if (i < ex1->num && ex1->list[i].start < next)
+			next = ex1->list[i].start;
+		if (pos < next &&
+		    ext2fs_find_next_one_bit(bm2->bitmap, next - bm2->start,
+					     pos - bm2->start) <
+		    next - bm2->start)
+			return 1;
+		if (pos < next)
+			pos = next;
+		if (i >= ex1->num)
+			break;
+		next = EXTENT_END(&ex1->list[i]);
+		if (next > (__u64) bm1->end + 1)
+			next = (__u64) bm1->end + 1;
+		if (pos < next &&
+		    ext2fs_find_next_zero_bit(bm2->bitmap, next - bm2->start,
+					      pos - bm2->start) <
+		    next - bm2->start)
+			return 1;
+		if (pos < next)
+			pos = next;
+	}
+	return 0;
+}
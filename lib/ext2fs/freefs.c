@@ -38,6 +38,10 @@ void ext2fs_free(ext2_filsys fs)
 		ext2fs_free_mem(&fs->orig_super);
 	if (fs->group_desc)
 		ext2fs_free_mem(&fs->group_desc);
+	if (fs->backup_super)
+		ext2fs_free_mem(&fs->backup_super);
+	if (fs->backup_desc)
+		ext2fs_free_mem(&fs->backup_desc);
 	if (fs->block_map)
 		ext2fs_free_block_bitmap(fs->block_map);
 	if (fs->inode_map)
@@ -52,6 +56,9 @@ void ext2fs_free(ext2_filsys fs)
 
 	if (fs->icache)
 		ext2fs_free_inode_cache(fs->icache);
+
+	if (fs->scratch_dir)
+		ext2fs_free_mem(&fs->scratch_dir);
 	
 	fs->magic = 0;
 
@@ -72,6 +79,10 @@ void ext2fs_free_generic_bitmap(ext2fs_inode_bitmap bitmap)
 		ext2fs_free_mem(&bitmap->bitmap);
 		bitmap->bitmap = 0;
 	}
+	if (bitmap->extents)
+		ext2fs_extent_bitmap_free(bitmap);
+	if (bitmap->lazy_groups)
+		ext2fs_free_mem(&bitmap->lazy_groups);
 	ext2fs_free_mem(&bitmap);
 }
 
@@ -137,7 +148,7 @@ void ext2fs_free_dblist(ext2_dblist dblist)
 		return;
 
 	if (dblist->list)
-		ext2fs_free_mem(&dblist->list);
+		ext2fs_free_scratch_mem(&dblist->list);
 	dblist->list = 0;
 	if (dblist->fs && dblist->fs->dblist == dblist)
 		dblist->fs->dblist = 0;
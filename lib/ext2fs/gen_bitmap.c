@@ -12,6 +12,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #if HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -34,6 +35,9 @@ int ext2fs_mark_generic_bitmap(ext2fs_generic_bitmap bitmap,
 		ext2fs_warn_bitmap2(bitmap, EXT2FS_MARK_ERROR, bitno);
 		return 0;
 	}
+	EXT2FS_LAZY_LOAD(bitmap, bitno, 1);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT)
+		return ext2fs_extent_bitmap_mark(bitmap, bitno);
 	return ext2fs_set_bit(bitno - bitmap->start, bitmap->bitmap);
 }
 
@@ -44,5 +48,174 @@ int ext2fs_unmark_generic_bitmap(ext2fs_generic_bitmap bitmap,
 		ext2fs_warn_bitmap2(bitmap, EXT2FS_UNMARK_ERROR, bitno);
 		return 0;
 	}
+	EXT2FS_LAZY_LOAD(bitmap, bitno, 1);
+	if (bitmap->type == EXT2FS_BMAP_EXTENT)
+		return ext2fs_extent_bitmap_unmark(bitmap, bitno);
 	return ext2fs_clear_bit(bitno - bitmap->start, bitmap->bitmap);
 }
+
+/*
+ * Check that start..end lies within the bitmap, complaining (and
+ * returning 0) if it doesn't.
+ */
+static int check_range(ext2fs_generic_bitmap bitmap, __u32 start, __u32 end,
+		       int code)
+{
+	if ((start < bitmap->start) || (end > bitmap->end) || (start > end)) {
+		ext2fs_warn_bitmap2(bitmap, code, start);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Return the last bit of the block group containing bitno, for
+ * searching lazily loaded bitmaps one group at a time.
+ */
+static __u32 group_end(ext2fs_generic_bitmap bitmap, __u32 bitno)
+{
+	__u32	per_group;
+
+	if (bitmap->magic == EXT2_ET_MAGIC_INODE_BITMAP)
+		per_group = EXT2_INODES_PER_GROUP(bitmap->fs->super);
+	else
+		per_group = EXT2_BLOCKS_PER_GROUP(bitmap->fs->super);
+	return bitno + (per_group - 1 - (bitno - bitmap->start) % per_group);
+}
+
+/*
+ * Find the first bit between start and end, inclusive, which is set
+ * (or clear, if zero is set).  Returns ENOENT if there isn't one.
+ */
+static errcode_t find_first(ext2fs_generic_bitmap bitmap, __u32 start,
+			    __u32 end, int zero, __u32 *out)
+{
+	__u32	bitno, last;
+
+	if (!check_range(bitmap, start, end, EXT2FS_TEST_ERROR))
+		return EXT2_ET_INVALID_ARGUMENT;
+
+	if (bitmap->type == EXT2FS_BMAP_EXTENT)
+		return ext2fs_extent_bitmap_find_first(bitmap, start, end,
+						       zero, out);
+
+	/*
+	 * Search a lazily loaded bitmap a group at a time, so that
+	 * only the groups before the bit we find have to be read in.
+	 */
+	for (; ; start = last + 1) {
+		last = end;
+		if (bitmap->lazy_groups) {
+			last = group_end(bitmap, start);
+			if (last > end)
+				last = end;
+			ext2fs_lazy_bitmap_load(bitmap, start,
+						last - start + 1);
+		}
+		if (zero)
+			bitno = ext2fs_find_next_zero_bit(bitmap->bitmap,
+						last - bitmap->start + 1,
+						start - bitmap->start);
+		else
+			bitno = ext2fs_find_next_one_bit(bitmap->bitmap,
+						last - bitmap->start + 1,
+						start - bitmap->start);
+		if (bitno <= last - bitmap->start) {
+			*out = bitno + bitmap->start;
+			return 0;
+		}
+		if (last == end)
+			return ENOENT;
+	}
+}
+
+/*
+ * Find the first set bit between start and end, inclusive.  Returns
+ * ENOENT if there isn't one.
+ */
+errcode_t ext2fs_find_first_set_generic_bitmap(ext2fs_generic_bitmap bitmap,
+					       __u32 start, __u32 end,
+					       __u32 *out)
+{
+	return find_first(bitmap, start, end, 0, out);
+}
+
+/*
+ * Find the first clear bit between start and end, inclusive.  Returns
+ * ENOENT if there isn't one.
+ */
+errcode_t ext2fs_find_first_zero_generic_bitmap(ext2fs_generic_bitmap bitmap,
+						__u32 start, __u32 end,
+						__u32 *out)
+{
+	return find_first(bitmap, start, end, 1, out);
+}
+
+/*
+ * Find the first bit between start and end, inclusive, which differs
+ * between bm1 and bm2.  Returns ENOENT if they are the same over the
+ * whole range.
+ */
+errcode_t ext2fs_find_first_diff_generic_bitmap(ext2fs_generic_bitmap bm1,
+						ext2fs_generic_bitmap bm2,
+						__u32 start, __u32 end,
+						__u32 *out)
+{
+	__u32	bitno, n;
+	__u64	next;
+	int	set1, set2;
+
+	if (!check_range(bm1, start, end, EXT2FS_TEST_ERROR) ||
+	    !check_range(bm2, start, end, EXT2FS_TEST_ERROR))
+		return EXT2_ET_INVALID_ARGUMENT;
+
+	/*
+	 * If the bitmaps can't be compared word by word, skip from
+	 * wherever either bitmap changes to the next such place.
+	 */
+	if ((bm1->type == EXT2FS_BMAP_EXTENT) ||
+	    (bm2->type == EXT2FS_BMAP_EXTENT) ||
+	    (bm1->start != bm2->start)) {
+		for (bitno = start; ; bitno = next) {
+			set1 = !!ext2fs_test_generic_bitmap(bm1, bitno);
+			set2 = !!ext2fs_test_generic_bitmap(bm2, bitno);
+			if (set1 != set2) {
+				*out = bitno;
+				return 0;
+			}
+			next = (__u64) end + 1;
+			if (find_first(bm1, bitno, end, set1, &n) == 0)
+				next = n;
+			if (find_first(bm2, bitno, end, set2, &n) == 0 &&
+			    n < next)
+				next = n;
+			if (next > end)
+				return ENOENT;
+		}
+	}
+	EXT2FS_LAZY_LOAD(bm1, start, end - start + 1);
+	EXT2FS_LAZY_LOAD(bm2, start, end - start + 1);
+	bitno = ext2fs_find_next_diff_bit(bm1->bitmap, bm2->bitmap,
+					  end - bm1->start + 1,
+					  start - bm1->start);
+	if (bitno > end - bm1->start)
+		return ENOENT;
+	*out = bitno + bm1->start;
+	return 0;
+}
+
+/*
+ * Return the number of bits set between start and end, inclusive.
+ */
+__u32 ext2fs_count_generic_bitmap_range(ext2fs_generic_bitmap bitmap,
+					__u32 start, __u32 end)
+{
+	if (!check_range(bitmap, start, end, EXT2FS_TEST_ERROR))
+		return 0;
+
+	if (bitmap->type == EXT2FS_BMAP_EXTENT)
+		return ext2fs_extent_bitmap_count_range(bitmap, start, end);
+	EXT2FS_LAZY_LOAD(bitmap, start, end - start + 1);
+	return ext2fs_count_bit_range(start - bitmap->start,
+				      end - start + 1, bitmap->bitmap);
+}
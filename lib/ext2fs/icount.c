@@ -35,6 +35,15 @@
  * e2fsck's pass 2.  Pass 2 increments inode counts as it finds them,
  * so this extra bitmap avoids searching the sorted list to see if a
  * particular inode is on the sorted list already.
+ *
+ * Inserting into the middle of the sorted list means moving all of
+ * the entries after it, which gets expensive when a large number of
+ * inodes with multiple links are not found in order.  So there are
+ * two alternate backends which can be selected when the icount is
+ * created: EXT2_ICOUNT_OPT_HASH keeps the same entries in an open
+ * addressed hash table instead of a sorted list, and
+ * EXT2_ICOUNT_OPT_FULLMAP simply keeps a 16-bit count for every
+ * inode, which is the fastest but needs two bytes per inode.
  */
 
 struct ext2_icount_el {
@@ -51,8 +60,19 @@ struct ext2_icount {
 	ext2_ino_t		num_inodes;
 	ext2_ino_t		cursor;
 	struct ext2_icount_el	*list;
+	int			flags;
+	int			hash_shift;
+	__u16			*fullmap;
+	ext2_filsys		fs;
 };
 
+/*
+ * Multiplicative hash; the top bits of the product are the best
+ * mixed, so the table index is taken from there.
+ */
+#define ICOUNT_HASH(icount, ino) \
+	((ext2_ino_t) ((ino) * 0x9E3779B1U) >> (icount)->hash_shift)
+
 void ext2fs_free_icount(ext2_icount_t icount)
 {
 	if (!icount)
@@ -60,7 +80,9 @@ void ext2fs_free_icount(ext2_icount_t icount)
 
 	icount->magic = 0;
 	if (icount->list)
-		ext2fs_free_mem(&icount->list);
+		ext2fs_free_scratch_mem(&icount->list);
+	if (icount->fullmap)
+		ext2fs_free_scratch_mem(&icount->fullmap);
 	if (icount->single)
 		ext2fs_free_inode_bitmap(icount->single);
 	if (icount->multiple)
@@ -68,6 +90,59 @@ void ext2fs_free_icount(ext2_icount_t icount)
 	ext2fs_free_mem(&icount);
 }
 
+/*
+ * hash_icount_slot() --- return the hash table slot which holds ino,
+ * 	or the empty slot where it should be inserted.
+ */
+static struct ext2_icount_el *hash_icount_slot(ext2_icount_t icount,
+					       ext2_ino_t ino)
+{
+	ext2_ino_t	mask = icount->size - 1;
+	ext2_ino_t	i = ICOUNT_HASH(icount, ino);
+
+	while (icount->list[i].ino && icount->list[i].ino != ino)
+		i = (i + 1) & mask;
+	return &icount->list[i];
+}
+
+/*
+ * resize_icount_hash() --- (re)allocate the hash table so that it can
+ * 	hold at least entries elements while staying no more than
+ * 	three quarters full, and rehash any existing entries into it.
+ */
+static errcode_t resize_icount_hash(ext2_icount_t icount, ext2_ino_t entries)
+{
+	struct ext2_icount_el	*old_list = icount->list;
+	ext2_ino_t		old_size = icount->size;
+	ext2_ino_t		new_size = 16;
+	ext2_ino_t		i;
+	int			bits = 4;
+	size_t			bytes;
+	errcode_t		retval;
+
+	while (new_size - new_size / 4 < entries) {
+		new_size <<= 1;
+		bits++;
+	}
+	bytes = (size_t) new_size * sizeof(struct ext2_icount_el);
+	retval = ext2fs_get_scratch_mem(icount->fs, bytes, &icount->list);
+	if (retval) {
+		icount->list = old_list;
+		return retval;
+	}
+	memset(icount->list, 0, bytes);
+	icount->size = new_size;
+	icount->hash_shift = 32 - bits;
+
+	if (!old_list)
+		return 0;
+	for (i = 0; i < old_size; i++)
+		if (old_list[i].ino)
+			*hash_icount_slot(icount, old_list[i].ino) = old_list[i];
+	ext2fs_free_scratch_mem(&old_list);
+	return 0;
+}
+
 errcode_t ext2fs_create_icount2(ext2_filsys fs, int flags, unsigned int size,
 				ext2_icount_t hint, ext2_icount_t *ret)
 {
@@ -76,9 +151,12 @@ errcode_t ext2fs_create_icount2(ext2_filsys fs, int flags, unsigned int size,
 	size_t		bytes;
 	ext2_ino_t	i;
 
+	if ((flags & EXT2_ICOUNT_OPT_HASH) && (flags & EXT2_ICOUNT_OPT_FULLMAP))
+		return EXT2_ET_INVALID_ARGUMENT;
+
 	if (hint) {
 		EXT2_CHECK_MAGIC(hint, EXT2_ET_MAGIC_ICOUNT);
-		if (hint->size > size)
+		if (!hint->fullmap && hint->size > size)
 			size = (size_t) hint->size;
 	}
 	
@@ -86,6 +164,25 @@ errcode_t ext2fs_create_icount2(ext2_filsys fs, int flags, unsigned int size,
 	if (retval)
 		return retval;
 	memset(icount, 0, sizeof(struct ext2_icount));
+	icount->flags = flags;
+	icount->num_inodes = fs->super->s_inodes_count;
+	icount->fs = fs;
+
+	if (flags & EXT2_ICOUNT_OPT_FULLMAP) {
+		/*
+		 * Every inode gets its own count, so neither the
+		 * bitmaps nor the list are needed.
+		 */
+		bytes = (size_t) (icount->num_inodes + 1) * sizeof(__u16);
+		retval = ext2fs_get_scratch_mem(fs, bytes, &icount->fullmap);
+		if (retval)
+			goto errout;
+		memset(icount->fullmap, 0, bytes);
+		icount->size = icount->num_inodes;
+		icount->magic = EXT2_ET_MAGIC_ICOUNT;
+		*ret = icount;
+		return 0;
+	}
 
 	retval = ext2fs_allocate_inode_bitmap(fs, 0, 
 					      &icount->single);
@@ -113,13 +210,22 @@ errcode_t ext2fs_create_icount2(ext2_filsys fs, int flags, unsigned int size,
 			goto errout;
 		icount->size += fs->super->s_inodes_count / 50;
 	}
+
+	if (flags & EXT2_ICOUNT_OPT_HASH) {
+		retval = resize_icount_hash(icount, icount->size);
+		if (retval)
+			goto errout;
+		icount->magic = EXT2_ET_MAGIC_ICOUNT;
+		*ret = icount;
+		return 0;
+	}
 	
 	bytes = (size_t) (icount->size * sizeof(struct ext2_icount_el));
 #if 0
 	printf("Icount allocated %d entries, %d bytes.\n",
 	       icount->size, bytes);
 #endif
-	retval = ext2fs_get_mem(bytes, &icount->list);
+	retval = ext2fs_get_scratch_mem(fs, bytes, &icount->list);
 	if (retval)
 		goto errout;
 	memset(icount->list, 0, bytes);
@@ -127,14 +233,13 @@ errcode_t ext2fs_create_icount2(ext2_filsys fs, int flags, unsigned int size,
 	icount->magic = EXT2_ET_MAGIC_ICOUNT;
 	icount->count = 0;
 	icount->cursor = 0;
-	icount->num_inodes = fs->super->s_inodes_count;
 
 	/*
 	 * Populate the sorted list with those entries which were
 	 * found in the hint icount (since those are ones which will
 	 * likely need to be in the sorted list this time around).
 	 */
-	if (hint) {
+	if (hint && !hint->fullmap && !(hint->flags & EXT2_ICOUNT_OPT_HASH)) {
 		for (i=0; i < hint->count; i++)
 			icount->list[i].ino = hint->list[i].ino;
 		icount->count = hint->count;
@@ -178,11 +283,11 @@ static struct ext2_icount_el *insert_icount_el(ext2_icount_t icount,
 #if 0
 		printf("Reallocating icount %d entries...\n", new_size);
 #endif	
-		retval = ext2fs_resize_mem((size_t) icount->size *
-					   sizeof(struct ext2_icount_el),
-					   (size_t) new_size *
-					   sizeof(struct ext2_icount_el),
-					   &icount->list);
+		retval = ext2fs_resize_scratch_mem((size_t) icount->size *
+						sizeof(struct ext2_icount_el),
+						(size_t) new_size *
+						sizeof(struct ext2_icount_el),
+						&icount->list);
 		if (retval)
 			return 0;
 		icount->size = new_size;
@@ -201,6 +306,32 @@ static struct ext2_icount_el *insert_icount_el(ext2_icount_t icount,
 	return el;
 }
 
+/*
+ * get_hash_icount_el() --- the hash table version of get_icount_el()
+ */
+static struct ext2_icount_el *get_hash_icount_el(ext2_icount_t icount,
+						 ext2_ino_t ino, int create)
+{
+	struct ext2_icount_el	*el;
+
+	el = hash_icount_slot(icount, ino);
+	if (el->ino || !create)
+		return el->ino ? el : 0;
+
+	if (icount->count + 1 > icount->size - icount->size / 4) {
+#if 0
+		printf("Rehashing icount %d entries...\n", icount->size * 2);
+#endif
+		if (resize_icount_hash(icount, icount->count + 1))
+			return 0;
+		el = hash_icount_slot(icount, ino);
+	}
+	icount->count++;
+	el->ino = ino;
+	el->count = 0;
+	return el;
+}
+
 /*
  * get_icount_el() --- given an inode number, try to find icount
  * 	information in the sorted list.  If the create flag is set,
@@ -216,6 +347,9 @@ static struct ext2_icount_el *get_icount_el(ext2_icount_t icount,
 	if (!icount || !icount->list)
 		return 0;
 
+	if (icount->flags & EXT2_ICOUNT_OPT_HASH)
+		return get_hash_icount_el(icount, ino, create);
+
 	if (create && ((icount->count == 0) ||
 		       (ino > icount->list[(unsigned)icount->count-1].ino))) {
 		return insert_icount_el(icount, ino, (unsigned) icount->count);
@@ -283,6 +417,22 @@ errcode_t ext2fs_icount_validate(ext2_icount_t icount, FILE *out)
 		fprintf(out, "%s: count > size\n", bad);
 		return EXT2_ET_INVALID_ARGUMENT;
 	}
+	if (icount->fullmap)
+		return 0;
+	if (icount->flags & EXT2_ICOUNT_OPT_HASH) {
+		for (i=0; i < icount->size; i++) {
+			if (!icount->list[i].ino)
+				continue;
+			if (hash_icount_slot(icount, icount->list[i].ino) !=
+			    &icount->list[i]) {
+				fprintf(out, "%s: list[%d].ino=%u misplaced "
+					"in hash table\n", bad, i,
+					icount->list[i].ino);
+				ret = EXT2_ET_INVALID_ARGUMENT;
+			}
+		}
+		return ret;
+	}
 	for (i=1; i < icount->count; i++) {
 		if (icount->list[i-1].ino >= icount->list[i].ino) {
 			fprintf(out, "%s: list[%d].ino=%u, list[%d].ino=%u\n",
@@ -303,6 +453,10 @@ errcode_t ext2fs_icount_fetch(ext2_icount_t icount, ext2_ino_t ino, __u16 *ret)
 	if (!ino || (ino > icount->num_inodes))
 		return EXT2_ET_INVALID_ARGUMENT;
 
+	if (icount->fullmap) {
+		*ret = icount->fullmap[ino];
+		return 0;
+	}
 	if (ext2fs_test_inode_bitmap(icount->single, ino)) {
 		*ret = 1;
 		return 0;
@@ -331,6 +485,12 @@ errcode_t ext2fs_icount_increment(ext2_icount_t icount, ext2_ino_t ino,
 	if (!ino || (ino > icount->num_inodes))
 		return EXT2_ET_INVALID_ARGUMENT;
 
+	if (icount->fullmap) {
+		icount->fullmap[ino]++;
+		if (ret)
+			*ret = icount->fullmap[ino];
+		return 0;
+	}
 	if (ext2fs_test_inode_bitmap(icount->single, ino)) {
 		/*
 		 * If the existing count is 1, then we know there is
@@ -396,6 +556,14 @@ errcode_t ext2fs_icount_decrement(ext2_icount_t icount, ext2_ino_t ino,
 
 	EXT2_CHECK_MAGIC(icount, EXT2_ET_MAGIC_ICOUNT);
 
+	if (icount->fullmap) {
+		if (!icount->fullmap[ino])
+			return EXT2_ET_INVALID_ARGUMENT;
+		icount->fullmap[ino]--;
+		if (ret)
+			*ret = icount->fullmap[ino];
+		return 0;
+	}
 	if (ext2fs_test_inode_bitmap(icount->single, ino)) {
 		ext2fs_unmark_inode_bitmap(icount->single, ino);
 		if (icount->multiple)
@@ -439,6 +607,10 @@ errcode_t ext2fs_icount_store(ext2_icount_t icount, ext2_ino_t ino,
 
 	EXT2_CHECK_MAGIC(icount, EXT2_ET_MAGIC_ICOUNT);
 
+	if (icount->fullmap) {
+		icount->fullmap[ino] = count;
+		return 0;
+	}
 	if (count == 1) {
 		ext2fs_mark_inode_bitmap(icount->single, ino);
 		if (icount->multiple)
@@ -287,6 +287,9 @@ errcode_t ext2fs_image_bitmap_write(ext2_filsys fs, int fd, int flags)
 			if (retval)
 				return retval;
 		}
+		retval = ext2fs_lazy_bitmap_load_all(fs->inode_map);
+		if (retval)
+			return retval;
 		ptr = fs->inode_map->bitmap;
 		size = (EXT2_INODES_PER_GROUP(fs->super) / 8);
 	} else {
@@ -295,6 +298,9 @@ errcode_t ext2fs_image_bitmap_write(ext2_filsys fs, int fd, int flags)
 			if (retval)
 				return retval;
 		}
+		retval = ext2fs_lazy_bitmap_load_all(fs->block_map);
+		if (retval)
+			return retval;
 		ptr = fs->block_map->bitmap;
 		size = EXT2_BLOCKS_PER_GROUP(fs->super) / 8;
 	}
@@ -351,6 +357,9 @@ errcode_t ext2fs_image_bitmap_read(ext2_filsys fs, int fd, int flags)
 			if (retval)
 				return retval;
 		}
+		retval = ext2fs_lazy_bitmap_load_all(fs->inode_map);
+		if (retval)
+			return retval;
 		ptr = fs->inode_map->bitmap;
 		size = (EXT2_INODES_PER_GROUP(fs->super) / 8);
 	} else {
@@ -359,6 +368,9 @@ errcode_t ext2fs_image_bitmap_read(ext2_filsys fs, int fd, int flags)
 			if (retval)
 				return retval;
 		}
+		retval = ext2fs_lazy_bitmap_load_all(fs->block_map);
+		if (retval)
+			return retval;
 		ptr = fs->block_map->bitmap;
 		size = EXT2_BLOCKS_PER_GROUP(fs->super) / 8;
 	}
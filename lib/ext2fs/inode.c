@@ -50,9 +50,17 @@ struct ext2_struct_inode_scan {
 	void *			done_group_data;
 	int			bad_block_ptr;
 	int			scan_flags;
-	int			reserved[6];
+	blk_t			readahead_block;
+	dgrp_t			readahead_group;
+	int			reserved[4];
 };
 
+/*
+ * Number of inode_buffer_blocks-sized chunks of the inode table that
+ * we try to keep in flight ahead of the current scan position.
+ */
+#define INODE_SCAN_READAHEAD	4
+
 /*
  * This routine flushes the icache, if it exists.
  */
@@ -302,6 +310,69 @@ static errcode_t check_for_inode_bad_blocks(ext2_inode_scan scan,
 	return 0;
 }
 
+/*
+ * This function is called by get_next_blocks() to ask the I/O
+ * channel to start reading the next few chunks of the current
+ * blockgroup's inode table, so that the disk can be busy while our
+ * caller is processing the inodes in the chunk we just read.
+ *
+ * Once the rest of the current blockgroup's inode table has been
+ * requested, start on the beginning of the next blockgroup's inode
+ * table, so that moving on to the next group doesn't stall either.
+ * readahead_group and readahead_block record how far ahead we have
+ * already asked for.
+ */
+static void readahead_inode_blocks(ext2_inode_scan scan)
+{
+	ext2_filsys	fs = scan->fs;
+	blk_t		table_end, end, window;
+	dgrp_t		next;
+
+	if (scan->readahead_group == scan->current_group + 1)
+		return;
+	table_end = scan->current_block + scan->blocks_left;
+	if (scan->readahead_group != scan->current_group ||
+	    scan->readahead_block < scan->current_block ||
+	    scan->readahead_block > table_end) {
+		scan->readahead_group = scan->current_group;
+		scan->readahead_block = scan->current_block;
+	}
+	if (!scan->current_block)
+		return;
+
+	window = INODE_SCAN_READAHEAD * scan->inode_buffer_blocks;
+	if (scan->readahead_block < table_end) {
+		end = table_end;
+		if (end > scan->current_block + window)
+			end = scan->current_block + window;
+		/*
+		 * Don't bother issuing a request until there is at
+		 * least a full chunk which hasn't been asked for.
+		 */
+		if (end - scan->readahead_block < scan->inode_buffer_blocks &&
+		    end < table_end)
+			return;
+		io_channel_readahead(fs->io, scan->readahead_block,
+				     (int) (end - scan->readahead_block));
+		scan->readahead_block = end;
+		return;
+	}
+
+	if (scan->groups_left <= 0)
+		return;
+	next = scan->current_group + 1;
+	scan->readahead_group = next;
+	scan->readahead_block = fs->group_desc[next].bg_inode_table;
+	if (!scan->readahead_block ||
+	    ((scan->scan_flags & EXT2_SF_DO_LAZY) &&
+	     (fs->group_desc[next].bg_flags & EXT2_BG_INODE_UNINIT)))
+		return;
+	if (window > fs->inode_blocks_per_group)
+		window = fs->inode_blocks_per_group;
+	io_channel_readahead(fs->io, scan->readahead_block, (int) window);
+	scan->readahead_block += window;
+}
+
 /*
  * This function is called by ext2fs_get_next_inode when it needs to
  * read in more blocks from the current blockgroup's inode table.
@@ -357,6 +428,7 @@ static errcode_t get_next_blocks(ext2_inode_scan scan)
 	scan->blocks_left -= num_blocks;
 	if (scan->current_block)
 		scan->current_block += num_blocks;
+	readahead_inode_blocks(scan);
 	return 0;
 }
 
@@ -67,3 +67,29 @@ errcode_t io_channel_write_byte(io_channel channel, unsigned long offset,
 
 	return EXT2_ET_UNIMPLEMENTED;
 }
+
+/*
+ * Hint to the I/O manager that the specified blocks will be read in
+ * the near future, so it can start fetching them in the background.
+ */
+errcode_t io_channel_readahead(io_channel channel, unsigned long block,
+			       int count)
+{
+	EXT2_CHECK_MAGIC(channel, EXT2_ET_MAGIC_IO_CHANNEL);
+
+	if (channel->manager->readahead)
+		return channel->manager->readahead(channel, block, count);
+
+	return EXT2_ET_UNIMPLEMENTED;
+}
+
+errcode_t io_channel_zeroout(io_channel channel, unsigned long block,
+			     unsigned long count)
+{
+	EXT2_CHECK_MAGIC(channel, EXT2_ET_MAGIC_IO_CHANNEL);
+
+	if (channel->manager->zeroout)
+		return channel->manager->zeroout(channel, block, count);
+
+	return EXT2_ET_UNIMPLEMENTED;
+}
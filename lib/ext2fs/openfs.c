@@ -26,7 +26,7 @@
 #include "ext2_fs.h"
 
 
-#include "ext2fs.h"
+#include "ext2fsP.h"
 #include "e2image.h"
 
 blk_t ext2fs_descriptor_block_loc(ext2_filsys fs, blk_t group_block, dgrp_t i)
@@ -287,6 +287,13 @@ errcode_t ext2fs_open2(const char *name, const char *io_options,
 		dest += fs->blocksize;
 	}
 
+	/*
+	 * If we were opened using the primary superblock, the backups
+	 * are assumed to match what we just read.
+	 */
+	if ((fs->flags & EXT2_FLAG_DEFER_BACKUPS) && fs->orig_super)
+		ext2fs_snapshot_backups(fs);
+
 	*ret_fs = fs;
 	return 0;
 cleanup:
@@ -322,6 +329,8 @@ errcode_t ext2fs_rewrite_to_io(ext2_filsys fs, io_channel new_io)
 	if ((fs->flags & EXT2_FLAG_IMAGE_FILE) == 0)
 		return EXT2_ET_NOT_IMAGE_FILE;
 	fs->io = fs->image_io = new_io;
+	if (fs->backup_desc)
+		ext2fs_free_mem(&fs->backup_desc);
 	fs->flags |= EXT2_FLAG_DIRTY | EXT2_FLAG_RW | 
 		EXT2_FLAG_BB_DIRTY | EXT2_FLAG_IB_DIRTY;
 	fs->flags &= ~EXT2_FLAG_IMAGE_FILE;
@@ -42,6 +42,27 @@ errcode_t ext2fs_resize_generic_bitmap(__u32 new_end, __u32 new_real_end,
 	 * If we're expanding the bitmap, make sure all of the new
 	 * parts of the bitmap are zero.
 	 */
+	if (bmap->type == EXT2FS_BMAP_EXTENT) {
+		/*
+		 * Clear the padding which is becoming part of the
+		 * bitmap, and anything beyond the new real end.
+		 */
+		if (new_end > bmap->end)
+			ext2fs_extent_bitmap_unmark_range(bmap, bmap->end+1,
+							  new_end - bmap->end);
+		if (new_real_end < bmap->real_end)
+			ext2fs_extent_bitmap_unmark_range(bmap,
+					new_real_end+1,
+					bmap->real_end - new_real_end);
+		bmap->end = new_end;
+		bmap->real_end = new_real_end;
+		return 0;
+	}
+
+	retval = ext2fs_lazy_bitmap_load_all(bmap);
+	if (retval)
+		return retval;
+
 	if (new_end > bmap->end) {
 		bitno = bmap->real_end;
 		if (bitno > new_end)
@@ -51,15 +51,144 @@ static void ext2fs_swap_bitmap(ext2_filsys fs, char *bitmap, int nbytes)
 }
 #endif
 
+/*
+ * The bitmap blocks of all of the groups are read and written in
+ * order of their location on disk, and runs of adjacent bitmap blocks
+ * (such as a group's block and inode bitmaps, which are normally next
+ * to each other) are transferred with a single request.
+ */
+#define BITMAP_IO_MAX		64	/* Max blocks in a single request */
+#define BITMAP_READAHEAD	256	/* Bitmap blocks to keep read ahead */
+
+struct bitmap_io {
+	blk_t	blk;
+	dgrp_t	group;
+	int	is_inode;	/* Inode bitmap, rather than block bitmap */
+	char	*bitmap;	/* This group's part of the in-memory bitmap */
+};
+
+static EXT2_QSORT_TYPE bitmap_io_cmp(const void *a, const void *b)
+{
+	const struct bitmap_io *io_a = (const struct bitmap_io *) a;
+	const struct bitmap_io *io_b = (const struct bitmap_io *) b;
+
+	if (io_a->blk < io_b->blk)
+		return -1;
+	return (io_a->blk > io_b->blk);
+}
+
+/*
+ * Return the number of entries, starting with list[i], whose blocks
+ * are adjacent on disk and can be transferred together.
+ */
+static int bitmap_io_run(struct bitmap_io *list, int i, int num)
+{
+	int	n;
+
+	for (n = 1; i + n < num && n < BITMAP_IO_MAX; n++)
+		if (list[i+n].blk != list[i].blk + n)
+			break;
+	return n;
+}
+
+/*
+ * Read in the groups of a lazily loaded bitmap which hold any of the
+ * num bits starting at bitno, and which haven't been read in yet.
+ */
+errcode_t ext2fs_lazy_bitmap_load(ext2fs_generic_bitmap bitmap,
+				  __u32 bitno, __u32 num)
+{
+	ext2_filsys	fs = bitmap->fs;
+	dgrp_t		group, last;
+	__u32		per_group;
+	int		is_inode, nbytes, uninit_flag;
+	blk_t		blk;
+	char		*cp;
+	errcode_t	retval = 0;
+
+	if (!bitmap->lazy_groups || !num ||
+	    bitno < bitmap->start || bitno > bitmap->real_end)
+		return 0;
+	if (num - 1 > bitmap->real_end - bitno)
+		num = bitmap->real_end - bitno + 1;
+
+	is_inode = (bitmap->magic == EXT2_ET_MAGIC_INODE_BITMAP);
+	if (is_inode) {
+		per_group = EXT2_INODES_PER_GROUP(fs->super);
+		uninit_flag = EXT2_BG_INODE_UNINIT;
+	} else {
+		per_group = EXT2_BLOCKS_PER_GROUP(fs->super);
+		uninit_flag = EXT2_BG_BLOCK_UNINIT;
+	}
+	nbytes = per_group / 8;
+	group = (bitno - bitmap->start) / per_group;
+	last = (bitno - bitmap->start + num - 1) / per_group;
+
+	for (; group <= last; group++) {
+		if (ext2fs_test_bit(group, bitmap->lazy_groups))
+			continue;
+		cp = bitmap->bitmap + group * nbytes;
+		if (is_inode)
+			blk = fs->group_desc[group].bg_inode_bitmap;
+		else
+			blk = fs->group_desc[group].bg_block_bitmap;
+		if (EXT2_HAS_COMPAT_FEATURE(fs->super,
+					    EXT2_FEATURE_COMPAT_LAZY_BG) &&
+		    (fs->group_desc[group].bg_flags & uninit_flag))
+			blk = 0;
+		if (!blk)
+			memset(cp, 0xff, nbytes);
+		else if (io_channel_read_blk(fs->io, blk, -nbytes, cp)) {
+			/*
+			 * Leave the group marked as not read in, so that
+			 * it won't be written back over what's on disk.
+			 */
+			memset(cp, 0xff, nbytes);
+			retval = is_inode ? EXT2_ET_INODE_BITMAP_READ :
+				EXT2_ET_BLOCK_BITMAP_READ;
+			ext2fs_warn_bitmap(retval, group, bitmap->description);
+			continue;
+		}
+#ifdef EXT2_BIG_ENDIAN_BITMAPS
+		else if (!((fs->flags & EXT2_FLAG_SWAP_BYTES) ||
+			   (fs->flags & EXT2_FLAG_SWAP_BYTES_READ)))
+			ext2fs_swap_bitmap(fs, cp, nbytes);
+#endif
+		ext2fs_set_bit(group, bitmap->lazy_groups);
+	}
+	return retval;
+}
+
+/*
+ * Read in all of a lazily loaded bitmap, for callers which are about
+ * to use bitmap->bitmap directly.
+ */
+errcode_t ext2fs_lazy_bitmap_load_all(ext2fs_generic_bitmap bitmap)
+{
+	errcode_t	retval;
+
+	if (!bitmap || !bitmap->lazy_groups)
+		return 0;
+	retval = ext2fs_lazy_bitmap_load(bitmap, bitmap->start,
+					 bitmap->real_end - bitmap->start + 1);
+	if (retval)
+		return retval;
+	ext2fs_free_mem(&bitmap->lazy_groups);
+	return 0;
+}
+
 static errcode_t write_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 {
 	dgrp_t 		i;
 	unsigned int	j;
 	int		block_nbytes, inode_nbytes;
 	unsigned int	nbits;
-	errcode_t	retval;
+	errcode_t	retval = 0;
 	char 		*block_bitmap, *inode_bitmap;
-	char 		*block_buf, *inode_buf;
+	char		*block_loaded = 0, *inode_loaded = 0;
+	char		*io_buf = 0, *cp;
+	struct bitmap_io *list = 0, *ent;
+	int		num, n, m, k;
 	int		lazy_flag = 0;
 	blk_t		blk;
 
@@ -74,101 +203,120 @@ static errcode_t write_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 	block_bitmap = inode_bitmap = 0;
 	if (do_block) {
 		block_bitmap = fs->block_map->bitmap;
+		block_loaded = fs->block_map->lazy_groups;
 		//blockռöֽ
 		block_nbytes = EXT2_BLOCKS_PER_GROUP(fs->super) / 8;
-		retval = ext2fs_get_mem(fs->blocksize, &block_buf);
-		if (retval)
-			return retval;
-		memset(block_buf, 0xff, fs->blocksize);
 	}
 	if (do_inode) {
 		inode_bitmap = fs->inode_map->bitmap;
+		inode_loaded = fs->inode_map->lazy_groups;
 		inode_nbytes = (size_t) 
 			((EXT2_INODES_PER_GROUP(fs->super)+7) / 8);
-		retval = ext2fs_get_mem(fs->blocksize, &inode_buf);
-		if (retval)
-			return retval;
-		memset(inode_buf, 0xff, fs->blocksize);
 	}
 
+	retval = ext2fs_get_mem(2 * fs->group_desc_count *
+				sizeof(struct bitmap_io), &list);
+	if (retval)
+		return retval;
+	num = 0;
 	for (i = 0; i < fs->group_desc_count; i++) {
-		if (!block_bitmap || !do_block)
-			goto skip_block_bitmap;
-
-		if (lazy_flag && fs->group_desc[i].bg_flags &
-		    EXT2_BG_BLOCK_UNINIT) 
-			goto skip_this_block_bitmap;
- 
-		//blockûռһblock
-		memcpy(block_buf, block_bitmap, block_nbytes);
-		if (i == fs->group_desc_count - 1) {
-			//һgroup
-			/* Force bitmap padding for the last group */
-			nbits = ((fs->super->s_blocks_count
-				  - fs->super->s_first_data_block)
-				 % EXT2_BLOCKS_PER_GROUP(fs->super));
-			if (nbits)
-				//һgroupĸs_blocks_per_group
-				for (j = nbits; j < fs->blocksize * 8; j++)
-					//bitmapжs_blocks_per_groupǲȫλ
-					ext2fs_set_bit(j, block_buf);
+		/*
+		 * Groups of a lazily loaded bitmap which were never read
+		 * in can't have changed, so they are left alone.
+		 */
+		if (block_bitmap) {
+			blk = fs->group_desc[i].bg_block_bitmap;
+			if (lazy_flag && fs->group_desc[i].bg_flags &
+			    EXT2_BG_BLOCK_UNINIT)
+				blk = 0;
+			if (block_loaded && !ext2fs_test_bit(i, block_loaded))
+				blk = 0;
+			if (blk) {
+				ent = list + num++;
+				ent->blk = blk;
+				ent->group = i;
+				ent->is_inode = 0;
+				ent->bitmap = block_bitmap;
+			}
+			block_bitmap += block_nbytes;
 		}
-		blk = fs->group_desc[i].bg_block_bitmap;
-		if (blk) {
-#if 0
-#ifdef EXT2_BIG_ENDIAN_BITMAPS
-			if (!((fs->flags & EXT2_FLAG_SWAP_BYTES) ||
-			      (fs->flags & EXT2_FLAG_SWAP_BYTES_WRITE)))
-				ext2fs_swap_bitmap(fs, block_buf, 
-						   block_nbytes);
-#endif
-#endif
-			//дblock bitmap
-			retval = io_channel_write_blk(fs->io, blk, 1,
-						      block_buf);
-			if (retval)
-				return EXT2_ET_BLOCK_BITMAP_WRITE;
+		if (inode_bitmap) {
+			blk = fs->group_desc[i].bg_inode_bitmap;
+			if (lazy_flag && fs->group_desc[i].bg_flags &
+			    EXT2_BG_INODE_UNINIT)
+				blk = 0;
+			if (inode_loaded && !ext2fs_test_bit(i, inode_loaded))
+				blk = 0;
+			if (blk) {
+				ent = list + num++;
+				ent->blk = blk;
+				ent->group = i;
+				ent->is_inode = 1;
+				ent->bitmap = inode_bitmap;
+			}
+			inode_bitmap += inode_nbytes;
 		}
-	skip_this_block_bitmap:
-		block_bitmap += block_nbytes;
-	skip_block_bitmap:
+	}
+	qsort(list, num, sizeof(struct bitmap_io), bitmap_io_cmp);
 
-		if (!inode_bitmap || !do_inode)
-			continue;
+	if (num) {
+		retval = ext2fs_get_mem(fs->blocksize *
+					(num < BITMAP_IO_MAX ?
+					 num : BITMAP_IO_MAX), &io_buf);
+		if (retval)
+			goto errout;
+	}
 
-		if (lazy_flag && fs->group_desc[i].bg_flags &
-		    EXT2_BG_INODE_UNINIT) 
-			goto skip_this_inode_bitmap;
- 
-		memcpy(inode_buf, inode_bitmap, inode_nbytes);
-		blk = fs->group_desc[i].bg_inode_bitmap;
-		if (blk) {
+	for (k = 0; k < num; k += n) {
+		n = bitmap_io_run(list, k, num);
+		for (m = 0, ent = list + k; m < n; m++, ent++) {
+			cp = io_buf + m * fs->blocksize;
+			memset(cp, 0xff, fs->blocksize);
+			if (ent->is_inode) {
+				memcpy(cp, ent->bitmap, inode_nbytes);
 #ifdef EXT2_BIG_ENDIAN_BITMAPS
-			if (!((fs->flags & EXT2_FLAG_SWAP_BYTES) ||
-			      (fs->flags & EXT2_FLAG_SWAP_BYTES_WRITE)))
-				ext2fs_swap_bitmap(fs, inode_buf, 
-						   inode_nbytes);
+				if (!((fs->flags & EXT2_FLAG_SWAP_BYTES) ||
+				      (fs->flags & EXT2_FLAG_SWAP_BYTES_WRITE)))
+					ext2fs_swap_bitmap(fs, cp,
+							   inode_nbytes);
 #endif
-			retval = io_channel_write_blk(fs->io, blk, 1,
-						      inode_buf);
-			if (retval)
-				return EXT2_ET_INODE_BITMAP_WRITE;
+				continue;
+			}
+			memcpy(cp, ent->bitmap, block_nbytes);
+			if (ent->group == fs->group_desc_count - 1) {
+				//һgroup
+				/* Force bitmap padding for the last group */
+				nbits = ((fs->super->s_blocks_count
+					  - fs->super->s_first_data_block)
+					 % EXT2_BLOCKS_PER_GROUP(fs->super));
+				if (nbits)
+					//һgroupĸs_blocks_per_group
+					for (j = nbits; j < fs->blocksize * 8;
+					     j++)
+						//bitmapжs_blocks_per_groupǲȫλ
+						ext2fs_set_bit(j, cp);
+			}
+		}
+		retval = io_channel_write_blk(fs->io, list[k].blk, n, io_buf);
+		if (retval) {
+			retval = list[k].is_inode ? EXT2_ET_INODE_BITMAP_WRITE :
+				EXT2_ET_BLOCK_BITMAP_WRITE;
+			goto errout;
 		}
-	skip_this_inode_bitmap:
-		inode_bitmap += inode_nbytes;
-
 	}
 	if (do_block) {
 		//block bitmap clean
 		fs->flags &= ~EXT2_FLAG_BB_DIRTY;
-		ext2fs_free_mem(&block_buf);
 	}
 	if (do_inode) {
 		//inode bitmap clean
 		fs->flags &= ~EXT2_FLAG_IB_DIRTY;
-		ext2fs_free_mem(&inode_buf);
 	}
-	return 0;
+errout:
+	if (io_buf)
+		ext2fs_free_mem(&io_buf);
+	ext2fs_free_mem(&list);
+	return retval;
 }
 
 static errcode_t read_bitmaps(ext2_filsys fs, int do_inode, int do_block)
@@ -181,6 +329,9 @@ static errcode_t read_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 	int inode_nbytes = (int) EXT2_INODES_PER_GROUP(fs->super) / 8;
 	int lazy_flag = 0;
 	blk_t	blk;
+	char	*io_buf = 0, *cp;
+	struct bitmap_io *list = 0, *ent;
+	int	num, n, m, k, ra, nbytes;
 
 	EXT2_CHECK_MAGIC(fs, EXT2_ET_MAGIC_EXT2FS_FILSYS);
 
@@ -235,6 +386,34 @@ static errcode_t read_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 		return 0;
 	}
 
+	/*
+	 * With EXT2_FLAG_LAZY_BITMAPS, nothing is read now; each group
+	 * is read in by ext2fs_lazy_bitmap_load() when it is first used.
+	 */
+	if (fs->flags & EXT2_FLAG_LAZY_BITMAPS) {
+		nbytes = (fs->group_desc_count + 7) / 8;
+		if (block_bitmap) {
+			retval = ext2fs_get_mem(nbytes,
+						&fs->block_map->lazy_groups);
+			if (retval)
+				goto cleanup;
+			memset(fs->block_map->lazy_groups, 0, nbytes);
+		}
+		if (inode_bitmap) {
+			retval = ext2fs_get_mem(nbytes,
+						&fs->inode_map->lazy_groups);
+			if (retval)
+				goto cleanup;
+			memset(fs->inode_map->lazy_groups, 0, nbytes);
+		}
+		return 0;
+	}
+
+	retval = ext2fs_get_mem(2 * fs->group_desc_count *
+				sizeof(struct bitmap_io), &list);
+	if (retval)
+		goto cleanup;
+	num = 0;
 	for (i = 0; i < fs->group_desc_count; i++) {
 		if (block_bitmap) {
 			blk = fs->group_desc[i].bg_block_bitmap;
@@ -242,17 +421,11 @@ static errcode_t read_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 			    EXT2_BG_BLOCK_UNINIT)
 				blk = 0;
 			if (blk) {
-				retval = io_channel_read_blk(fs->io, blk,
-					     -block_nbytes, block_bitmap);
-				if (retval) {
-					retval = EXT2_ET_BLOCK_BITMAP_READ;
-					goto cleanup;
-				}
-#ifdef EXT2_BIG_ENDIAN_BITMAPS
-				if (!((fs->flags & EXT2_FLAG_SWAP_BYTES) ||
-				      (fs->flags & EXT2_FLAG_SWAP_BYTES_READ)))
-					ext2fs_swap_bitmap(fs, block_bitmap, block_nbytes);
-#endif
+				ent = list + num++;
+				ent->blk = blk;
+				ent->group = i;
+				ent->is_inode = 0;
+				ent->bitmap = block_bitmap;
 			} else
 				memset(block_bitmap, 0xff, block_nbytes);
 			block_bitmap += block_nbytes;
@@ -263,22 +436,59 @@ static errcode_t read_bitmaps(ext2_filsys fs, int do_inode, int do_block)
 			    EXT2_BG_INODE_UNINIT)
 				blk = 0;
 			if (blk) {
-				retval = io_channel_read_blk(fs->io, blk,
-					     -inode_nbytes, inode_bitmap);
-				if (retval) {
-					retval = EXT2_ET_INODE_BITMAP_READ;
-					goto cleanup;
-				}
-#ifdef EXT2_BIG_ENDIAN_BITMAPS
-				if (!((fs->flags & EXT2_FLAG_SWAP_BYTES) ||
-				      (fs->flags & EXT2_FLAG_SWAP_BYTES_READ)))
-					ext2fs_swap_bitmap(fs, inode_bitmap, inode_nbytes);
-#endif
+				ent = list + num++;
+				ent->blk = blk;
+				ent->group = i;
+				ent->is_inode = 1;
+				ent->bitmap = inode_bitmap;
 			} else
 				memset(inode_bitmap, 0xff, inode_nbytes);
 			inode_bitmap += inode_nbytes;
 		}
 	}
+	qsort(list, num, sizeof(struct bitmap_io), bitmap_io_cmp);
+
+	if (num) {
+		retval = ext2fs_get_mem(fs->blocksize *
+					(num < BITMAP_IO_MAX ?
+					 num : BITMAP_IO_MAX), &io_buf);
+		if (retval)
+			goto cleanup;
+	}
+
+	/*
+	 * Read the bitmaps in runs of adjacent blocks, keeping the
+	 * next few runs read ahead while waiting for each one.
+	 */
+	for (k = ra = 0; k < num; k += n) {
+		n = bitmap_io_run(list, k, num);
+		if (ra < k + n)
+			ra = k + n;
+		while (ra < num && ra < k + BITMAP_READAHEAD) {
+			m = bitmap_io_run(list, ra, num);
+			io_channel_readahead(fs->io, list[ra].blk, m);
+			ra += m;
+		}
+		retval = io_channel_read_blk(fs->io, list[k].blk,
+					     -(n * fs->blocksize), io_buf);
+		if (retval) {
+			retval = list[k].is_inode ? EXT2_ET_INODE_BITMAP_READ :
+				EXT2_ET_BLOCK_BITMAP_READ;
+			goto cleanup;
+		}
+		for (m = 0, ent = list + k; m < n; m++, ent++) {
+			cp = io_buf + m * fs->blocksize;
+			nbytes = ent->is_inode ? inode_nbytes : block_nbytes;
+			memcpy(ent->bitmap, cp, nbytes);
+#ifdef EXT2_BIG_ENDIAN_BITMAPS
+			if (!((fs->flags & EXT2_FLAG_SWAP_BYTES) ||
+			      (fs->flags & EXT2_FLAG_SWAP_BYTES_READ)))
+				ext2fs_swap_bitmap(fs, ent->bitmap, nbytes);
+#endif
+		}
+	}
+	ext2fs_free_mem(&io_buf);
+	ext2fs_free_mem(&list);
 	return 0;
 	
 cleanup:
@@ -292,6 +502,10 @@ cleanup:
 	}
 	if (buf)
 		ext2fs_free_mem(&buf);
+	if (io_buf)
+		ext2fs_free_mem(&io_buf);
+	if (list)
+		ext2fs_free_mem(&list);
 	return retval;
 }
 
@@ -0,0 +1,232 @@
+/*
+ * scratch.c --- memory for large tables which may be backed by a
+ * 	file in a scratch directory instead of anonymous memory.
+ *
+ * When a scratch directory has been set with ext2fs_set_scratch_dir(),
+ * each scratch area is a shared mapping of an unlinked temporary file
+ * in that directory.  The kernel can then write its pages back to the
+ * file and drop them when memory is tight, instead of needing swap
+ * space, at the cost of some disk I/O.  Without a scratch directory
+ * (or without mmap), scratch areas are just malloc'ed memory.
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ */
+
+#include <stdio.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#include <stdlib.h>
+#include <fcntl.h>
+#if HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#include "ext2_fs.h"
+#include "ext2fs.h"
+
+/*
+ * Every scratch area starts with this header, so that it can be
+ * resized and freed without the caller having to know how it was
+ * allocated.  fd is -1 for areas which are plain malloc'ed memory.
+ * The header is padded so that the caller's data stays aligned.
+ */
+struct scratch_hdr {
+	unsigned long	size;
+	int		fd;
+};
+
+#define SCRATCH_HDR_SIZE	16
+
+/*
+ * File-backed areas are grown in units of this many bytes, so that a
+ * caller which grows its table a few entries at a time doesn't have
+ * to remap the file each time.
+ */
+#define SCRATCH_CHUNK		(256 * 1024)
+
+#define SCRATCH_DATA(hdr)	((void *) ((char *) (hdr) + SCRATCH_HDR_SIZE))
+#define SCRATCH_HDR(p)		((struct scratch_hdr *) \
+				 ((char *) (p) - SCRATCH_HDR_SIZE))
+
+errcode_t ext2fs_set_scratch_dir(ext2_filsys fs, const char *dir)
+{
+	errcode_t	retval;
+
+	EXT2_CHECK_MAGIC(fs, EXT2_ET_MAGIC_EXT2FS_FILSYS);
+
+	if (fs->scratch_dir)
+		ext2fs_free_mem(&fs->scratch_dir);
+	if (!dir)
+		return 0;
+#ifdef HAVE_MMAP
+	if (access(dir, W_OK) < 0)
+		return errno;
+	retval = ext2fs_get_mem(strlen(dir)+1, &fs->scratch_dir);
+	if (retval)
+		return retval;
+	strcpy(fs->scratch_dir, dir);
+	return 0;
+#else
+	return EXT2_ET_UNIMPLEMENTED;
+#endif
+}
+
+#ifdef HAVE_MMAP
+/*
+ * Create an unlinked temporary file in the scratch directory, so that
+ * it goes away by itself however the program exits.
+ */
+static int open_scratch_file(const char *dir)
+{
+	char	*fn;
+	int	fd, save_errno;
+
+	if (ext2fs_get_mem(strlen(dir) + 32, &fn))
+		return -1;
+	sprintf(fn, "%s/ext2fs-scratch.XXXXXX", dir);
+	fd = mkstemp(fn);
+	if (fd >= 0)
+		unlink(fn);
+	save_errno = errno;
+	ext2fs_free_mem(&fn);
+	errno = save_errno;
+	return fd;
+}
+
+static unsigned long scratch_round(unsigned long size)
+{
+	return (size + SCRATCH_CHUNK - 1) &
+		~((unsigned long) SCRATCH_CHUNK - 1);
+}
+#endif
+
+/*
+ * Allocate a scratch area of size bytes.  Like ext2fs_get_mem(), the
+ * contents are not initialized.
+ */
+errcode_t ext2fs_get_scratch_mem(ext2_filsys fs, unsigned long size,
+				 void *ptr)
+{
+	struct scratch_hdr	*hdr;
+	errcode_t		retval;
+	void			*p;
+	int			fd = -1;
+
+	size += SCRATCH_HDR_SIZE;
+#ifdef HAVE_MMAP
+	if (fs && fs->scratch_dir) {
+		size = scratch_round(size);
+		fd = open_scratch_file(fs->scratch_dir);
+		if (fd < 0)
+			return errno;
+		if (ftruncate(fd, size) < 0) {
+			retval = errno;
+			close(fd);
+			return retval;
+		}
+		p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			retval = errno;
+			close(fd);
+			return retval;
+		}
+		hdr = p;
+	} else
+#endif
+	{
+		retval = ext2fs_get_mem(size, &hdr);
+		if (retval)
+			return retval;
+	}
+	hdr->size = size;
+	hdr->fd = fd;
+	p = SCRATCH_DATA(hdr);
+	memcpy(ptr, &p, sizeof(p));
+	return 0;
+}
+
+/*
+ * Resize a scratch area, which must have been allocated by
+ * ext2fs_get_scratch_mem().  The old_size parameter is ignored; it is
+ * there so that this can be used in the same way as
+ * ext2fs_resize_mem().
+ */
+errcode_t ext2fs_resize_scratch_mem(unsigned long EXT2FS_ATTR((unused)) old_size,
+				    unsigned long size, void *ptr)
+{
+	struct scratch_hdr	*hdr;
+	errcode_t		retval;
+	void			*p;
+
+	memcpy(&p, ptr, sizeof(p));
+	hdr = SCRATCH_HDR(p);
+	size += SCRATCH_HDR_SIZE;
+
+	if (hdr->fd < 0) {
+		retval = ext2fs_resize_mem(hdr->size, size, &hdr);
+		if (retval)
+			return retval;
+		hdr->size = size;
+	}
+#ifdef HAVE_MMAP
+	else {
+		unsigned long		mapped = hdr->size;
+		int			fd = hdr->fd;
+
+		size = scratch_round(size);
+		if (size == mapped)
+			return 0;
+		if (size > mapped && ftruncate(fd, size) < 0)
+			return errno;
+		p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED)
+			return errno;
+		munmap(hdr, mapped);
+		if (size < mapped)
+			(void) ftruncate(fd, size);
+		hdr = p;
+		hdr->size = size;
+	}
+#endif
+	p = SCRATCH_DATA(hdr);
+	memcpy(ptr, &p, sizeof(p));
+	return 0;
+}
+
+/*
+ * Free a scratch area
+ */
+errcode_t ext2fs_free_scratch_mem(void *ptr)
+{
+	struct scratch_hdr	*hdr;
+	void			*p;
+
+	memcpy(&p, ptr, sizeof(p));
+	if (!p)
+		return 0;
+	hdr = SCRATCH_HDR(p);
+	if (hdr->fd < 0)
+		ext2fs_free_mem(&hdr);
+#ifdef HAVE_MMAP
+	else {
+		int	fd = hdr->fd;
+
+		munmap(hdr, hdr->size);
+		close(fd);
+	}
+#endif
+	p = 0;
+	memcpy(ptr, &p, sizeof(p));
+	return 0;
+}
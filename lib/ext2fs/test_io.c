@@ -66,6 +66,10 @@ static errcode_t test_write_byte(io_channel channel, unsigned long offset,
 				 int count, const void *buf);
 static errcode_t test_set_option(io_channel channel, const char *option, 
 				 const char *arg);
+static errcode_t test_readahead(io_channel channel, unsigned long block,
+				int count);
+static errcode_t test_zeroout(io_channel channel, unsigned long block,
+			      unsigned long count);
 
 static struct struct_io_manager struct_test_manager = {
 	EXT2_ET_MAGIC_IO_MANAGER,
@@ -77,7 +81,9 @@ static struct struct_io_manager struct_test_manager = {
 	test_write_blk,
 	test_flush,
 	test_write_byte,
-	test_set_option
+	test_set_option,
+	test_readahead,
+	test_zeroout
 };
 
 io_manager test_io_manager = &struct_test_manager;
@@ -409,3 +415,36 @@ static errcode_t test_set_option(io_channel channel, const char *option,
 	}
 	return retval;
 }
+
+static errcode_t test_readahead(io_channel channel, unsigned long block,
+				int count)
+{
+	struct test_private_data *data;
+
+	EXT2_CHECK_MAGIC(channel, EXT2_ET_MAGIC_IO_CHANNEL);
+	data = (struct test_private_data *) channel->private_data;
+	EXT2_CHECK_MAGIC(data, EXT2_ET_MAGIC_TEST_IO_CHANNEL);
+
+	if (data->real)
+		return io_channel_readahead(data->real, block, count);
+	return EXT2_ET_UNIMPLEMENTED;
+}
+
+static errcode_t test_zeroout(io_channel channel, unsigned long block,
+			      unsigned long count)
+{
+	struct test_private_data *data;
+	errcode_t	retval = EXT2_ET_UNIMPLEMENTED;
+
+	EXT2_CHECK_MAGIC(channel, EXT2_ET_MAGIC_IO_CHANNEL);
+	data = (struct test_private_data *) channel->private_data;
+	EXT2_CHECK_MAGIC(data, EXT2_ET_MAGIC_TEST_IO_CHANNEL);
+
+	if (data->real)
+		retval = io_channel_zeroout(data->real, block, count);
+	if (data->flags & TEST_FLAG_WRITE)
+		fprintf(data->outfile,
+			"Test_io: zeroout(%lu, %lu) returned %s\n",
+			block, count, retval ? error_message(retval) : "OK");
+	return retval;
+}
@@ -37,6 +37,96 @@ int bits_list[] = {
 
 #define BIG_TEST_BIT   (((unsigned) 1 << 31) + 42)
 
+#define RANGE_TEST_BITS	1000
+
+/*
+ * Check the bit range functions against the single bit versions, for
+ * ranges starting and ending at every alignment.
+ */
+static int test_bit_ranges(void)
+{
+	unsigned char	a[RANGE_TEST_BITS / 8 + 16], b[RANGE_TEST_BITS / 8 + 16];
+	unsigned int	start, len, i, count, expect, size;
+	unsigned char	*ua = a + 1, *ub = b + 1;
+
+	srandom(1);
+	for (start = 0; start < 80; start++) {
+		for (len = 0; len < RANGE_TEST_BITS - start; len += 1 + len / 4) {
+			for (i = 0; i < sizeof(a); i++)
+				a[i] = b[i] = random();
+			ext2fs_set_bit_range(start, len, ua);
+			for (i = start; i < start + len; i++)
+				ext2fs_set_bit(i, ub);
+			if (memcmp(a, b, sizeof(a))) {
+				printf("ext2fs_set_bit_range(%u, %u) failed\n",
+				       start, len);
+				return 1;
+			}
+			ext2fs_clear_bit_range(start, len, ua);
+			for (i = start; i < start + len; i++)
+				ext2fs_clear_bit(i, ub);
+			if (memcmp(a, b, sizeof(a))) {
+				printf("ext2fs_clear_bit_range(%u, %u) "
+				       "failed\n", start, len);
+				return 1;
+			}
+
+			/* Mostly empty arrays, for odd starts */
+			for (i = 0; i < sizeof(a); i++)
+				a[i] = b[i] = (start & 1) ? 0 :
+					random() & random();
+			if (start & 1) {
+				i = random() % RANGE_TEST_BITS;
+				ext2fs_set_bit(i, ua);
+				ext2fs_set_bit(i, ub);
+			}
+			for (i = 0, expect = 0; i < len; i++)
+				if (ext2fs_test_bit(start + i, ua))
+					expect++;
+			count = ext2fs_count_bit_range(start, len, ua);
+			if (count != expect) {
+				printf("ext2fs_count_bit_range(%u, %u) "
+				       "returned %u, expected %u\n",
+				       start, len, count, expect);
+				return 1;
+			}
+
+			size = start + len;
+			for (i = start; i < size; i++)
+				if (ext2fs_test_bit(i, ua))
+					break;
+			if (ext2fs_find_next_one_bit(ua, size, start) != i) {
+				printf("ext2fs_find_next_one_bit(%u, %u) "
+				       "failed\n", size, start);
+				return 1;
+			}
+			for (i = start; i < size; i++)
+				if (!ext2fs_test_bit(i, ua))
+					break;
+			if (ext2fs_find_next_zero_bit(ua, size, start) != i) {
+				printf("ext2fs_find_next_zero_bit(%u, %u) "
+				       "failed\n", size, start);
+				return 1;
+			}
+			if (len)
+				ext2fs_fast_clear_bit(size - 1 - random() % len,
+						      ub);
+			for (i = start; i < size; i++)
+				if (!ext2fs_test_bit(i, ua) !=
+				    !ext2fs_test_bit(i, ub))
+					break;
+			if (ext2fs_find_next_diff_bit(ua, ub, size,
+						      start) != i) {
+				printf("ext2fs_find_next_diff_bit(%u, %u) "
+				       "failed\n", size, start);
+				return 1;
+			}
+		}
+	}
+	printf("ext2fs bit range tests succeeded.\n");
+	return 0;
+}
+
 
 main(int argc, char **argv)
 {
@@ -169,5 +259,8 @@ main(int argc, char **argv)
 
 	printf("ext2fs_fast_set_bit big_test successful\n");
 
+	if (test_bit_ranges())
+		exit(1);
+
 	exit(0);
 }
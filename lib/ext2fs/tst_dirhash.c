@@ -0,0 +1,149 @@
+/*
+ * tst_dirhash.c --- check that ext2fs_dirhash_many() gives the same
+ * 	results as ext2fs_dirhash(), and optionally time them both.
+ *
+ * Usage: tst_dirhash [count]
+ *
+ * If count is given, hash count random names with each function for
+ * every hash version, and print how long it took.
+ *
+ * %Begin-Header%
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ * %End-Header%
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <sys/time.h>
+
+#include "ext2_fs.h"
+#include "ext2fs.h"
+
+#define NUM_NAMES	4096
+
+static char	*names[NUM_NAMES];
+static int	lens[NUM_NAMES];
+
+static const char *version_names[] = { "legacy", "half_md4", "tea" };
+
+static __u32 test_seed[4] = { 0x87654321, 0x12345678, 0xdeadbeef, 0x1 };
+
+/*
+ * Make up names of every length from 0 to 255, mostly short, as they
+ * would be in a real directory.
+ */
+static void make_names(void)
+{
+	int	i, j, len;
+
+	srandom(42);
+	for (i = 0; i < NUM_NAMES; i++) {
+		if (i < 256)
+			len = i;
+		else if (random() % 8)
+			len = 1 + random() % 24;
+		else
+			len = 1 + random() % 255;
+		names[i] = malloc(len + 1);
+		if (!names[i]) {
+			fprintf(stderr, "Couldn't allocate names\n");
+			exit(1);
+		}
+		for (j = 0; j < len; j++)
+			names[i][j] = 1 + random() % 255;
+		names[i][len] = 0;
+		lens[i] = len;
+	}
+}
+
+static int check_version(int version, const __u32 *seed)
+{
+	ext2_dirhash_t	hashes[NUM_NAMES], minor_hashes[NUM_NAMES];
+	ext2_dirhash_t	hash, minor_hash;
+	errcode_t	retval;
+	int		i, failed = 0;
+
+	retval = ext2fs_dirhash_many(version, NUM_NAMES,
+				     (const char * const *) names, lens,
+				     seed, hashes, minor_hashes);
+	if (retval) {
+		com_err("ext2fs_dirhash_many", retval, "for %s",
+			version_names[version]);
+		return 1;
+	}
+	for (i = 0; i < NUM_NAMES; i++) {
+		ext2fs_dirhash(version, names[i], lens[i], seed,
+			       &hash, &minor_hash);
+		if (hash != hashes[i] || minor_hash != minor_hashes[i]) {
+			printf("%s hash of name %d (length %d) is %08x:%08x, "
+			       "should be %08x:%08x\n", version_names[version],
+			       i, lens[i], hashes[i], minor_hashes[i],
+			       hash, minor_hash);
+			failed++;
+		}
+	}
+	return failed;
+}
+
+static double time_diff(struct timeval *start)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, 0);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void benchmark(int count)
+{
+	ext2_dirhash_t	hashes[NUM_NAMES], minor_hashes[NUM_NAMES];
+	struct timeval	start;
+	int		version, i, j;
+
+	for (version = EXT2_HASH_LEGACY; version <= EXT2_HASH_TEA;
+	     version++) {
+		gettimeofday(&start, 0);
+		for (i = 0; i < count; i += NUM_NAMES)
+			for (j = 0; j < NUM_NAMES; j++)
+				ext2fs_dirhash(version, names[j], lens[j],
+					       test_seed, &hashes[j],
+					       &minor_hashes[j]);
+		printf("%-8s ext2fs_dirhash:      %.3f seconds\n",
+		       version_names[version], time_diff(&start));
+
+		gettimeofday(&start, 0);
+		for (i = 0; i < count; i += NUM_NAMES)
+			ext2fs_dirhash_many(version, NUM_NAMES,
+					    (const char * const *) names,
+					    lens, test_seed, hashes,
+					    minor_hashes);
+		printf("%-8s ext2fs_dirhash_many: %.3f seconds\n",
+		       version_names[version], time_diff(&start));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int	version, failed = 0;
+
+	make_names();
+	for (version = EXT2_HASH_LEGACY; version <= EXT2_HASH_TEA;
+	     version++) {
+		failed += check_version(version, 0);
+		failed += check_version(version, test_seed);
+	}
+	if (failed) {
+		printf("ext2fs_dirhash_many: %d tests failed.\n", failed);
+		exit(1);
+	}
+	printf("ext2fs_dirhash_many: all tests passed.\n");
+
+	if (argc > 1)
+		benchmark(atoi(argv[1]));
+	return 0;
+}
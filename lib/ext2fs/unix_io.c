@@ -2,7 +2,8 @@
  * unix_io.c --- This is the Unix (well, really POSIX) implementation
  * 	of the I/O manager.
  *
- * Implements a one-block write-through cache.
+ * Implements a hashed block cache with LRU replacement.  The size of
+ * the cache may be changed using the "cache_size" option.
  *
  * Includes support for Windows NT support under Cygwin. 
  *
@@ -28,6 +29,7 @@
 #endif
 #include <fcntl.h>
 #include <time.h>
+#include <limits.h>
 #ifdef __linux__
 #include <sys/utsname.h>
 #endif
@@ -40,6 +42,9 @@
 #if HAVE_SYS_RESOURCE_H
 #include <sys/resource.h>
 #endif
+#ifdef HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif
 
 #include "ext2_fs.h"
 #include "ext2fs.h"
@@ -54,22 +59,37 @@
 struct unix_cache {
 	char		*buf;
 	unsigned long	block;
-	int		access_time;
+	struct unix_cache *hash_next;
+	struct unix_cache *lru_prev, *lru_next;
 	unsigned	dirty:1;
 	unsigned	in_use:1;
 };
 
-#define CACHE_SIZE 8
+#define CACHE_SIZE 8		/* Default (and minimum) number of blocks */
 #define WRITE_DIRECT_SIZE 4	/* Must be smaller than CACHE_SIZE */
 #define READ_DIRECT_SIZE 4	/* Should be smaller than CACHE_SIZE */
+#define FLUSH_COALESCE_SIZE 64	/* Max blocks written by a single flush I/O */
+#define READAHEAD_SIZE 1024	/* Default max blocks in a readahead request */
 
 struct unix_private_data {
 	int	magic;
 	int	dev;
 	int	flags;
-	int	access_time;
 	ext2_loff_t offset;
-	struct unix_cache cache[CACHE_SIZE];
+	int	cache_size;		/* Number of cache entries */
+	unsigned long cache_bytes;	/* Requested cache size in bytes */
+	int	readahead_max;		/* Max readahead blocks, 0 disables */
+	int	hash_mask;
+	struct unix_cache *cache;
+	struct unix_cache **hash;
+	struct unix_cache **flush_list;
+	char	*cache_buf;
+	char	*flush_buf;
+	/*
+	 * Head of the LRU list.  lru.lru_next is the most recently
+	 * used entry; lru.lru_prev is the next one to be reused.
+	 */
+	struct unix_cache lru;
 };
 
 static errcode_t unix_open(const char *name, int flags, io_channel *channel);
@@ -84,6 +104,10 @@ static errcode_t unix_write_byte(io_channel channel, unsigned long offset,
 				int size, const void *data);
 static errcode_t unix_set_option(io_channel channel, const char *option, 
 				 const char *arg);
+static errcode_t unix_readahead(io_channel channel, unsigned long block,
+				int count);
+static errcode_t unix_zeroout(io_channel channel, unsigned long block,
+			      unsigned long count);
 
 static void reuse_cache(io_channel channel, struct unix_private_data *data,
 		 struct unix_cache *cache, unsigned long block);
@@ -110,7 +134,9 @@ static struct struct_io_manager struct_unix_manager = {
 #else
 	unix_write_byte,
 #endif
-	unix_set_option
+	unix_set_option,
+	unix_readahead,
+	unix_zeroout
 };
 
 io_manager unix_io_manager = &struct_unix_manager;
@@ -250,46 +276,152 @@ error_out:
  * Here we implement the cache functions
  */
 
-/* Allocate the cache buffers */
-static errcode_t alloc_cache(io_channel channel,
-			     struct unix_private_data *data)
+/* Free the cache buffers */
+static void free_cache(struct unix_private_data *data)
+{
+	if (data->cache)
+		ext2fs_free_mem(&data->cache);
+	if (data->hash)
+		ext2fs_free_mem(&data->hash);
+	if (data->flush_list)
+		ext2fs_free_mem(&data->flush_list);
+	if (data->cache_buf)
+		ext2fs_free_mem(&data->cache_buf);
+	if (data->flush_buf)
+		ext2fs_free_mem(&data->flush_buf);
+	data->lru.lru_next = data->lru.lru_prev = &data->lru;
+}
+
+/*
+ * Allocate the cache buffers for a cache of cache_size blocks (or of
+ * cache_bytes bytes, if that is non-zero) of block_size bytes each.
+ * The new cache replaces the old one only once it has all been
+ * allocated, so that on failure the old cache is left as it was.
+ */
+static errcode_t alloc_cache(struct unix_private_data *data, int block_size,
+			     unsigned long cache_size,
+			     unsigned long cache_bytes)
 {
 	errcode_t		retval;
-	struct unix_cache	*cache;
-	int			i;
-	
-	data->access_time = 0;
-	for (i=0, cache = data->cache; i < CACHE_SIZE; i++, cache++) {
-		cache->block = 0;
-		cache->access_time = 0;
-		cache->dirty = 0;
-		cache->in_use = 0;
-		if ((retval = ext2fs_get_mem(channel->block_size,
-					     &cache->buf)))
-			return retval;
+	struct unix_cache	*cache = 0, **hash = 0, **flush_list = 0;
+	char			*cache_buf = 0, *flush_buf = 0;
+	size_t			i, hash_size;
+
+	if (cache_bytes)
+		cache_size = cache_bytes / block_size;
+	if (cache_size < CACHE_SIZE)
+		cache_size = CACHE_SIZE;
+	/* Refuse caches whose size in bytes can't be represented */
+	if (cache_size > (INT_MAX >> 1) ||
+	    cache_size > ((size_t) -1) / block_size ||
+	    cache_size > ((size_t) -1) / sizeof(struct unix_cache))
+		return EXT2_ET_INVALID_ARGUMENT;
+	for (hash_size = CACHE_SIZE; hash_size < cache_size; hash_size <<= 1)
+		;
+
+	retval = ext2fs_get_mem(cache_size * sizeof(struct unix_cache),
+				&cache);
+	if (retval)
+		goto errout;
+	memset(cache, 0, cache_size * sizeof(struct unix_cache));
+	retval = ext2fs_get_mem(hash_size * sizeof(struct unix_cache *),
+				&hash);
+	if (retval)
+		goto errout;
+	memset(hash, 0, hash_size * sizeof(struct unix_cache *));
+	retval = ext2fs_get_mem(cache_size * sizeof(struct unix_cache *),
+				&flush_list);
+	if (retval)
+		goto errout;
+	retval = ext2fs_get_mem(cache_size * (size_t) block_size, &cache_buf);
+	if (retval)
+		goto errout;
+	retval = ext2fs_get_mem(FLUSH_COALESCE_SIZE * (size_t) block_size,
+				&flush_buf);
+	if (retval)
+		goto errout;
+
+	free_cache(data);
+	data->cache = cache;
+	data->hash = hash;
+	data->flush_list = flush_list;
+	data->cache_buf = cache_buf;
+	data->flush_buf = flush_buf;
+	data->cache_size = cache_size;
+	data->cache_bytes = cache_bytes;
+	data->hash_mask = hash_size - 1;
+
+	for (i=0; i < cache_size; i++, cache++) {
+		cache->buf = cache_buf + i * block_size;
+		cache->lru_prev = data->lru.lru_prev;
+		cache->lru_next = &data->lru;
+		data->lru.lru_prev->lru_next = cache;
+		data->lru.lru_prev = cache;
 	}
 	return 0;
+
+errout:
+	if (cache)
+		ext2fs_free_mem(&cache);
+	if (hash)
+		ext2fs_free_mem(&hash);
+	if (flush_list)
+		ext2fs_free_mem(&flush_list);
+	if (cache_buf)
+		ext2fs_free_mem(&cache_buf);
+	return retval;
 }
 
-/* Free the cache buffers */
-static void free_cache(struct unix_private_data *data)
+#ifndef NO_IO_CACHE
+/*
+ * Helper functions to maintain the hash chains and the LRU list
+ */
+#define CACHE_HASH(data, block)	((data)->hash[(block) & (data)->hash_mask])
+
+static void unhash_cache(struct unix_private_data *data,
+			 struct unix_cache *cache)
 {
-	struct unix_cache	*cache;
-	int			i;
-	
-	data->access_time = 0;
-	for (i=0, cache = data->cache; i < CACHE_SIZE; i++, cache++) {
-		cache->block = 0;
-		cache->access_time = 0;
-		cache->dirty = 0;
-		cache->in_use = 0;
-		if (cache->buf)
-			ext2fs_free_mem(&cache->buf);
-		cache->buf = 0;
+	struct unix_cache	**pp;
+
+	for (pp = &CACHE_HASH(data, cache->block); *pp;
+	     pp = &(*pp)->hash_next) {
+		if (*pp == cache) {
+			*pp = cache->hash_next;
+			break;
+		}
 	}
+	cache->hash_next = 0;
+}
+
+static void lru_move(struct unix_private_data *data,
+		     struct unix_cache *cache, int to_head)
+{
+	struct unix_cache	*prev, *next;
+
+	cache->lru_prev->lru_next = cache->lru_next;
+	cache->lru_next->lru_prev = cache->lru_prev;
+	if (to_head) {
+		prev = &data->lru;
+		next = data->lru.lru_next;
+	} else {
+		prev = data->lru.lru_prev;
+		next = &data->lru;
+	}
+	cache->lru_prev = prev;
+	cache->lru_next = next;
+	prev->lru_next = cache;
+	next->lru_prev = cache;
+}
+
+static void invalidate_cache(struct unix_private_data *data,
+			     struct unix_cache *cache)
+{
+	unhash_cache(data, cache);
+	cache->in_use = 0;
+	cache->dirty = 0;
+	lru_move(data, cache, 0);
 }
 
-#ifndef NO_IO_CACHE
 /*
  * Try to find a block in the cache.  If the block is not found, and
  * eldest is a non-zero pointer, then fill in eldest with the cache
@@ -299,36 +431,17 @@ static struct unix_cache *find_cached_block(struct unix_private_data *data,
 					    unsigned long block,
 					    struct unix_cache **eldest)
 {
-    /*
-     * oldest_cache¼类ʹõcache,cacheҪ
-    */
-	struct unix_cache	*cache, *unused_cache, *oldest_cache;
-	int			i;
-	
-	unused_cache = oldest_cache = 0;
-	for (i=0, cache = data->cache; i < CACHE_SIZE; i++, cache++) {
-		if (!cache->in_use) {
-			if (!unused_cache)
-                //ҵδʹõcache
-				unused_cache = cache;
-			continue;
-		}
+	struct unix_cache	*cache;
+
+	for (cache = CACHE_HASH(data, block); cache;
+	     cache = cache->hash_next) {
 		if (cache->block == block) {
-            /* 
-             * cacheеblockͲblockͬ,cache->access_time
-             * ʹԼӺdata->access_time,ʾcacheҪٴα
-             */
-			cache->access_time = ++data->access_time;
+			lru_move(data, cache, 1);
 			return cache;
 		}
-		if (!oldest_cache ||
-		    (cache->access_time < oldest_cache->access_time))
-            //oldest_cacheʼָ类ʹõcache
-			oldest_cache = cache;
 	}
 	if (eldest)
-        //δʹõcacheȷunused_cache,򷵻ضcache
-		*eldest = (unused_cache) ? unused_cache : oldest_cache;
+		*eldest = data->lru.lru_prev;
 	return 0;
 }
 
@@ -338,45 +451,104 @@ static struct unix_cache *find_cached_block(struct unix_private_data *data,
 static void reuse_cache(io_channel channel, struct unix_private_data *data,
 		 struct unix_cache *cache, unsigned long block)
 {
-	if (cache->dirty && cache->in_use)
-        //cacheеݸµ
-		raw_write_blk(channel, data, cache->block, 1, cache->buf);
+	if (cache->in_use) {
+		if (cache->dirty)
+			raw_write_blk(channel, data, cache->block, 1,
+				      cache->buf);
+		unhash_cache(data, cache);
+	}
 
 	cache->in_use = 1;
 	cache->dirty = 0;
 	cache->block = block;
-	cache->access_time = ++data->access_time;
+	cache->hash_next = CACHE_HASH(data, block);
+	CACHE_HASH(data, block) = cache;
+	lru_move(data, cache, 1);
 }
 
 /*
- * Flush all of the blocks in the cache
+ * Drop any cached copies of the blocks in the specified range.
+ * Dirty blocks must have been written out already.
+ */
+static void invalidate_cached_range(struct unix_private_data *data,
+				    unsigned long block, unsigned long count)
+{
+	struct unix_cache	*cache;
+	int			i;
+
+	if (count < (unsigned long) data->cache_size) {
+		for (; count > 0; count--, block++)
+			if ((cache = find_cached_block(data, block, 0)))
+				invalidate_cache(data, cache);
+		return;
+	}
+	for (i=0, cache = data->cache; i < data->cache_size; i++, cache++) {
+		if (cache->in_use && cache->block >= block &&
+		    cache->block - block < count)
+			invalidate_cache(data, cache);
+	}
+}
+
+static EXT2_QSORT_TYPE cache_block_cmp(const void *a, const void *b)
+{
+	const struct unix_cache *ca = *(const struct unix_cache * const *) a;
+	const struct unix_cache *cb = *(const struct unix_cache * const *) b;
+
+	if (ca->block < cb->block)
+		return -1;
+	return (ca->block > cb->block);
+}
+
+/*
+ * Flush all of the blocks in the cache.  The dirty blocks are sorted
+ * so that runs of adjacent blocks can be written using a single I/O.
  */
 static errcode_t flush_cached_blocks(io_channel channel,
 				     struct unix_private_data *data,
 				     int invalidate)
 
 {
-	struct unix_cache	*cache;
+	struct unix_cache	*cache, **list = data->flush_list;
 	errcode_t		retval, retval2;
-	int			i;
+	int			i, j, k, num_dirty = 0;
+	char			*cp;
 
 	retval2 = 0;
-	for (i=0, cache = data->cache; i < CACHE_SIZE; i++, cache++) {
-		if (!cache->in_use)
-            continue;
+	for (i=0, cache = data->cache; i < data->cache_size; i++, cache++) {
+		if (cache->in_use && cache->dirty)
+			list[num_dirty++] = cache;
+	}
+	if (num_dirty > 1)
+		qsort(list, num_dirty, sizeof(struct unix_cache *),
+		      cache_block_cmp);
 
-		if (invalidate)
-			cache->in_use = 0;
-		
-		if (!cache->dirty)
-			continue;
-		
-		retval = raw_write_blk(channel, data,
-				       cache->block, 1, cache->buf);
-		if (retval)
+	for (i = 0; i < num_dirty; i = j) {
+		for (j = i+1; j < num_dirty && j - i < FLUSH_COALESCE_SIZE; j++)
+			if (list[j]->block != list[j-1]->block + 1)
+				break;
+		if (j - i == 1)
+			cp = list[i]->buf;
+		else {
+			cp = data->flush_buf;
+			for (k = i; k < j; k++)
+				memcpy(cp + (k - i) * channel->block_size,
+				       list[k]->buf, channel->block_size);
+		}
+		retval = raw_write_blk(channel, data, list[i]->block,
+				       j - i, cp);
+		if (retval) {
 			retval2 = retval;
-		else
-			cache->dirty = 0;
+			continue;
+		}
+		while (i < j)
+			list[i++]->dirty = 0;
+	}
+
+	if (invalidate) {
+		for (i=0, cache = data->cache; i < data->cache_size;
+		     i++, cache++)
+			if (cache->in_use)
+				invalidate_cache(data, cache);
 	}
 	return retval2;
 }
@@ -419,8 +591,9 @@ static errcode_t unix_open(const char *name, int flags, io_channel *channel)
 
 	memset(data, 0, sizeof(struct unix_private_data));
 	data->magic = EXT2_ET_MAGIC_UNIX_IO_CHANNEL;
+	data->readahead_max = READAHEAD_SIZE;
 
-	if ((retval = alloc_cache(io, data)))
+	if ((retval = alloc_cache(data, io->block_size, 0, 0)))
 		goto cleanup;
 
 	open_flags = (flags & IO_FLAG_RW) ? O_RDWR : O_RDONLY;
@@ -525,11 +698,13 @@ static errcode_t unix_set_blksize(io_channel channel, int blksize)
 		if ((retval = flush_cached_blocks(channel, data, 0)))
 			return retval;
 #endif
-		
-		channel->block_size = blksize;
-		free_cache(data);
-		if ((retval = alloc_cache(channel, data)))
+
+		retval = alloc_cache(data, blksize,
+				     data->cache_bytes ? 0 : data->cache_size,
+				     data->cache_bytes);
+		if (retval)
 			return retval;
+		channel->block_size = blksize;
 	}
 	return 0;
 }
@@ -539,7 +714,7 @@ static errcode_t unix_read_blk(io_channel channel, unsigned long block,
 			       int count, void *buf)
 {
 	struct unix_private_data *data;
-	struct unix_cache *cache, *reuse[READ_DIRECT_SIZE];
+	struct unix_cache *cache;
 	errcode_t	retval;
 	char		*cp;
 	int		i, j;
@@ -564,7 +739,7 @@ static errcode_t unix_read_blk(io_channel channel, unsigned long block,
 	cp = buf;
 	while (count > 0) {
 		/* If it's in the cache, use it! */
-		if ((cache = find_cached_block(data, block, &reuse[0]))) {
+		if ((cache = find_cached_block(data, block, 0))) {
 #ifdef DEBUG
 			printf("Using cached block %d\n", block);
 #endif
@@ -579,7 +754,7 @@ static errcode_t unix_read_blk(io_channel channel, unsigned long block,
 		 * single read request
 		 */
 		for (i=1; i < count; i++)
-			if (find_cached_block(data, block+i, &reuse[i]))
+			if (find_cached_block(data, block+i, 0))
 				break;
 #ifdef DEBUG
 		printf("Reading %d blocks starting at %d\n", i, block);
@@ -587,10 +762,13 @@ static errcode_t unix_read_blk(io_channel channel, unsigned long block,
 		if ((retval = raw_read_blk(channel, data, block, i, cp)))
 			return retval;
 		
-		/* Save the results in the cache */
+		/*
+		 * Save the results in the cache, reusing the least
+		 * recently used entries
+		 */
 		for (j=0; j < i; j++) {
 			count--;
-			cache = reuse[j];
+			cache = data->lru.lru_prev;
 			reuse_cache(channel, data, cache, block++);
 			memcpy(cache->buf, cp, channel->block_size);
 			cp += channel->block_size;
@@ -619,11 +797,15 @@ static errcode_t unix_write_blk(io_channel channel, unsigned long block,
 #else
 	/*
 	 * If we're doing an odd-sized write or a very large write,
-	 * flush out the cache completely and then do a direct write.
+	 * flush out the cache and drop any cached copies of the
+	 * blocks being written, and then do a direct write.
 	 */
 	if (count < 0 || count > WRITE_DIRECT_SIZE) {
-        if ((retval = flush_cached_blocks(channel, data, 1))) 
+		if ((retval = flush_cached_blocks(channel, data, 0)))
 			return retval;
+		invalidate_cached_range(data, block, (count < 0) ?
+			(-count + channel->block_size - 1) /
+					channel->block_size : count);
 		return raw_write_blk(channel, data, block, count, buf);
 	}
 
@@ -708,6 +890,8 @@ static errcode_t unix_set_option(io_channel channel, const char *option,
 	struct unix_private_data *data;
 	unsigned long tmp;
 	char *end;
+	int shift = 0;
+	errcode_t retval;
 
 	EXT2_CHECK_MAGIC(channel, EXT2_ET_MAGIC_IO_CHANNEL);
 	data = (struct unix_private_data *) channel->private_data;
@@ -723,5 +907,133 @@ static errcode_t unix_set_option(io_channel channel, const char *option,
 		data->offset = tmp;
 		return 0;
 	}
+	/*
+	 * The cache size is given as a number of blocks, or as a
+	 * number of bytes if it is followed by a K, M, or G suffix.
+	 */
+	if (!strcmp(option, "cache_size")) {
+		if (!arg)
+			return EXT2_ET_INVALID_ARGUMENT;
+
+		tmp = strtoul(arg, &end, 0);
+		switch (*end) {
+		case 'G': case 'g':
+			shift += 10;
+			/* fallthrough */
+		case 'M': case 'm':
+			shift += 10;
+			/* fallthrough */
+		case 'K': case 'k':
+			shift += 10;
+			end++;
+		}
+		if (*end || tmp == 0 || tmp > (~0UL >> shift))
+			return EXT2_ET_INVALID_ARGUMENT;
+		tmp <<= shift;
+#ifndef NO_IO_CACHE
+		if ((retval = flush_cached_blocks(channel, data, 0)))
+			return retval;
+#endif
+		return alloc_cache(data, channel->block_size,
+				   shift ? 0 : tmp, shift ? tmp : 0);
+	}
+	/*
+	 * Limit the number of blocks which will be requested by a
+	 * single readahead hint; zero disables readahead.
+	 */
+	if (!strcmp(option, "readahead")) {
+		if (!arg)
+			return EXT2_ET_INVALID_ARGUMENT;
+
+		tmp = strtoul(arg, &end, 0);
+		if (*end || tmp > INT_MAX)
+			return EXT2_ET_INVALID_ARGUMENT;
+		data->readahead_max = tmp;
+		return 0;
+	}
 	return EXT2_ET_INVALID_ARGUMENT;
 }
+
+/*
+ * Tell the kernel that we will be reading these blocks soon, so it
+ * can start reading them into the page cache while we are busy doing
+ * something else.
+ */
+static errcode_t unix_readahead(io_channel channel, unsigned long block,
+				int count)
+{
+	struct unix_private_data *data;
+#ifdef POSIX_FADV_WILLNEED
+	ext2_loff_t	location;
+#endif
+
+	EXT2_CHECK_MAGIC(channel, EXT2_ET_MAGIC_IO_CHANNEL);
+	data = (struct unix_private_data *) channel->private_data;
+	EXT2_CHECK_MAGIC(data, EXT2_ET_MAGIC_UNIX_IO_CHANNEL);
+
+	if (data->readahead_max == 0 || count <= 0)
+		return 0;
+	if (count > data->readahead_max)
+		count = data->readahead_max;
+
+#ifdef POSIX_FADV_WILLNEED
+	location = ((ext2_loff_t) block * channel->block_size) + data->offset;
+#ifdef HAVE_OPEN64
+	if (posix_fadvise64(data->dev, location,
+			    (ext2_loff_t) count * channel->block_size,
+			    POSIX_FADV_WILLNEED))
+#else
+	if (posix_fadvise(data->dev, location,
+			  (ext2_loff_t) count * channel->block_size,
+			  POSIX_FADV_WILLNEED))
+#endif
+		return EXT2_ET_UNIMPLEMENTED;
+	return 0;
+#else
+	return EXT2_ET_UNIMPLEMENTED;
+#endif
+}
+
+#if defined(__linux__) && defined(_IO) && !defined(BLKZEROOUT)
+#define BLKZEROOUT	_IO(0x12,127)	/* zero out a range of the device */
+#endif
+
+/*
+ * Have the device zero out count blocks starting at block.  This can
+ * be much faster than writing zeros, since the device may simply
+ * discard the blocks if it reads discarded blocks back as zeros.
+ * Only block devices which support BLKZEROOUT can do this; for
+ * anything else, the caller has to write the zeros itself.
+ */
+static errcode_t unix_zeroout(io_channel channel, unsigned long block,
+			      unsigned long count)
+{
+	struct unix_private_data *data;
+#ifdef BLKZEROOUT
+	struct stat	st;
+	__u64		range[2];
+	errcode_t	retval;
+#endif
+
+	EXT2_CHECK_MAGIC(channel, EXT2_ET_MAGIC_IO_CHANNEL);
+	data = (struct unix_private_data *) channel->private_data;
+	EXT2_CHECK_MAGIC(data, EXT2_ET_MAGIC_UNIX_IO_CHANNEL);
+
+#ifdef BLKZEROOUT
+	if (fstat(data->dev, &st) < 0 || !S_ISBLK(st.st_mode))
+		return EXT2_ET_UNIMPLEMENTED;
+
+#ifndef NO_IO_CACHE
+	if ((retval = flush_cached_blocks(channel, data, 0)))
+		return retval;
+	invalidate_cached_range(data, block, count);
+#endif
+	range[0] = ((__u64) block * channel->block_size) + data->offset;
+	range[1] = (__u64) count * channel->block_size;
+	if (ioctl(data->dev, BLKZEROOUT, range) < 0)
+		return errno;
+	return 0;
+#else
+	return EXT2_ET_UNIMPLEMENTED;
+#endif
+}
@@ -49,6 +49,7 @@ extern int optind;
 
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 #include "et/com_err.h"
 #include "ext2fs/ext2_io.h"
@@ -69,14 +70,17 @@ static int t_max = 0;			/* allocated test patterns */
 static unsigned long *t_patts = NULL;	/* test patterns */
 static int current_O_DIRECT = 0;	/* Current status of O_DIRECT flag */
 static int exclusive_ok = 0;
+static int num_regions = 1;		/* number of regions to test at once */
+static int region_fd = -1;		/* pipe to parent when testing a region */
 
 #define T_INC 32
+#define MAX_REGIONS 64		/* Most child processes for -r */
 
 int sys_page_size = 4096;
 
 static void usage(void)
 {
-	fprintf(stderr, _("Usage: %s [-b block_size] [-i input_file] [-o output_file] [-svwnf]\n [-c blocks_at_once] [-p num_passes] [-t test_pattern [-t test_pattern [...]]]\n device [last_block [start_block]]\n"),
+	fprintf(stderr, _("Usage: %s [-b block_size] [-i input_file] [-o output_file] [-svwnf]\n [-c blocks_at_once] [-p num_passes] [-r num_regions]\n [-t test_pattern [-t test_pattern [...]]]\n device [last_block [start_block]]\n"),
 		 program_name);
 	exit (1);
 }
@@ -122,8 +126,21 @@ static int bb_output (unsigned long bad)
 	if (ext2fs_badblocks_list_test(bb_list, bad))
 		return 0;
 
-	fprintf(out, "%lu\n", bad);
-	fflush(out);
+	if (region_fd >= 0) {
+		ssize_t	got;
+
+		do {
+			got = write(region_fd, &bad, sizeof(bad));
+		} while (got < 0 && errno == EINTR);
+		if (got != sizeof(bad)) {
+			com_err(program_name, got < 0 ? errno : 0,
+				_("while reporting bad block %lu"), bad);
+			_exit(1);
+		}
+	} else {
+		fprintf(out, "%lu\n", bad);
+		fflush(out);
+	}
 
 	errcode = ext2fs_badblocks_list_add (bb_list, bad);
 	if (errcode) {
@@ -353,7 +370,9 @@ static unsigned int test_ro (int dev, unsigned long last_block,
 		     last_block);
 	}
 	if (t_flag) {
-		fputs(_("Checking for bad blocks in read-only mode\n"), stderr);
+		if (region_fd < 0)
+			fputs(_("Checking for bad blocks in read-only mode\n"),
+			      stderr);
 		pattern_fill(blkbuf + blocks_at_once * block_size,
 			     t_patts[0], block_size);
 	}
@@ -769,6 +788,121 @@ static unsigned int test_nd (int dev, unsigned long last_block,
 	return bb_count;
 }
 
+/*
+ * Split the blocks from from_count to last_block into num_regions
+ * pieces and test each of them in a child process of its own, so
+ * that there are several requests outstanding to the device at once
+ * and one region's comparisons overlap with another's I/O.  The
+ * children send their bad blocks back down a pipe, and we report them
+ * here so that the output and the in-memory list stay in one place.
+ */
+static unsigned int test_regions(unsigned int (*test_func)(int, unsigned long,
+							  int, unsigned long,
+							  unsigned long),
+				 const char *device_name, int open_flag,
+				 unsigned long last_block, int block_size,
+				 unsigned long from_count,
+				 unsigned long blocks_at_once)
+{
+	unsigned long region_size, start, end, bad;
+	unsigned int bb_count = 0;
+	int fds[2], dev, status, failed = 0;
+	pid_t pid;
+	ssize_t got;
+
+	if (pipe(fds) < 0) {
+		com_err(program_name, errno, _("while creating pipe"));
+		exit(1);
+	}
+
+	/* Keep the regions aligned the same way as the reads within them */
+	region_size = (last_block - from_count + num_regions - 1) /
+		num_regions;
+	region_size = ((region_size + blocks_at_once - 1) / blocks_at_once) *
+		blocks_at_once;
+
+	if (v_flag)
+		fprintf(stderr, _("Checking blocks %lu to %lu "
+				  "in %d regions\n"),
+			from_count, last_block, num_regions);
+
+	for (start = from_count; start < last_block; start = end) {
+		end = start + region_size;
+		if (end > last_block || end < start)
+			end = last_block;
+		pid = fork();
+		if (pid < 0) {
+			com_err(program_name, errno, _("while forking"));
+			exit(1);
+		}
+		if (pid)
+			continue;
+
+		/*
+		 * Each child needs its own file descriptor, since the
+		 * file offset and O_DIRECT flag would otherwise be
+		 * shared with the other regions.  Progress reports
+		 * from several processes would only garble each other.
+		 */
+		close(fds[0]);
+		region_fd = fds[1];
+		dev = open(device_name, open_flag);
+		if (dev == -1) {
+			com_err(program_name, errno,
+				_("while trying to open %s"), device_name);
+			exit(1);
+		}
+		current_O_DIRECT = 0;
+		s_flag = 0;
+		v_flag = 0;
+		test_func(dev, end, block_size, start, blocks_at_once);
+		close(dev);
+		_exit(0);
+	}
+	close(fds[1]);
+
+	/*
+	 * The children clean up after themselves when interrupted (see
+	 * test_nd), so wait for them to finish rather than dying first.
+	 */
+	signal(SIGHUP, SIG_IGN);
+	signal(SIGINT, SIG_IGN);
+	signal(SIGTERM, SIG_IGN);
+
+	while (1) {
+		got = read(fds[0], &bad, sizeof(bad));
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got != sizeof(bad))
+			break;
+		bb_count += bb_output(bad);
+	}
+	close(fds[0]);
+
+	while ((pid = wait(&status)) != 0) {
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed++;
+	}
+
+	signal(SIGHUP, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	if (failed) {
+		com_err(program_name, 0,
+			_("testing of %d regions failed"), failed);
+		exit(1);
+	}
+	if (s_flag || v_flag)
+		fputs(_(done_string), stderr);
+	return bb_count;
+}
+
 static void check_mount(char *device_name)
 {
 	errcode_t	retval;
@@ -853,7 +987,7 @@ int main (int argc, char ** argv)
 	
 	if (argc && *argv)
 		program_name = *argv;
-	while ((c = getopt (argc, argv, "b:fi:o:svwnc:p:h:t:X")) != EOF) {
+	while ((c = getopt (argc, argv, "b:fi:o:svwnc:p:r:h:t:X")) != EOF) {
 		switch (c) {
 		case 'b':
 			block_size = strtoul (optarg, &tmp, 0);
@@ -906,6 +1040,15 @@ int main (int argc, char ** argv)
 				exit (1);
 			}
 			break;
+		case 'r':
+			num_regions = strtoul (optarg, &tmp, 0);
+			if (*tmp || num_regions < 1 ||
+			    num_regions > MAX_REGIONS) {
+				com_err (program_name, 0,
+				    "bad number of regions - %s", optarg);
+				exit (1);
+			}
+			break;
 		case 'h':
 			host_device_name = optarg;
 			break;
@@ -1081,8 +1224,14 @@ int main (int argc, char ** argv)
 	do {
 		unsigned int bb_count;
 
-		bb_count = test_func(dev, last_block, block_size,
-				     from_count, blocks_at_once);
+		if (num_regions > 1)
+			bb_count = test_regions(test_func, device_name,
+						open_flag, last_block,
+						block_size, from_count,
+						blocks_at_once);
+		else
+			bb_count = test_func(dev, last_block, block_size,
+					     from_count, blocks_at_once);
 		if (bb_count)
 			passes_clean = 0;
 		else
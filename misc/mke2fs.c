@@ -55,7 +55,7 @@ extern int optind;
 #include "../version.h"
 #include "nls-enable.h"
 
-#define STRIDE_LENGTH 8
+#define ZERO_BUFFER_SIZE	(4*1024*1024)	/* Bytes zeroed per write */
 
 #ifndef __sparc__
 #define ZAP_BOOTBLOCK
@@ -78,6 +78,7 @@ int	journal_size;
 int	journal_flags;
 char	*bad_blocks_filename;
 __u32	fs_stride;
+int	zeroout = 1;	/* Let the device zero blocks, if it can */
 
 struct ext2_super_block fs_param;
 char *creator_os;
@@ -348,6 +349,10 @@ static void progress_close(struct progress_struct *progress)
  * and _ret_count_ if they are non-NULL pointers.  Returns 0 on
  * success, and an error code on an error.
  *
+ * If the device can zero the blocks itself (see io_channel_zeroout),
+ * we let it; otherwise the zeros are written ZERO_BUFFER_SIZE bytes at
+ * a time.
+ *
  * As a special case, if the first argument is NULL, then it will
  * attempt to free the static zeroizing buffer.  (This is to keep
  * programs that check for memory leaks happy.)
@@ -356,7 +361,7 @@ static errcode_t zero_blocks(ext2_filsys fs, blk_t blk, int num,
 			     struct progress_struct *progress,
 			     blk_t *ret_blk, int *ret_count)
 {
-	int		j, count, next_update, next_update_incr;
+	int		j, count, stride, next_update, next_update_incr;
 	static char	*buf;
 	errcode_t	retval;
 
@@ -368,26 +373,35 @@ static errcode_t zero_blocks(ext2_filsys fs, blk_t blk, int num,
 		}
 		return 0;
 	}
+	/*
+	 * Once the device has failed to zero blocks for us, don't
+	 * bother asking again.
+	 */
+	if (zeroout) {
+		if (io_channel_zeroout(fs->io, blk, num) == 0)
+			return 0;
+		zeroout = 0;
+	}
+	stride = ZERO_BUFFER_SIZE / fs->blocksize;
 	/* Allocate the zeroizing buffer if necessary */
 	if (!buf) {
-        //一次性清空8个block
-		buf = malloc(fs->blocksize * STRIDE_LENGTH);
+		buf = malloc(ZERO_BUFFER_SIZE);
 		if (!buf) {
 			com_err("malloc", ENOMEM,
 				_("while allocating zeroizing buffer"));
 			exit(1);
 		}
-		memset(buf, 0, fs->blocksize * STRIDE_LENGTH);
+		memset(buf, 0, ZERO_BUFFER_SIZE);
 	}
 	/* OK, do the write loop */
 	next_update = 0;
 	next_update_incr = num / 100;
 	if (next_update_incr < 1)
 		next_update_incr = 1;
-	for (j=0; j < num; j += STRIDE_LENGTH, blk += STRIDE_LENGTH) {
+	for (j=0; j < num; j += stride, blk += stride) {
 		count = num - j;
-		if (count > STRIDE_LENGTH)
-			count = STRIDE_LENGTH;
+		if (count > stride)
+			count = stride;
 		retval = io_channel_write_blk(fs->io, blk, count, buf);
 		if (retval) {
 			if (ret_count)
@@ -406,12 +420,26 @@ static errcode_t zero_blocks(ext2_filsys fs, blk_t blk, int num,
 }	
 
 //清空inode table所在的block
-static void write_inode_tables(ext2_filsys fs)
+static void zero_inode_tables(ext2_filsys fs, blk_t blk, int num)
 {
 	errcode_t	retval;
-	blk_t		blk;
+
+	if (!num)
+		return;
+	retval = zero_blocks(fs, blk, num, 0, &blk, &num);
+	if (retval) {
+		fprintf(stderr, _("\nCould not write %d "
+			"blocks in inode table starting at %u: %s\n"),
+			num, blk, error_message(retval));
+		exit(1);
+	}
+}
+
+static void write_inode_tables(ext2_filsys fs)
+{
+	blk_t		blk, run_start = 0;
 	dgrp_t		i;
-	int		num;
+	int		num, run = 0;
 	struct progress_struct progress;
 	int		lazy_flag = 0;
 
@@ -434,22 +462,29 @@ static void write_inode_tables(ext2_filsys fs)
 
 		if (!(lazy_flag &&
 		      (fs->group_desc[i].bg_flags & EXT2_BG_INODE_UNINIT))) {
-            //清空inode table所在的block
-			retval = zero_blocks(fs, blk, num, 0, &blk, &num);
-			if (retval) {
-				fprintf(stderr, _("\nCould not write %d "
-				"blocks in inode table starting at %u: %s\n"),
-					num, blk, error_message(retval));
-				exit(1);
+			/*
+			 * Inode tables which follow each other on disk
+			 * are zeroed together.
+			 */
+			if (run && run_start + run == blk)
+				run += num;
+			else {
+				//清空inode table所在的block
+				zero_inode_tables(fs, run_start, run);
+				run_start = blk;
+				run = num;
 			}
 		}
 		if (sync_kludge) {
+			zero_inode_tables(fs, run_start, run);
+			run = 0;
 			if (sync_kludge == 1)
 				sync();
 			else if ((i % sync_kludge) == 0)
 				sync();
 		}
 	}
+	zero_inode_tables(fs, run_start, run);
     //清空zero_blocks所用的buf
 	zero_blocks(0, 0, 0, 0, 0, 0);
 	progress_close(&progress);
@@ -891,6 +926,10 @@ static void parse_extended_opts(struct ext2_super_block *param,
 
 				param->s_reserved_gdt_blocks = rsv_gdb;
 			}
+		} else if (!strcmp(token, "zeroout")) {
+			zeroout = 1;
+		} else if (!strcmp(token, "nozeroout")) {
+			zeroout = 0;
 		} else
 			r_usage++;
 	}
@@ -901,7 +940,9 @@ static void parse_extended_opts(struct ext2_super_block *param,
 			"\tis set off by an equals ('=') sign.\n\n"
 			"Valid extended options are:\n"
 			"\tstride=<stride length in blocks>\n"
-			"\tresize=<resize maximum size in blocks>\n\n"));
+			"\tresize=<resize maximum size in blocks>\n"
+			"\tzeroout\n"
+			"\tnozeroout\n\n"));
 		exit(1);
 	}
 }	
@@ -770,7 +770,15 @@ int main (int argc, char ** argv)
 #else
 	io_ptr = unix_io_manager;
 #endif
-	retval = ext2fs_open2(device_name, io_options, open_flag, 
+	/*
+	 * Removing a journal only touches the bitmaps of the groups
+	 * holding its blocks, so there is no need to read them all.
+	 * Options which only change the mount count or check time
+	 * don't need to rewrite the backup superblocks.
+	 */
+	retval = ext2fs_open2(device_name, io_options,
+			      open_flag | EXT2_FLAG_LAZY_BITMAPS |
+			      EXT2_FLAG_DEFER_BACKUPS,
 			      0, 0, io_ptr, &fs);
         if (retval) {
 		com_err (program_name, retval, _("while trying to open %s"),
@@ -29,6 +29,7 @@ struct _ext2_extent {
 	int	size;
 	int	num;
 	int	sorted;
+	int	hint;		/* Entry found by the last lookup */
 };
 
 /*
@@ -85,7 +86,7 @@ errcode_t ext2fs_add_extent_entry(ext2_extent extent, __u32 old_loc, __u32 new_l
 	int				curr;
 
 	if (extent->num >= extent->size) {
-		newsize = extent->size + 100;
+		newsize = extent->size * 2;
 		retval = ext2fs_resize_mem(sizeof(struct ext2_extent_entry) * 
 					   extent->size, 
 					   sizeof(struct ext2_extent_entry) * 
@@ -132,30 +133,82 @@ static EXT2_QSORT_TYPE extent_cmp(const void *a, const void *b)
 	db_a = (const struct ext2_extent_entry *) a;
 	db_b = (const struct ext2_extent_entry *) b;
 	
-	return (db_a->old_loc - db_b->old_loc);
+	if (db_a->old_loc < db_b->old_loc)
+		return -1;
+	return (db_a->old_loc > db_b->old_loc);
 }	
 
+/*
+ * Sort the extent table, and merge any entries which turn out to be
+ * contiguous once they are in order.
+ */
+static void sort_extent_table(ext2_extent extent)
+{
+	struct ext2_extent_entry *ent, *last;
+	int	i;
+
+	qsort(extent->list, extent->num,
+	      sizeof(struct ext2_extent_entry), extent_cmp);
+	last = extent->list;
+	for (i = 1, ent = last + 1; i < extent->num; i++, ent++) {
+		if ((last->old_loc + last->size == ent->old_loc) &&
+		    (last->new_loc + last->size == ent->new_loc)) {
+			last->size += ent->size;
+			continue;
+		}
+		*++last = *ent;
+	}
+	if (extent->num)
+		extent->num = last - extent->list + 1;
+	extent->sorted = 1;
+	extent->hint = 0;
+}
+
 /*
  * Given an inode map and inode number, look up the old inode number
  * and return the new inode number.
  */
 __u32 ext2fs_extent_translate(ext2_extent extent, __u32 old_loc)
 {
+	struct ext2_extent_entry *ent;
 	int	low, high, mid;
 	__u32	lowval, highval;
 	float	range;
 
-	if (!extent->sorted) {
-		qsort(extent->list, extent->num,
-		      sizeof(struct ext2_extent_entry), extent_cmp);
-		extent->sorted = 1;
+	if (!extent->sorted)
+		sort_extent_table(extent);
+	if (!extent->num)
+		return 0;
+
+	/* Most locations looked up aren't being moved at all */
+	ent = extent->list + extent->num - 1;
+	if ((old_loc < extent->list[0].old_loc) ||
+	    (old_loc >= ent->old_loc + ent->size))
+		return 0;
+
+	/*
+	 * Callers tend to look up locations in ascending order (the
+	 * blocks of a file, or the entries of the inode table), so
+	 * try the entry found last time and the one after it before
+	 * searching the whole table.
+	 */
+	ent = extent->list + extent->hint;
+	if (old_loc >= ent->old_loc) {
+		if (old_loc < ent->old_loc + ent->size)
+			return ent->new_loc + (old_loc - ent->old_loc);
+		if ((extent->hint + 1 == extent->num) ||
+		    (old_loc < ent[1].old_loc))
+			return 0;
+		ent++;
+		if (old_loc < ent->old_loc + ent->size) {
+			extent->hint++;
+			return ent->new_loc + (old_loc - ent->old_loc);
+		}
 	}
+
 	low = 0;
 	high = extent->num-1;
 	while (low <= high) {
-#if 0
-		mid = (low+high)/2;
-#else
 		if (low == high)
 			mid = low;
 		else {
@@ -172,16 +225,19 @@ __u32 ext2fs_extent_translate(ext2_extent extent, __u32 old_loc)
 					(highval - lowval);
 			mid = low + ((int) (range * (high-low)));
 		}
-#endif
-		if ((old_loc >= extent->list[mid].old_loc) &&
-		    (old_loc < extent->list[mid].old_loc + extent->list[mid].size))
-			return (extent->list[mid].new_loc +
-				(old_loc - extent->list[mid].old_loc));
-		if (old_loc < extent->list[mid].old_loc)
+		ent = extent->list + mid;
+		if ((old_loc >= ent->old_loc) &&
+		    (old_loc < ent->old_loc + ent->size)) {
+			extent->hint = mid;
+			return ent->new_loc + (old_loc - ent->old_loc);
+		}
+		if (old_loc < ent->old_loc)
 			high = mid-1;
 		else
 			low = mid+1;
 	}
+	/* Leave the hint at the entry just before old_loc */
+	extent->hint = (high > 0) ? high : 0;
 	return 0;
 }
 
@@ -896,29 +896,52 @@ static blk_t get_new_block(ext2_resize_t rfs)
 	}
 }
 
+/*
+ * Blocks are copied in chunks of up to this many bytes.  This can be
+ * changed by setting RESIZE2FS_MOVE_SIZE to the chunk size in
+ * kilobytes, up to RESIZE_MOVE_MAX bytes, which keeps the byte counts
+ * of the reads and writes well within an int.
+ */
+#define RESIZE_MOVE_SIZE	(4 * 1024 * 1024)
+#define RESIZE_MOVE_MAX		(64 * 1024 * 1024)
+
+static int move_chunk_blocks(ext2_filsys fs)
+{
+	unsigned long	bytes = RESIZE_MOVE_SIZE;
+	char		*tmp;
+	int		blocks;
+
+	tmp = getenv("RESIZE2FS_MOVE_SIZE");
+	if (tmp && atoi(tmp) > 0) {
+		bytes = atoi(tmp);
+		if (bytes > RESIZE_MOVE_MAX / 1024)
+			bytes = RESIZE_MOVE_MAX / 1024;
+		bytes *= 1024;
+	}
+	blocks = bytes / fs->blocksize;
+	if (blocks < 1)
+		blocks = 1;
+	return blocks;
+}
+
 static errcode_t block_mover(ext2_resize_t rfs)
 {
 	blk_t			blk, old_blk, new_blk;
+	blk_t			next_old, next_new;
 	ext2_filsys		fs = rfs->new_fs;
 	ext2_filsys		old_fs = rfs->old_fs;
 	errcode_t		retval;
-	int			size, c;
+	int			size, next_size, c, max;
 	int			to_move, moved;
 	ext2_badblocks_list	badblock_list = 0;
 	int			bb_modified = 0;
+	char			*buf = 0;
 	
 	retval = ext2fs_read_bb_inode(old_fs, &badblock_list);
 	if (retval)
 		return retval;
 
 	new_blk = fs->super->s_first_data_block;
-	if (!rfs->itable_buf) {
-		retval = ext2fs_get_mem(fs->blocksize *
-					fs->inode_blocks_per_group,
-					&rfs->itable_buf);
-		if (retval)
-			return retval;
-	}
 	retval = ext2fs_create_extent_table(&rfs->bmap, 0);
 	if (retval)
 		return retval;
@@ -961,8 +984,20 @@ static errcode_t block_mover(ext2_resize_t rfs)
 	}
 
 	/*
-	 * Step two is to actually move the blocks
+	 * Step two is to actually move the blocks.  They are copied
+	 * in large chunks, and while each chunk is being copied the
+	 * next one is read ahead, so that the device is kept busy
+	 * instead of waiting for each read in turn.  The copies
+	 * don't need to reach the disk until the inodes are updated
+	 * to point at them, so there is just one flush at the end.
 	 */
+	max = move_chunk_blocks(fs);
+	if (max > to_move)
+		max = to_move;
+	retval = ext2fs_get_mem(fs->blocksize * max, &buf);
+	if (retval)
+		goto errout;
+
 	retval =  ext2fs_iterate_extent(rfs->bmap, 0, 0, 0);
 	if (retval) goto errout;
 
@@ -972,11 +1007,12 @@ static errcode_t block_mover(ext2_resize_t rfs)
 		if (retval)
 			goto errout;
 	}
-	while (1) {
-		retval = ext2fs_iterate_extent(rfs->bmap, &old_blk, &new_blk, &size);
+	retval = ext2fs_iterate_extent(rfs->bmap, &old_blk, &new_blk, &size);
+	if (retval) goto errout;
+	while (size) {
+		retval = ext2fs_iterate_extent(rfs->bmap, &next_old,
+					       &next_new, &next_size);
 		if (retval) goto errout;
-		if (!size)
-			break;
 #ifdef RESIZE2FS_DEBUG
 		if (rfs->flags & RESIZE_DEBUG_BMOVE)
 			printf("Moving %d blocks %u->%u\n",
@@ -984,20 +1020,25 @@ static errcode_t block_mover(ext2_resize_t rfs)
 #endif
 		do {
 			c = size;
-			if (c > fs->inode_blocks_per_group)
-				c = fs->inode_blocks_per_group;
-			retval = io_channel_read_blk(fs->io, old_blk, c,
-						     rfs->itable_buf);
+			if (c > max)
+				c = max;
+			if (size > c)
+				io_channel_readahead(fs->io, old_blk + c,
+						     (size - c > max) ?
+						     max : size - c);
+			else if (next_size)
+				io_channel_readahead(fs->io, next_old,
+						     (next_size > max) ?
+						     max : next_size);
+			retval = io_channel_read_blk(fs->io, old_blk, c, buf);
 			if (retval) goto errout;
-			retval = io_channel_write_blk(fs->io, new_blk, c,
-						      rfs->itable_buf);
+			retval = io_channel_write_blk(fs->io, new_blk, c, buf);
 			if (retval) goto errout;
 			size -= c;
 			new_blk += c;
 			old_blk += c;
 			moved += c;
 			if (rfs->progress) {
-				io_channel_flush(fs->io);
 				retval = (rfs->progress)(rfs,
 						E2_RSZ_BLOCK_RELOC_PASS,
 						moved, to_move);
@@ -1005,10 +1046,15 @@ static errcode_t block_mover(ext2_resize_t rfs)
 					goto errout;
 			}
 		} while (size > 0);
-		io_channel_flush(fs->io);
+		old_blk = next_old;
+		new_blk = next_new;
+		size = next_size;
 	}
+	retval = io_channel_flush(fs->io);
 
 errout:
+	if (buf)
+		ext2fs_free_mem(&buf);
 	if (badblock_list) {
 		if (!retval && bb_modified)
 			retval = ext2fs_update_bb_inode(old_fs,
@@ -1112,12 +1158,37 @@ static errcode_t inode_scan_and_fix(ext2_resize_t rfs)
 	char			*block_buf = 0;
 	ext2_ino_t		start_to_move;
 	blk_t			orig_size, new_block;
+	int			collect_dirs;
 	
 	if ((rfs->old_fs->group_desc_count <=
 	     rfs->new_fs->group_desc_count) &&
 	    !rfs->bmap)
 		return 0;
 
+	/*
+	 * If no blocks are being moved, the scan is only needed to
+	 * renumber the inodes in the block groups being removed, so
+	 * skip it if none of them are in use.
+	 */
+	start_to_move = (rfs->new_fs->group_desc_count *
+			 rfs->new_fs->super->s_inodes_per_group);
+	if (!rfs->bmap) {
+		for (ino = start_to_move + 1;
+		     ino <= rfs->old_fs->super->s_inodes_count; ino++)
+			if (ext2fs_fast_test_inode_bitmap(rfs->old_fs->inode_map,
+							  ino))
+				break;
+		if (ino > rfs->old_fs->super->s_inodes_count)
+			return 0;
+	}
+
+	/*
+	 * The directory blocks are collected for inode_ref_fix(),
+	 * which is only needed if inodes may be renumbered.
+	 */
+	collect_dirs = (rfs->old_fs->group_desc_count >
+			rfs->new_fs->group_desc_count);
+
 	/*
 	 * Save the original size of the old filesystem, and
 	 * temporarily set the size to be the new size if the new size
@@ -1132,14 +1203,13 @@ static errcode_t inode_scan_and_fix(ext2_resize_t rfs)
 	retval = ext2fs_open_inode_scan(rfs->old_fs, 0, &scan);
 	if (retval) goto errout;
 
-	retval = ext2fs_init_dblist(rfs->old_fs, 0);
-	if (retval) goto errout;
+	if (collect_dirs) {
+		retval = ext2fs_init_dblist(rfs->old_fs, 0);
+		if (retval) goto errout;
+	}
 	retval = ext2fs_get_mem(rfs->old_fs->blocksize * 3, &block_buf);
 	if (retval) goto errout;
 
-	start_to_move = (rfs->new_fs->group_desc_count *
-			 rfs->new_fs->super->s_inodes_per_group);
-	
 	if (rfs->progress) {
 		retval = (rfs->progress)(rfs, E2_RSZ_INODE_SCAN_PASS,
 					 0, rfs->old_fs->group_desc_count);
@@ -1164,7 +1234,7 @@ static errcode_t inode_scan_and_fix(ext2_resize_t rfs)
 		if (inode.i_links_count == 0 && ino != EXT2_RESIZE_INO)
 			continue; /* inode not in use */
 
-		pb.is_dir = LINUX_S_ISDIR(inode.i_mode);
+		pb.is_dir = collect_dirs && LINUX_S_ISDIR(inode.i_mode);
 		pb.changed = 0;
 
 		if (inode.i_file_acl && rfs->bmap) {
@@ -1260,6 +1330,7 @@ struct istruct {
 	errcode_t	err;
 	unsigned long	max_dirs;
 	int		num;
+	ext2fs_inode_bitmap changed_dirs;
 };
 
 static int check_and_change_inodes(ext2_ino_t dir, 
@@ -1270,12 +1341,9 @@ static int check_and_change_inodes(ext2_ino_t dir,
 				   void *priv_data)
 {
 	struct istruct *is = (struct istruct *) priv_data;
-	struct ext2_inode 	inode;
 	ext2_ino_t		new_inode;
-	errcode_t		retval;
 
 	if (is->rfs->progress && offset == 0) {
-		io_channel_flush(is->rfs->old_fs->io);
 		is->err = (is->rfs->progress)(is->rfs,
 					      E2_RSZ_INODE_REF_UPD_PASS,
 					      ++is->num, is->max_dirs);
@@ -1299,16 +1367,37 @@ static int check_and_change_inodes(ext2_ino_t dir,
 
 	dirent->inode = new_inode;
 
-	/* Update the directory mtime and ctime */
-	retval = ext2fs_read_inode(is->rfs->old_fs, dir, &inode);
-	if (retval == 0) {
-		inode.i_mtime = inode.i_ctime = time(0);
-		ext2fs_write_inode(is->rfs->old_fs, dir, &inode);
-	}
+	/* The directory's times are updated once it's all been fixed */
+	ext2fs_mark_inode_bitmap(is->changed_dirs, dir);
 
 	return DIRENT_CHANGED;
 }
 
+/*
+ * Update the mtime and ctime of each directory that had entries
+ * changed.  Directories which were themselves renumbered live at
+ * their new inode number by now.
+ */
+static void touch_changed_dirs(ext2_resize_t rfs,
+			       ext2fs_inode_bitmap changed_dirs)
+{
+	struct ext2_inode 	inode;
+	ext2_ino_t		ino, dir;
+	time_t			now = time(0);
+
+	for (ino = 1; ino <= rfs->old_fs->super->s_inodes_count; ino++) {
+		if (!ext2fs_fast_test_inode_bitmap(changed_dirs, ino))
+			continue;
+		dir = ext2fs_extent_translate(rfs->imap, ino);
+		if (!dir)
+			dir = ino;
+		if (ext2fs_read_inode(rfs->old_fs, dir, &inode) == 0) {
+			inode.i_mtime = inode.i_ctime = now;
+			ext2fs_write_inode(rfs->old_fs, dir, &inode);
+		}
+	}
+}
+
 static errcode_t inode_ref_fix(ext2_resize_t rfs)
 {
 	errcode_t		retval;
@@ -1325,6 +1414,13 @@ static errcode_t inode_ref_fix(ext2_resize_t rfs)
 	is.max_dirs = ext2fs_dblist_count(rfs->old_fs->dblist);
 	is.rfs = rfs;
 	is.err = 0;
+	is.changed_dirs = 0;
+
+	retval = ext2fs_allocate_inode_bitmap(rfs->old_fs,
+					      _("changed directories"),
+					      &is.changed_dirs);
+	if (retval)
+		goto errout;
 
 	if (rfs->progress) {
 		retval = (rfs->progress)(rfs, E2_RSZ_INODE_REF_UPD_PASS,
@@ -1342,8 +1438,12 @@ static errcode_t inode_ref_fix(ext2_resize_t rfs)
 		retval = is.err;
 		goto errout;
 	}
+	touch_changed_dirs(rfs, is.changed_dirs);
+	retval = io_channel_flush(rfs->old_fs->io);
 
 errout:
+	if (is.changed_dirs)
+		ext2fs_free_inode_bitmap(is.changed_dirs);
 	ext2fs_free_extent_table(rfs->imap);
 	rfs->imap = 0;
 	return retval;
@@ -16,6 +16,60 @@
 
 void do_test(FILE *in, FILE *out);
 
+/*
+ * Build a table of num_extents runs of moved blocks, scattered over
+ * a filesystem with gaps between them, and time num_lookups lookups
+ * against it: first walking through the blocks in order, the way
+ * process_block() does, and then at random.
+ */
+static void do_bench(FILE *out, int num_extents, int num_lookups)
+{
+	ext2_extent	extent;
+	errcode_t	retval;
+	struct timeval	start, end;
+	__u32		blk, max_blk, found;
+	int		i, j, len;
+
+	retval = ext2fs_create_extent_table(&extent, 0);
+	if (retval) {
+		fprintf(out, "# Error: %s\n", error_message(retval));
+		return;
+	}
+	srandom(42);
+	blk = 1;
+	for (i = 0; i < num_extents; i++) {
+		blk += 1 + random() % 64;
+		len = 1 + random() % 32;
+		for (j = 0; j < len; j++, blk++)
+			ext2fs_add_extent_entry(extent, blk, blk + 0x10000000);
+	}
+	max_blk = blk + 64;
+
+	gettimeofday(&start, 0);
+	for (i = 0, found = 0, blk = 0; i < num_lookups; i++) {
+		if (ext2fs_extent_translate(extent, blk))
+			found++;
+		if (++blk >= max_blk)
+			blk = 0;
+	}
+	gettimeofday(&end, 0);
+	fprintf(out, "# Sequential: %d lookups, %u found, %.3f seconds\n",
+		num_lookups, found, (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1000000.0);
+
+	gettimeofday(&start, 0);
+	for (i = 0, found = 0; i < num_lookups; i++) {
+		if (ext2fs_extent_translate(extent, random() % max_blk))
+			found++;
+	}
+	gettimeofday(&end, 0);
+	fprintf(out, "# Random: %d lookups, %u found, %.3f seconds\n",
+		num_lookups, found, (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1000000.0);
+
+	ext2fs_free_extent_table(extent);
+}
+
 void do_test(FILE *in, FILE *out)
 {
 	char		buf[128];
@@ -64,6 +118,10 @@ void do_test(FILE *in, FILE *out)
 			num2 = strtoul(arg2, 0, 0);
 		}
 		
+		if (!strcmp(cmd, "bench")) {
+			do_bench(out, num1, num2);
+			continue;
+		}
 		if (!strcmp(cmd, "create")) {
 			retval = ext2fs_create_extent_table(&extent, num1);
 			if (retval) {
@@ -17,6 +17,7 @@
 #include <getopt.h>
 #endif
 #include <fcntl.h>
+#include <time.h>
 
 #include <ext2fs/ext2_fs.h>
 
@@ -70,8 +71,18 @@ void do_create_icount(int argc, char **argv)
 	progname = *argv;
 	argv++; argc --;
 
-	if (argc && !strcmp("-i", *argv)) {
-		flags |= EXT2_ICOUNT_OPT_INCREMENT;
+	while (argc && argv[0][0] == '-') {
+		if (!strcmp("-i", *argv))
+			flags |= EXT2_ICOUNT_OPT_INCREMENT;
+		else if (!strcmp("-h", *argv))
+			flags |= EXT2_ICOUNT_OPT_HASH;
+		else if (!strcmp("-m", *argv))
+			flags |= EXT2_ICOUNT_OPT_FULLMAP;
+		else {
+			com_err(progname, 0,
+				"Usage: %s [-i] [-h|-m] [size]", progname);
+			return;
+		}
 		argv++; argc--;
 	}
 	if (argc) {
@@ -219,6 +230,103 @@ void do_dump(int argc, char **argv)
 	}
 }
 
+/*
+ * Run a deterministic stream of random operations against the icount
+ * structure, checking each result against a simple array of counts.
+ * With -t, also report how long it took, which is useful for
+ * comparing the different icount backends.
+ */
+void do_stress(int argc, char **argv)
+{
+	const char	*usage = "usage: %s [-t] count [seed]\n";
+	errcode_t	retval;
+	__u16		*shadow = 0, count;
+	unsigned long	i, num_ops, seed = 1, errors = 0;
+	ext2_ino_t	ino, num_inodes;
+	int		timing = 0, op;
+	clock_t		start;
+	char		*tmp;
+
+	if (check_icount(argv[0]))
+		return;
+	argv++; argc--;
+	if (argc && !strcmp("-t", *argv)) {
+		timing++;
+		argv++; argc--;
+	}
+	if (argc < 1 || argc > 2) {
+		printf(usage, "stress");
+		return;
+	}
+	num_ops = strtoul(argv[0], &tmp, 0);
+	if (*tmp) {
+		com_err("stress", 0, "Bad count - %s", argv[0]);
+		return;
+	}
+	if (argc > 1) {
+		seed = strtoul(argv[1], &tmp, 0);
+		if (*tmp) {
+			com_err("stress", 0, "Bad seed - %s", argv[1]);
+			return;
+		}
+	}
+
+	num_inodes = test_fs->super->s_inodes_count;
+	retval = ext2fs_get_mem((num_inodes + 1) * sizeof(__u16), &shadow);
+	if (retval) {
+		com_err("stress", retval, "while allocating count array");
+		return;
+	}
+	for (ino = 1; ino <= num_inodes; ino++) {
+		retval = ext2fs_icount_fetch(test_icount, ino, &shadow[ino]);
+		if (retval) {
+			com_err("stress", retval, "while fetching icount "
+				"for %lu", (unsigned long) ino);
+			goto out;
+		}
+	}
+
+	start = clock();
+	for (i = 0; i < num_ops; i++) {
+		seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+		ino = (seed >> 4) % num_inodes + 1;
+		op = seed % 10;
+		if (op < 5) {
+			retval = ext2fs_icount_increment(test_icount, ino,
+							 &count);
+			shadow[ino]++;
+		} else if (op < 7) {
+			retval = ext2fs_icount_decrement(test_icount, ino,
+							 &count);
+			if (!shadow[ino]) {
+				if (retval != EXT2_ET_INVALID_ARGUMENT)
+					errors++;
+				continue;
+			}
+			shadow[ino]--;
+		} else if (op < 8) {
+			count = (seed >> 8) % 4;
+			retval = ext2fs_icount_store(test_icount, ino, count);
+			shadow[ino] = count;
+		} else
+			retval = ext2fs_icount_fetch(test_icount, ino, &count);
+		if (retval || count != shadow[ino])
+			errors++;
+	}
+	if (timing)
+		printf("%lu operations took %.3f seconds\n", num_ops,
+		       (double) (clock() - start) / CLOCKS_PER_SEC);
+
+	for (ino = 1; ino <= num_inodes; ino++) {
+		retval = ext2fs_icount_fetch(test_icount, ino, &count);
+		if (retval || count != shadow[ino])
+			errors++;
+	}
+	printf("Stress test finished with %lu errors\n", errors);
+out:
+	ext2fs_free_mem(&shadow);
+}
+
 void do_validate(int argc, char **argv)
 {
 	errcode_t	retval;
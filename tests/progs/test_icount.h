@@ -6,5 +6,6 @@ void do_decrement(int argc, char **argv);
 void do_store(int argc, char **argv);
 void do_get_size(int argc, char **argv);
 void do_dump(int argc, char **argv);
+void do_stress(int argc, char **argv);
 void do_validate(int argc, char **argv);
 